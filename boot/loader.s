@@ -127,10 +127,14 @@ p_mode_start:
   mov gs, ax
 
   ; ---------------- 载入内核 ----------------
+  ; rd_disk_m_32一次最多读255个扇区，分两次读入
   mov eax, KERNEL_START_SECTOR
   mov ebx, KERNEL_BIN_BASE_ADDR
   mov ecx, 200
   call rd_disk_m_32
+  mov eax, KERNEL_START_SECTOR + 200
+  mov ecx, KERNEL_SECTOR_CNT - 200
+  call rd_disk_m_32
 
   call setup_page               ; 创建页表
 
@@ -0,0 +1,519 @@
+#include "ahci.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "pci.h"
+#include "stdio.h"
+#include "stdio-kernel.h"
+#include "string.h"
+#include "thread.h"
+#include "timer.h"
+#include "workqueue.h"
+
+// HBA全局寄存器
+#define HBA_CAP 0x00
+#define HBA_GHC 0x04
+#define HBA_IS 0x08
+#define HBA_PI 0x0c
+#define HBA_CAP_SNCQ (1u << 30)
+#define HBA_GHC_AE (1u << 31)
+#define HBA_GHC_IE (1u << 1)
+
+// 端口寄存器，第n个端口从0x100 + n * 0x80开始
+#define PORT_CLB 0x00
+#define PORT_CLBU 0x04
+#define PORT_FB 0x08
+#define PORT_FBU 0x0c
+#define PORT_IS 0x10
+#define PORT_IE 0x14
+#define PORT_CMD 0x18
+#define PORT_TFD 0x20
+#define PORT_SIG 0x24
+#define PORT_SSTS 0x28
+#define PORT_SCTL 0x2c
+#define PORT_SERR 0x30
+#define PORT_SACT 0x34
+#define PORT_CI 0x38
+
+#define PORT_CMD_ST (1u << 0)
+#define PORT_CMD_FRE (1u << 4)
+#define PORT_CMD_FR (1u << 14)
+#define PORT_CMD_CR (1u << 15)
+// 设备到主机寄存器FIS、PIO Setup、DMA Setup、Set Device Bits、
+// 描述符处理完成，以及各种错误
+#define PORT_INT_MASK 0x7800002f
+#define PORT_INT_ERR 0x78000000
+#define PORT_TFD_BSY 0x80
+#define PORT_TFD_DRQ 0x08
+#define PORT_TFD_ERR 0x01
+#define SATA_SIG_ATA 0x00000101
+
+#define FIS_TYPE_REG_H2D 0x27
+#define ATA_CMD_IDENTIFY 0xec
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_READ_FPDMA 0x60  // NCQ读写，扇区数放在feature字段，count字段放tag
+#define ATA_CMD_WRITE_FPDMA 0x61
+#define ATA_CMD_READ_LOG_EXT 0x2f
+#define ATA_LOG_NCQ_ERROR 0x10  // NCQ命令错误日志页，第0字节低5位是出错的tag
+
+#define AHCI_TIMEOUT_TICKS (5 * IRQ0_FREQUENCY)
+
+static uint32_t abar;  // HBA寄存器的虚拟地址
+static struct ahci_port ports[AHCI_MAX_DISKS];
+static struct disk ahci_disks[AHCI_MAX_DISKS];
+static uint8_t port_cnt;
+
+static inline uint32_t hba_read(uint32_t reg) {
+  return *(volatile uint32_t*)(abar + reg);
+}
+
+static inline void hba_write(uint32_t reg, uint32_t val) {
+  *(volatile uint32_t*)(abar + reg) = val;
+}
+
+static inline uint32_t port_read(struct ahci_port* port, uint32_t reg) {
+  return *(volatile uint32_t*)(port->regs + reg);
+}
+
+static inline void port_write(struct ahci_port* port, uint32_t reg,
+                              uint32_t val) {
+  *(volatile uint32_t*)(port->regs + reg) = val;
+}
+
+static inline struct ahci_cmd_table* slot_table(struct ahci_port* port,
+                                                uint32_t slot) {
+  return (struct ahci_cmd_table*)(port->cmd_tables + slot * PG_SIZE);
+}
+
+// 等寄存器reg中的mask位全部清零，最多等ms毫秒。会睡眠，只能在线程中调用
+static bool port_wait_clear(struct ahci_port* port, uint32_t reg,
+                            uint32_t mask, uint32_t ms) {
+  uint32_t waited = 0;
+  while (port_read(port, reg) & mask) {
+    if (waited >= ms) {
+      return false;
+    }
+    mtime_sleep(mil_seconds_per_intr);
+    waited += mil_seconds_per_intr;
+  }
+  return true;
+}
+
+// 停止命令引擎和FIS接收，规范要求两者都在500ms内停下
+static void port_stop(struct ahci_port* port) {
+  port_write(port, PORT_CMD, port_read(port, PORT_CMD) & ~PORT_CMD_ST);
+  port_wait_clear(port, PORT_CMD, PORT_CMD_CR, 500);
+  port_write(port, PORT_CMD, port_read(port, PORT_CMD) & ~PORT_CMD_FRE);
+  port_wait_clear(port, PORT_CMD, PORT_CMD_FR, 500);
+}
+
+// 清除错误后重新开始处理命令，须等设备不忙才能置ST
+static void port_start(struct ahci_port* port) {
+  port_write(port, PORT_SERR, 0xffffffff);
+  port_write(port, PORT_IS, 0xffffffff);
+  port_write(port, PORT_CMD, port_read(port, PORT_CMD) | PORT_CMD_FRE);
+  port_wait_clear(port, PORT_TFD, PORT_TFD_BSY | PORT_TFD_DRQ, 1000);
+  port_write(port, PORT_CMD, port_read(port, PORT_CMD) | PORT_CMD_ST);
+}
+
+// 发COMRESET复位链路后重启端口：SCTL.DET置1至少1ms再清零，等待链路重新建立
+static void port_reset(struct ahci_port* port) {
+  port_stop(port);
+  port_write(port, PORT_SCTL, (port_read(port, PORT_SCTL) & ~0xf) | 1);
+  mtime_sleep(1);
+  port_write(port, PORT_SCTL, port_read(port, PORT_SCTL) & ~0xf);
+  uint32_t waited = 0;
+  while ((port_read(port, PORT_SSTS) & 0xf) != 3 && waited < 1000) {
+    mtime_sleep(mil_seconds_per_intr);
+    waited += mil_seconds_per_intr;
+  }
+  port_start(port);
+}
+
+// 把buf按物理页追加到PRD表中，物理上相接的页合并为一项，表满时返回false
+static bool prdt_add(struct ahci_prd* prdt, uint32_t* n, void* buf,
+                     uint32_t bytes) {
+  uint32_t vaddr = (uint32_t)buf;
+  while (bytes > 0) {
+    uint32_t phys = addr_v2p(vaddr);
+    uint32_t chunk = PG_SIZE - (vaddr & (PG_SIZE - 1));
+    if (chunk > bytes) {
+      chunk = bytes;
+    }
+    struct ahci_prd* last = *n > 0 ? &prdt[*n - 1] : NULL;
+    if (last != NULL && phys == last->dba + (last->dbc & 0x3fffff) + 1) {
+      last->dbc += chunk;
+    } else {
+      if (*n == AHCI_PRDT_MAX) {
+        return false;
+      }
+      prdt[*n].dba = phys;
+      prdt[*n].dbau = 0;
+      prdt[*n].reserved = 0;
+      prdt[*n].dbc = chunk - 1;
+      (*n)++;
+    }
+    vaddr += chunk;
+    bytes -= chunk;
+  }
+  return true;
+}
+
+// 填写命令表中的寄存器FIS，NCQ命令的扇区数在feature字段，tag在count字段
+static void build_fis(uint8_t* fis, uint8_t cmd, uint32_t lba,
+                      uint32_t sec_cnt, bool ncq, uint32_t slot) {
+  memset(fis, 0, 20);
+  fis[0] = FIS_TYPE_REG_H2D;
+  fis[1] = 0x80;  // 这是一条命令而不是控制寄存器的更新
+  fis[2] = cmd;
+  fis[4] = lba;
+  fis[5] = lba >> 8;
+  fis[6] = lba >> 16;
+  fis[7] = 0x40;  // LBA模式
+  fis[8] = lba >> 24;
+  if (ncq) {
+    fis[3] = sec_cnt;
+    fis[11] = sec_cnt >> 8;
+    fis[12] = slot << 3;
+  } else {
+    fis[12] = sec_cnt;
+    fis[13] = sec_cnt >> 8;
+  }
+}
+
+static void fill_header(struct ahci_port* port, uint32_t slot, bool write,
+                        uint32_t prd_cnt) {
+  struct ahci_cmd_header* hdr = &port->cmd_list[slot];
+  hdr->flags = 5 | (write ? 0x40 : 0);  // 寄存器FIS为5个双字
+  hdr->prdtl = prd_cnt;
+  hdr->prdbc = 0;
+  hdr->ctba = addr_v2p((uint32_t)slot_table(port, slot));
+  hdr->ctbau = 0;
+}
+
+// 请求队列的驱动回调：占一个空闲槽位发出命令后立即返回，由中断完成请求
+static int32_t ahci_do_request(struct request_queue* q, struct request* rq) {
+  struct ahci_port* port = q->queuedata;
+  // 全程关中断，端口开始恢复后命令表不会再被改写，取出的请求放回队列
+  enum intr_status old_status = intr_disable();
+  if (port->recovering) {
+    blk_requeue_request(q, rq);
+    intr_set_status(old_status);
+    return BLK_QUEUED;
+  }
+  uint32_t free_slots = port->slots_mask & ~port->issued;
+  ASSERT(free_slots != 0);
+  uint32_t slot = 0;
+  while (!(free_slots & (1u << slot))) {
+    slot++;
+  }
+
+  struct ahci_cmd_table* table = slot_table(port, slot);
+  uint32_t prd_cnt = 0;
+  struct list_elem* elem = rq->bios.head.next;
+  while (elem != &rq->bios.tail) {
+    struct bio* bio = elem2entry(struct bio, bio_tag, elem);
+    if (!prdt_add(table->prdt, &prd_cnt, bio->buf, bio->sec_cnt * 512)) {
+      intr_set_status(old_status);
+      printk("%s: request at sector %d too fragmented\n", port->disk->name,
+             rq->lba);
+      return -1;
+    }
+    elem = elem->next;
+  }
+  uint8_t cmd;
+  if (port->ncq) {
+    cmd = rq->write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA;
+  } else {
+    cmd = rq->write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+  }
+  build_fis(table->cfis, cmd, rq->lba, rq->sec_cnt, port->ncq, slot);
+  fill_header(port, slot, rq->write, prd_cnt);
+
+  port->slot_rq[slot] = rq;
+  port->issued |= 1u << slot;
+  add_timer(&port->slot_timer[slot], ticks + AHCI_TIMEOUT_TICKS);
+  if (port->ncq) {
+    port_write(port, PORT_SACT, 1u << slot);
+  }
+  port_write(port, PORT_CI, 1u << slot);
+  intr_set_status(old_status);
+  return BLK_QUEUED;
+}
+
+// 在槽位0上轮询执行一条读512字节的命令，用于初始化时的IDENTIFY和
+// 出错后的READ LOG EXT，此时端口中断关闭、没有其他在途命令
+static bool ahci_exec_polled(struct ahci_port* port, uint8_t cmd, uint32_t lba,
+                             uint32_t sec_cnt, void* buf) {
+  struct ahci_cmd_table* table = slot_table(port, 0);
+  uint32_t prd_cnt = 0;
+  prdt_add(table->prdt, &prd_cnt, buf, 512);
+  build_fis(table->cfis, cmd, lba, sec_cnt, false, 0);
+  table->cfis[7] = 0;
+  fill_header(port, 0, false, prd_cnt);
+  port_write(port, PORT_CI, 1);
+  uint32_t deadline = ticks + AHCI_TIMEOUT_TICKS;
+  while (port_read(port, PORT_CI) & 1) {
+    if ((int32_t)(ticks - deadline) >= 0) {
+      return false;
+    }
+    thread_yield();
+  }
+  return !(port_read(port, PORT_TFD) & PORT_TFD_ERR);
+}
+
+// 读NCQ错误日志，返回出错命令的tag。日志读不出来，
+// 或错误与队列命令无关(第0字节最高位NQ置位)时返回-1
+static int32_t ncq_error_tag(struct ahci_port* port) {
+  uint8_t* log = get_kernel_pages(1);
+  if (log == NULL) {
+    return -1;
+  }
+  int32_t tag = -1;
+  if (ahci_exec_polled(port, ATA_CMD_READ_LOG_EXT, ATA_LOG_NCQ_ERROR, 1, log) &&
+      !(log[0] & 0x80)) {
+    tag = log[0] & 0x1f;
+  }
+  mfree_page(PF_KERNEL, log, 1);
+  return tag;
+}
+
+// 端口出错或命令超时后在system_wq中恢复，等待寄存器时可以睡眠。
+// 出错前已经完成的命令照常完成；超时的端口须COMRESET，只让超时的命令失败；
+// NCQ出错时读错误日志，只让出错的tag失败；其余在途命令放回队列重新派发。
+// 找不到出错的命令时全部失败
+static void ahci_recover(struct work_struct* work) {
+  struct ahci_port* port = elem2entry(struct ahci_port, recover_work, work);
+  struct request_queue* q = &port->disk->queue;
+  enum intr_status old_status = intr_disable();
+  uint32_t done = port->issued &
+                  ~(port_read(port, PORT_SACT) | port_read(port, PORT_CI));
+  uint32_t failed = port->timed_out;
+  intr_set_status(old_status);
+
+  if (failed != 0) {
+    port_reset(port);
+  } else {
+    port_stop(port);
+    port_start(port);
+    uint32_t pending = port->issued & ~done;
+    int32_t tag = port->ncq ? ncq_error_tag(port) : -1;
+    failed = tag >= 0 && (pending & (1u << tag)) ? 1u << tag : pending;
+  }
+
+  old_status = intr_disable();
+  uint32_t slot;
+  for (slot = 0; port->issued != 0; slot++) {
+    if (!(port->issued & (1u << slot))) {
+      continue;
+    }
+    struct request* rq = port->slot_rq[slot];
+    port->issued &= ~(1u << slot);
+    port->slot_rq[slot] = NULL;
+    del_timer(&port->slot_timer[slot]);
+    if (done & (1u << slot)) {
+      blk_complete_request(q, rq, 0);
+    } else if (failed & (1u << slot)) {
+      blk_complete_request(q, rq, -1);
+    } else {
+      blk_requeue_request(q, rq);
+    }
+  }
+  port->timed_out = 0;
+  port->recovering = false;
+  port_write(port, PORT_IS, 0xffffffff);
+  port_write(port, PORT_IE, PORT_INT_MASK);
+  intr_set_status(old_status);
+  blk_start_queue(q);
+}
+
+// 在中断或定时器中调用：关掉端口中断、暂停派发，恢复交给system_wq
+static void ahci_start_recovery(struct ahci_port* port) {
+  if (!port->recovering) {
+    port->recovering = true;
+    port_write(port, PORT_IE, 0);
+    blk_stop_queue(&port->disk->queue);
+    queue_work(system_wq, &port->recover_work);
+  }
+}
+
+// 处理一个端口的中断：出错时开始恢复，
+// 否则SACT和CI中都已清零的槽位就是完成的命令
+static void ahci_port_intr(struct ahci_port* port) {
+  uint32_t is = port_read(port, PORT_IS);
+  port_write(port, PORT_IS, is);
+  if (port->recovering) {
+    return;
+  }
+  if (is & PORT_INT_ERR) {
+    printk("%s: port error, is 0x%x tfd 0x%x\n", port->disk->name, is,
+           port_read(port, PORT_TFD));
+    ahci_start_recovery(port);
+    return;
+  }
+  struct request_queue* q = &port->disk->queue;
+  uint32_t done = port->issued &
+                  ~(port_read(port, PORT_SACT) | port_read(port, PORT_CI));
+  uint32_t slot;
+  for (slot = 0; done != 0; slot++) {
+    if (done & (1u << slot)) {
+      done &= ~(1u << slot);
+      port->issued &= ~(1u << slot);
+      del_timer(&port->slot_timer[slot]);
+      blk_complete_request(q, port->slot_rq[slot], 0);
+      port->slot_rq[slot] = NULL;
+    }
+  }
+}
+
+// 命令超时，设备可能已挂死，交给恢复工作COMRESET。
+// 到期后槽位可能刚完成并被新命令重新占用，那时定时器已重新挂上
+static void ahci_timeout(struct timer_list* timer) {
+  struct ahci_port* port = timer->data;
+  uint32_t slot = timer - port->slot_timer;
+  enum intr_status old_status = intr_disable();
+  if (!timer_pending(timer) && (port->issued & (1u << slot)) &&
+      !port->recovering) {
+    printk("%s: command timeout, slot %d tfd 0x%x\n", port->disk->name, slot,
+           port_read(port, PORT_TFD));
+    port->timed_out |= 1u << slot;
+    ahci_start_recovery(port);
+  }
+  intr_set_status(old_status);
+}
+
+// 中断线可能与其他PCI设备共用，IS为0说明不是HBA发的
+static void intr_ahci_handler(void* dev_id UNUSED) {
+  uint32_t is = hba_read(HBA_IS);
+  if (is == 0) {
+    return;
+  }
+  uint8_t idx;
+  for (idx = 0; idx < port_cnt; idx++) {
+    if (is & (1u << ports[idx].port_no)) {
+      ahci_port_intr(&ports[idx]);
+    }
+  }
+  hba_write(HBA_IS, is);
+}
+
+// 为端口分配命令列表、接收FIS区和命令表，识别硬盘并建立请求队列
+static void ahci_port_init(struct ahci_port* port, uint32_t nr_slots,
+                           bool hba_ncq) {
+  port_stop(port);
+  uint8_t* page = get_kernel_pages(1);
+  port->cmd_list = (struct ahci_cmd_header*)page;
+  port->rfis = page + 1024;
+  port->cmd_tables = get_kernel_pages(nr_slots);
+  ASSERT(page != NULL && port->cmd_tables != NULL);
+  port_write(port, PORT_CLB, addr_v2p((uint32_t)port->cmd_list));
+  port_write(port, PORT_CLBU, 0);
+  port_write(port, PORT_FB, addr_v2p((uint32_t)port->rfis));
+  port_write(port, PORT_FBU, 0);
+  port->slots_mask = nr_slots == 32 ? 0xffffffff : (1u << nr_slots) - 1;
+  port->issued = 0;
+  uint32_t slot;
+  for (slot = 0; slot < nr_slots; slot++) {
+    timer_setup(&port->slot_timer[slot], ahci_timeout, port);
+  }
+  init_work(&port->recover_work, ahci_recover);
+  port->recovering = false;
+  port->timed_out = 0;
+  port_write(port, PORT_IE, 0);
+  port_start(port);
+
+  struct disk* hd = port->disk;
+  uint16_t* id_words = get_kernel_pages(1);
+  if (!ahci_exec_polled(port, ATA_CMD_IDENTIFY, 0, 0, id_words)) {
+    printk("    %s identify failed\n", hd->name);
+    mfree_page(PF_KERNEL, id_words, 1);
+    return;
+  }
+  hd->my_channel = NULL;
+  hd->dev_no = port->port_no;
+  hd->dma = true;
+  hd->lba48 = id_words[83] & 0x400;
+  hd->multi_cnt = 1;
+  if (hd->lba48) {
+    hd->sectors = id_words[102] || id_words[103]
+                      ? 0xffffffff
+                      : id_words[100] | (uint32_t)id_words[101] << 16;
+  } else {
+    hd->sectors = id_words[60] | (uint32_t)id_words[61] << 16;
+  }
+  // 第76字第8位表示支持NCQ，第75字低5位是队列深度减1
+  port->ncq = hba_ncq && hd->lba48 && (id_words[76] & 0x100);
+  uint32_t depth = 1;
+  if (port->ncq) {
+    depth = (id_words[75] & 0x1f) + 1;
+    if (depth > nr_slots) {
+      depth = nr_slots;
+    }
+  }
+  mfree_page(PF_KERNEL, id_words, 1);
+  printk("    %s: port %d, %dMB, NCQ depth %d\n", hd->name, port->port_no,
+         hd->sectors >> 11, depth);
+
+  blk_queue_init(&hd->queue, hd->name, ahci_do_request, port);
+  hd->queue.queue_depth = depth;
+  hd->queue.max_sectors = AHCI_MAX_SECTORS;
+  hd->queue.max_segments = AHCI_PRDT_MAX;
+  port_write(port, PORT_IS, 0xffffffff);
+  port_write(port, PORT_IE, PORT_INT_MASK);
+  disk_register(hd, &disk_bdev_ops);
+  disk_scan_partitions(hd);
+}
+
+void ahci_init(void) {
+  // class 0x01、subclass 0x06、prog-if 0x01是AHCI模式的SATA控制器
+  struct pci_device* pdev = pci_find_class(0x01, 0x06);
+  if (pdev == NULL || pdev->prog_if != 0x01) {
+    return;
+  }
+  printk("  ahci_init start\n");
+  // 8259A只有16根中断线，不支持MSI，使用PCI的INTx
+  if (pdev->irq_line >= 16) {
+    printk("  ahci: no legacy interrupt line, disabled\n");
+    return;
+  }
+  pci_set_master(pdev);
+  abar = (uint32_t)ioremap(pdev->bar[5] & 0xfffffff0, 0x1100);
+  ASSERT(abar != 0);
+  hba_write(HBA_GHC, hba_read(HBA_GHC) | HBA_GHC_AE);
+
+  uint32_t cap = hba_read(HBA_CAP);
+  uint32_t nr_slots = ((cap >> 8) & 0x1f) + 1;
+  uint32_t pi = hba_read(HBA_PI);
+  uint8_t port_no;
+  for (port_no = 0; port_no < AHCI_MAX_PORTS && port_cnt < AHCI_MAX_DISKS;
+       port_no++) {
+    if (!(pi & (1u << port_no))) {
+      continue;
+    }
+    uint32_t regs = abar + 0x100 + port_no * 0x80;
+    // 链路已建立(DET为3)且签名为ATA硬盘的端口才使用
+    if ((*(volatile uint32_t*)(regs + PORT_SSTS) & 0xf) != 3 ||
+        *(volatile uint32_t*)(regs + PORT_SIG) != SATA_SIG_ATA) {
+      continue;
+    }
+    struct ahci_port* port = &ports[port_cnt];
+    port->port_no = port_no;
+    port->regs = regs;
+    port->disk = &ahci_disks[port_cnt];
+    // 排在IDE的sda~sdd之后
+    sprintf(port->disk->name, "sd%c", 'e' + port_cnt);
+    port_cnt++;
+  }
+
+  hba_write(HBA_IS, 0xffffffff);
+  hba_write(HBA_GHC, hba_read(HBA_GHC) | HBA_GHC_IE);
+  if (request_irq(pdev->irq_line, intr_ahci_handler, NULL) != 0) {
+    PANIC("ahci_init: irq busy");
+  }
+  uint8_t idx;
+  for (idx = 0; idx < port_cnt; idx++) {
+    ahci_port_init(&ports[idx], nr_slots, cap & HBA_CAP_SNCQ);
+  }
+  printk("  ahci_init done\n");
+}
@@ -0,0 +1,59 @@
+#ifndef __DEVICE_AHCI_H
+#define __DEVICE_AHCI_H
+#include "stdint.h"
+#include "global.h"
+#include "genhd.h"
+#include "timer.h"
+#include "workqueue.h"
+
+#define AHCI_MAX_PORTS 32
+#define AHCI_MAX_SLOTS 32
+#define AHCI_MAX_DISKS 4
+// 每个命令表占一页，除去0x80字节的头部都用作PRD表
+#define AHCI_PRDT_MAX ((PG_SIZE - 0x80) / sizeof(struct ahci_prd))
+#define AHCI_MAX_SECTORS 128
+
+// 命令列表中的一项，每个端口32项
+struct ahci_cmd_header {
+  uint16_t flags;  // 0~4位为命令FIS的双字数，6位表示写
+  uint16_t prdtl;  // PRD表项数
+  volatile uint32_t prdbc;  // 已传输的字节数，由HBA回写
+  uint32_t ctba;   // 命令表物理地址，128字节对齐
+  uint32_t ctbau;
+  uint32_t reserved[4];
+} __attribute__((packed));
+
+struct ahci_prd {
+  uint32_t dba;  // 数据缓冲区物理地址，须2字节对齐
+  uint32_t dbau;
+  uint32_t reserved;
+  uint32_t dbc;  // 0~21位为字节数减1，31位表示完成时中断
+} __attribute__((packed));
+
+struct ahci_cmd_table {
+  uint8_t cfis[64];  // 命令FIS
+  uint8_t acmd[16];
+  uint8_t reserved[48];
+  struct ahci_prd prdt[0];
+} __attribute__((packed));
+
+struct ahci_port {
+  uint8_t port_no;
+  uint32_t regs;                         // 端口寄存器的虚拟地址
+  struct ahci_cmd_header* cmd_list;      // 1KB，与接收FIS的256字节共用一页
+  uint8_t* rfis;
+  uint8_t* cmd_tables;                   // 每个槽位一页
+  bool ncq;                              // 硬盘和HBA都支持原生命令队列
+  uint32_t slots_mask;                   // 可用的命令槽位
+  uint32_t issued;                       // 已发出未完成的槽位
+  struct request* slot_rq[AHCI_MAX_SLOTS];
+  struct timer_list slot_timer[AHCI_MAX_SLOTS];  // 命令超时定时器
+  // 出错或超时后在system_wq中恢复端口，期间请求队列暂停派发
+  struct work_struct recover_work;
+  bool recovering;
+  uint32_t timed_out;  // 超时的槽位，非0时须COMRESET
+  struct disk* disk;
+};
+
+void ahci_init(void);
+#endif
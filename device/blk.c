@@ -0,0 +1,370 @@
+#include "blk.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "thread.h"
+#include "memory.h"
+#include "softirq.h"
+#include "string.h"
+#include "timer.h"
+
+// bio的缓冲区跨越的页数，物理上不连续时每页都要占一个分散/聚集段
+static uint32_t bio_segs(struct bio* bio) {
+  uint32_t start = (uint32_t)bio->buf;
+  uint32_t end = start + bio->sec_cnt * 512 - 1;
+  return (end / PG_SIZE) - (start / PG_SIZE) + 1;
+}
+
+// 两个方向相同且合并后扇区数和段数都不超过上限的请求/bio才能合并
+static bool rq_mergeable(struct request_queue* q, struct request* rq,
+                         bool write, uint32_t sec_cnt, uint32_t nr_segs) {
+  return rq->write == write &&
+         rq->sec_cnt + sec_cnt <= q->max_sectors &&
+         rq->nr_segs + nr_segs <= q->max_segments;
+}
+
+// 取一个空闲请求，没有时等待派发线程归还，需关中断调用
+static struct request* rq_alloc(struct request_queue* q) {
+  while (list_empty(&q->free_requests)) {
+    wait_queue_sleep(&q->rq_wq);
+  }
+  return elem2entry(struct request, queue_tag, list_pop(&q->free_requests));
+}
+
+static void rq_free(struct request_queue* q, struct request* rq) {
+  list_push(&q->free_requests, &rq->queue_tag);
+  wake_up_one(&q->rq_wq);
+}
+
+// 把bio并入已有请求，成功返回true，需关中断调用。
+// 接在某请求之后时再看能否与下一个请求连成一个
+static bool elv_merge(struct request_queue* q, struct bio* bio) {
+  uint32_t nr_segs = bio_segs(bio);
+  struct list_elem* elem = q->requests.head.next;
+  while (elem != &q->requests.tail) {
+    struct request* rq = elem2entry(struct request, queue_tag, elem);
+    if (!rq_mergeable(q, rq, bio->write, bio->sec_cnt, nr_segs)) {
+      elem = elem->next;
+      continue;
+    }
+    if (rq->lba + rq->sec_cnt == bio->lba) {
+      list_append(&rq->bios, &bio->bio_tag);
+      rq->sec_cnt += bio->sec_cnt;
+      rq->nr_segs += nr_segs;
+      q->nr_merges++;
+      if (elem->next != &q->requests.tail) {
+        struct request* next =
+            elem2entry(struct request, queue_tag, elem->next);
+        if (rq->lba + rq->sec_cnt == next->lba &&
+            rq_mergeable(q, rq, next->write, next->sec_cnt,
+                         next->nr_segs)) {
+          list_remove(&next->queue_tag);
+          while (!list_empty(&next->bios)) {
+            list_append(&rq->bios, list_pop(&next->bios));
+          }
+          rq->sec_cnt += next->sec_cnt;
+          rq->nr_segs += next->nr_segs;
+          if ((int32_t)(next->expires - rq->expires) < 0) {
+            rq->expires = next->expires;
+          }
+          rq_free(q, next);
+        }
+      }
+      return true;
+    }
+    if (bio->lba + bio->sec_cnt == rq->lba) {
+      list_push(&rq->bios, &bio->bio_tag);
+      rq->lba = bio->lba;
+      rq->sec_cnt += bio->sec_cnt;
+      rq->nr_segs += nr_segs;
+      q->nr_merges++;
+      return true;
+    }
+    elem = elem->next;
+  }
+  return false;
+}
+
+// 按lba升序插入新请求
+static void elv_add_request(struct request_queue* q, struct request* rq) {
+  struct list_elem* elem = q->requests.head.next;
+  while (elem != &q->requests.tail &&
+         (elem2entry(struct request, queue_tag, elem))->lba <= rq->lba) {
+    elem = elem->next;
+  }
+  list_insert_before(elem, &rq->queue_tag);
+}
+
+// 选出下一个要派发的请求并移出队列，需关中断调用。
+// 有超时的请求时先派发最早到期的，否则按C-LOOK：从磁头位置向上取第一个，
+// 到顶后回到最低的请求，磁头只朝一个方向扫描
+static struct request* elv_next_request(struct request_queue* q) {
+  struct request* expired = NULL;
+  struct request* next = NULL;
+  struct list_elem* elem = q->requests.head.next;
+  while (elem != &q->requests.tail) {
+    struct request* rq = elem2entry(struct request, queue_tag, elem);
+    if ((int32_t)(ticks - rq->expires) >= 0 &&
+        (expired == NULL || (int32_t)(rq->expires - expired->expires) < 0)) {
+      expired = rq;
+    }
+    if (next == NULL && rq->lba >= q->head_pos) {
+      next = rq;
+    }
+    elem = elem->next;
+  }
+  if (expired != NULL) {
+    next = expired;
+  } else if (next == NULL) {
+    next = elem2entry(struct request, queue_tag, q->requests.head.next);
+  }
+  list_remove(&next->queue_tag);
+  q->head_pos = next->lba + next->sec_cnt;
+  return next;
+}
+
+static struct list blk_done_list;  // 驱动在中断中完成、等待BLOCK_SOFTIRQ处理的请求
+
+// 逐个完成请求中的bio并归还请求，需关中断调用
+void blk_end_request(struct request_queue* q, struct request* rq,
+                     int32_t error) {
+  while (!list_empty(&rq->bios)) {
+    struct bio* bio = elem2entry(struct bio, bio_tag, list_pop(&rq->bios));
+    bio->error = error;
+    if (bio->end_io != NULL) {
+      bio->end_io(bio);
+    }
+  }
+  rq_free(q, rq);
+  q->in_flight--;
+  wake_up_one(&q->work_wq);
+}
+
+// 驱动在中断处理程序中调用，只把请求挂到完成队列，
+// bio的回调和唤醒提交者留给BLOCK_SOFTIRQ做，缩短关中断的时间
+void blk_complete_request(struct request_queue* q, struct request* rq,
+                          int32_t error) {
+  enum intr_status old_status = intr_disable();
+  rq->q = q;
+  rq->error = error;
+  list_append(&blk_done_list, &rq->queue_tag);
+  raise_softirq(BLOCK_SOFTIRQ);
+  intr_set_status(old_status);
+}
+
+// 把已交给驱动但未执行的请求放回队列，稍后重新派发，需关中断调用
+void blk_requeue_request(struct request_queue* q, struct request* rq) {
+  elv_add_request(q, rq);
+  q->in_flight--;
+}
+
+// 驱动恢复错误期间不再接收新请求，已经取出的请求由驱动自行放回
+void blk_stop_queue(struct request_queue* q) {
+  enum intr_status old_status = intr_disable();
+  q->stopped = true;
+  intr_set_status(old_status);
+}
+
+void blk_start_queue(struct request_queue* q) {
+  enum intr_status old_status = intr_disable();
+  q->stopped = false;
+  wake_up_one(&q->work_wq);
+  intr_set_status(old_status);
+}
+
+static void blk_done_softirq(void) {
+  enum intr_status old_status = intr_disable();
+  while (!list_empty(&blk_done_list)) {
+    struct request* rq =
+        elem2entry(struct request, queue_tag, list_pop(&blk_done_list));
+    blk_end_request(rq->q, rq, rq->error);
+  }
+  intr_set_status(old_status);
+}
+
+// 每个队列一个派发线程，把请求交给驱动。bio的缓冲区都在内核空间，
+// 驱动在哪个页目录下访问或翻译它们都一样
+static void blk_dispatch_thread(void* arg) {
+  struct request_queue* q = arg;
+  while (1) {
+    enum intr_status old_status = intr_disable();
+    while (q->stopped || list_empty(&q->requests) ||
+           q->in_flight >= q->queue_depth) {
+      wait_queue_sleep(&q->work_wq);
+    }
+    struct request* rq = elv_next_request(q);
+    q->in_flight++;
+    intr_set_status(old_status);
+
+    int32_t ret = q->do_request(q, rq);
+    q->nr_dispatched++;
+    if (ret != BLK_QUEUED) {
+      old_status = intr_disable();
+      blk_end_request(q, rq, ret);
+      intr_set_status(old_status);
+    }
+  }
+}
+
+struct list bdev_list;  // 所有已注册的块设备
+
+void blk_init(void) {
+  list_init(&bdev_list);
+  list_init(&blk_done_list);
+  open_softirq(BLOCK_SOFTIRQ, blk_done_softirq);
+}
+
+void bdev_register(struct block_device* bdev, char* name,
+                   const struct block_device_ops* ops, void* private) {
+  strcpy(bdev->name, name);
+  bdev->ops = ops;
+  bdev->private = private;
+  list_append(&bdev_list, &bdev->bdev_tag);
+}
+
+void blk_queue_init(struct request_queue* q, char* name,
+                    blk_do_request_t* do_request, void* queuedata) {
+  list_init(&q->requests);
+  list_init(&q->free_requests);
+  wait_queue_init(&q->rq_wq);
+  wait_queue_init(&q->work_wq);
+  q->head_pos = 0;
+  q->max_sectors = BLK_MAX_SECTORS;
+  q->max_segments = BLK_MAX_SEGMENTS;
+  q->queue_depth = 1;
+  q->in_flight = 0;
+  q->stopped = false;
+  q->do_request = do_request;
+  q->queuedata = queuedata;
+  q->nr_bios = q->nr_merges = q->nr_dispatched = 0;
+  uint32_t idx;
+  for (idx = 0; idx < BLK_NR_REQUESTS; idx++) {
+    list_init(&q->rq_pool[idx].bios);
+    list_append(&q->free_requests, &q->rq_pool[idx].queue_tag);
+  }
+  thread_start(name, 31, blk_dispatch_thread, q);
+}
+
+void bio_init(struct bio* bio, uint32_t lba, void* buf, uint32_t sec_cnt,
+              bool write) {
+  bio->lba = lba;
+  bio->sec_cnt = sec_cnt;
+  bio->buf = buf;
+  bio->write = write;
+  bio->error = 0;
+  bio->end_io = NULL;
+  bio->private = NULL;
+  bio->bio_tag.prev = bio->bio_tag.next = NULL;
+}
+
+// 异步提交bio，bio本身和buf都须在内核空间，完成前不能释放
+void submit_bio(struct request_queue* q, struct bio* bio) {
+  ASSERT(bio->sec_cnt > 0 && bio->sec_cnt <= q->max_sectors);
+  ASSERT((uint32_t)bio >= 0xc0000000 && (uint32_t)bio->buf >= 0xc0000000);
+  enum intr_status old_status = intr_disable();
+  q->nr_bios++;
+  if (!elv_merge(q, bio)) {
+    struct request* rq = rq_alloc(q);
+    // 等待空闲请求期间别的bio可能已经把相邻扇区排进来了
+    if (elv_merge(q, bio)) {
+      rq_free(q, rq);
+    } else {
+      rq->lba = bio->lba;
+      rq->sec_cnt = bio->sec_cnt;
+      rq->nr_segs = bio_segs(bio);
+      rq->write = bio->write;
+      rq->expires = ticks + BLK_EXPIRE_TICKS;
+      list_append(&rq->bios, &bio->bio_tag);
+      elv_add_request(q, rq);
+    }
+  }
+  wake_up_one(&q->work_wq);
+  intr_set_status(old_status);
+}
+
+static void bio_batch_end_io(struct bio* bio) {
+  struct bio_batch* batch = bio->private;
+  enum intr_status old_status = intr_disable();
+  if (bio->error != 0) {
+    batch->error = bio->error;
+  }
+  if (--batch->pending == 0) {
+    wake_up_all(&batch->wq);
+  }
+  intr_set_status(old_status);
+}
+
+void bio_batch_init(struct bio_batch* batch) {
+  batch->pending = 0;
+  batch->error = 0;
+  wait_queue_init(&batch->wq);
+}
+
+void bio_batch_submit(struct request_queue* q, struct bio_batch* batch,
+                      struct bio* bio) {
+  bio->end_io = bio_batch_end_io;
+  bio->private = batch;
+  enum intr_status old_status = intr_disable();
+  batch->pending++;
+  intr_set_status(old_status);
+  submit_bio(q, bio);
+}
+
+// 等待批中所有bio完成，返回其中任一bio的错误码，全部成功返回0
+int32_t bio_batch_wait(struct bio_batch* batch) {
+  wait_event(&batch->wq, batch->pending == 0);
+  return batch->error;
+}
+
+// 同步读写内核空间中任意数量的扇区：按队列上限切成bio，
+// 每批BLK_BATCH个一起提交再等待
+static int32_t blk_rw_kernel(struct request_queue* q, uint32_t lba, void* buf,
+                             uint32_t sec_cnt, bool write) {
+  struct bio bios[BLK_BATCH];
+  struct bio_batch batch;
+  int32_t error = 0;
+  while (sec_cnt > 0 && error == 0) {
+    bio_batch_init(&batch);
+    uint32_t idx = 0;
+    while (idx < BLK_BATCH && sec_cnt > 0) {
+      uint32_t cnt = sec_cnt < q->max_sectors ? sec_cnt : q->max_sectors;
+      bio_init(&bios[idx], lba, buf, cnt, write);
+      bio_batch_submit(q, &batch, &bios[idx]);
+      lba += cnt;
+      buf = (void*)((uint32_t)buf + cnt * 512);
+      sec_cnt -= cnt;
+      idx++;
+    }
+    error = bio_batch_wait(&batch);
+  }
+  return error;
+}
+
+// 同步读写任意数量的扇区。buf在用户空间时在调用者的上下文中
+// 经内核页分段中转，驱动只接触内核缓冲区
+int32_t blk_rw(struct request_queue* q, uint32_t lba, void* buf,
+               uint32_t sec_cnt, bool write) {
+  if ((uint32_t)buf >= 0xc0000000) {
+    return blk_rw_kernel(q, lba, buf, sec_cnt, write);
+  }
+  void* bounce = get_kernel_pages(BLK_BOUNCE_PAGES);
+  if (bounce == NULL) {
+    return -1;
+  }
+  uint32_t max_cnt = BLK_BOUNCE_PAGES * PG_SIZE / 512;
+  int32_t error = 0;
+  while (sec_cnt > 0 && error == 0) {
+    uint32_t cnt = sec_cnt < max_cnt ? sec_cnt : max_cnt;
+    if (write) {
+      memcpy(bounce, buf, cnt * 512);
+    }
+    error = blk_rw_kernel(q, lba, bounce, cnt, write);
+    if (!write && error == 0) {
+      memcpy(buf, bounce, cnt * 512);
+    }
+    lba += cnt;
+    buf = (void*)((uint32_t)buf + cnt * 512);
+    sec_cnt -= cnt;
+  }
+  mfree_page(PF_KERNEL, bounce, BLK_BOUNCE_PAGES);
+  return error;
+}
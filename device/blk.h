@@ -0,0 +1,129 @@
+#ifndef __DEVICE_BLK_H
+#define __DEVICE_BLK_H
+#include "stdint.h"
+#include "global.h"
+#include "list.h"
+#include "wait_queue.h"
+
+// 块设备请求层：调用者提交bio后立即返回，bio在每个设备的请求队列中与
+// 相邻扇区的请求合并，由设备的派发线程按电梯算法取出交给驱动。
+// 同步驱动在do_request中做完请求，派发线程随即完成它；支持命令队列的驱动
+// 发出命令后返回BLK_QUEUED，完成时在中断中调用blk_complete_request，
+// 请求挂到完成队列后由BLOCK_SOFTIRQ在ksoftirqd中逐个blk_end_request，
+// 同时在途的请求数不超过queue_depth。
+// 派发线程和中断可能运行在任何任务的页目录下，bio的缓冲区必须在内核空间，
+// 用户空间的数据由blk_rw在提交者的上下文中经内核页中转
+
+#define BLK_NR_REQUESTS 32   // 每个队列的请求数上限，用完后提交者阻塞
+#define BLK_MAX_SECTORS 256  // 默认单个请求的最大扇区数
+#define BLK_MAX_SEGMENTS 128
+#define BLK_EXPIRE_TICKS 50  // 请求最长等待时间，超时的优先派发，防止饿死
+#define BLK_BATCH 8          // blk_rw每批提交的bio数
+#define BLK_QUEUED 1         // do_request的返回值，请求已发出，稍后完成
+#define BLK_BOUNCE_PAGES 8   // blk_rw中转用户缓冲区的内核页数
+
+struct bio;
+typedef void bio_end_io_t(struct bio* bio);
+
+struct bio {
+  uint32_t lba;
+  uint32_t sec_cnt;
+  void* buf;
+  bool write;
+  int32_t error;          // 完成后有效，0表示成功
+  bio_end_io_t* end_io;   // 完成回调，在派发线程或ksoftirqd中关中断调用
+  void* private;          // 供end_io使用
+  struct list_elem bio_tag;
+};
+
+struct request_queue;
+
+// 扇区连续、方向相同的一组bio，驱动一次命令完成
+struct request {
+  uint32_t lba;
+  uint32_t sec_cnt;
+  bool write;
+  uint32_t expires;  // 超过此ticks仍未派发则优先派发
+  uint32_t nr_segs;  // 各bio缓冲区跨越的页数之和，是驱动分散/聚集表项数的上限
+  struct list bios;  // 按lba升序，经bio_tag链接
+  struct list_elem queue_tag;
+  struct request_queue* q;  // 以下两项供blk_complete_request记录完成状态
+  int32_t error;
+};
+
+// 驱动执行一个请求，返回0表示成功，BLK_QUEUED表示已发出由驱动稍后完成
+typedef int32_t blk_do_request_t(struct request_queue* q, struct request* rq);
+
+struct request_queue {
+  struct list requests;      // 待派发的请求，按lba升序
+  struct list free_requests;
+  struct wait_queue rq_wq;   // 等待空闲请求的提交者
+  struct wait_queue work_wq; // 派发线程在此等待新请求
+  uint32_t head_pos;         // 上一个请求结束的扇区，C-LOOK从这里向上扫描
+  uint32_t max_sectors;
+  uint32_t max_segments;     // 单个请求最多的分散/聚集段数
+  uint32_t queue_depth;      // 同时交给驱动的请求数上限
+  uint32_t in_flight;
+  bool stopped;              // 驱动在恢复错误，暂停派发
+  blk_do_request_t* do_request;
+  void* queuedata;           // 驱动私有数据
+  uint32_t nr_bios;
+  uint32_t nr_merges;
+  uint32_t nr_dispatched;
+  struct request rq_pool[BLK_NR_REQUESTS];
+};
+
+// 一组bio共享的完成计数，提交者在blk_batch_wait中等全部完成
+struct bio_batch {
+  uint32_t pending;
+  int32_t error;
+  struct wait_queue wq;
+};
+
+struct blk_geometry {
+  uint32_t sectors;      // 总扇区数
+  uint32_t sector_size;  // 字节数，目前都是512
+};
+
+// 块设备：缓冲区层和文件系统只经ops访问设备，不关心背后是
+// 请求队列、DMA还是内存
+struct block_device;
+struct block_device_ops {
+  // 提交bio后立即返回，完成时关中断调用bio->end_io
+  void (*submit)(struct block_device* bdev, struct bio* bio);
+  // 把设备写缓存中的数据写入介质，成功返回0；NULL表示设备没有写缓存
+  int32_t (*flush)(struct block_device* bdev);
+  void (*getgeo)(struct block_device* bdev, struct blk_geometry* geo);
+};
+
+struct block_device {
+  char name[8];
+  const struct block_device_ops* ops;
+  void* private;  // 驱动私有数据
+  struct list_elem bdev_tag;
+};
+
+extern struct list bdev_list;
+
+void blk_init(void);
+void bdev_register(struct block_device* bdev, char* name,
+                   const struct block_device_ops* ops, void* private);
+void blk_queue_init(struct request_queue* q, char* name,
+                    blk_do_request_t* do_request, void* queuedata);
+void bio_init(struct bio* bio, uint32_t lba, void* buf, uint32_t sec_cnt,
+              bool write);
+void submit_bio(struct request_queue* q, struct bio* bio);
+void blk_end_request(struct request_queue* q, struct request* rq,
+                     int32_t error);
+void blk_complete_request(struct request_queue* q, struct request* rq,
+                          int32_t error);
+void blk_requeue_request(struct request_queue* q, struct request* rq);
+void blk_stop_queue(struct request_queue* q);
+void blk_start_queue(struct request_queue* q);
+void bio_batch_init(struct bio_batch* batch);
+void bio_batch_submit(struct request_queue* q, struct bio_batch* batch,
+                      struct bio* bio);
+int32_t bio_batch_wait(struct bio_batch* batch);
+int32_t blk_rw(struct request_queue* q, uint32_t lba, void* buf,
+               uint32_t sec_cnt, bool write);
+#endif
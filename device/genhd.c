@@ -0,0 +1,107 @@
+#include "genhd.h"
+#include "debug.h"
+#include "memory.h"
+#include "stdio.h"
+
+struct list partition_list;  // 所有磁盘上的分区
+
+static uint32_t ext_lba_base;
+static uint8_t p_no = 0, l_no = 0;
+
+struct partition_table_entry {
+  uint8_t bootable;
+  uint8_t start_head;
+  uint8_t start_sec;
+  uint8_t start_chs;
+  uint8_t fs_type;
+  uint8_t end_head;
+  uint8_t end_sec;
+  uint8_t end_chs;
+  uint32_t start_lba;
+  uint32_t sec_cnt;
+} __attribute__((packed));
+
+struct boot_sector {
+  uint8_t other[446];
+  struct partition_table_entry partition_table[4];
+  uint16_t signature;
+} __attribute__((packed));
+
+void genhd_init(void) {
+  list_init(&partition_list);
+}
+
+// 经请求队列的磁盘共用的块设备操作
+void disk_submit(struct block_device* bdev, struct bio* bio) {
+  struct disk* hd = bdev->private;
+  ASSERT(bio->lba + bio->sec_cnt <= hd->sectors);
+  submit_bio(&hd->queue, bio);
+}
+
+void disk_getgeo(struct block_device* bdev, struct blk_geometry* geo) {
+  struct disk* hd = bdev->private;
+  geo->sectors = hd->sectors;
+  geo->sector_size = 512;
+}
+
+const struct block_device_ops disk_bdev_ops = {
+    .submit = disk_submit, .flush = NULL, .getgeo = disk_getgeo};
+
+// 把磁盘注册为块设备，须在扫描分区之前
+void disk_register(struct disk* hd, const struct block_device_ops* ops) {
+  bdev_register(&hd->bdev, hd->name, ops, hd);
+}
+
+//分区扫描，这个函数会被递归调用
+static void partition_scan(struct disk* hd, uint32_t ext_lba) {
+  struct boot_sector* bs = sys_malloc(sizeof(struct boot_sector));
+  if (blk_rw(&hd->queue, ext_lba, bs, 1, false) != 0) {
+    char error[64];
+    sprintf(error, "%s read partition table at %d failed\n", hd->name,
+            ext_lba);
+    PANIC(error);
+  }
+  uint8_t part_idx = 0;
+  struct partition_table_entry* p = bs->partition_table;
+  while (part_idx++ < 4) {
+    if (p->fs_type == 0x5) {
+      if (ext_lba_base != 0) {
+        partition_scan(hd, p->start_lba + ext_lba_base);
+      } else {
+        ext_lba_base = p->start_lba;
+        partition_scan(hd, p->start_lba);
+      }
+    } else if (p->fs_type != 0) {
+      if (ext_lba == 0) {
+        hd->prim_parts[p_no].start_lba = ext_lba + p->start_lba;
+        hd->prim_parts[p_no].sec_cnt = p->sec_cnt;
+        hd->prim_parts[p_no].my_disk = hd;
+        hd->prim_parts[p_no].bdev = &hd->bdev;
+        list_append(&partition_list, &hd->prim_parts[p_no].part_tag);
+        sprintf(hd->prim_parts[p_no].name, "%s%d", hd->name, p_no + 1);
+        p_no++;
+        ASSERT(p_no < 4);
+      } else {
+        hd->logic_parts[l_no].start_lba = ext_lba + p->start_lba;
+        hd->logic_parts[l_no].sec_cnt = p->sec_cnt;
+        hd->logic_parts[l_no].my_disk = hd;
+        hd->logic_parts[l_no].bdev = &hd->bdev;
+        list_append(&partition_list, &hd->logic_parts[l_no].part_tag);
+        sprintf(hd->logic_parts[l_no].name, "%s%d", hd->name, l_no + 5);
+        l_no++;
+        if (l_no >= 8) {
+          return;
+        }
+      }
+    }
+    p++;
+  }
+  sys_free(bs);
+}
+
+// 扫描整块盘的分区表，挂到partition_list上
+void disk_scan_partitions(struct disk* hd) {
+  p_no = 0, l_no = 0;
+  ext_lba_base = 0;
+  partition_scan(hd, 0);
+}
@@ -0,0 +1,50 @@
+#ifndef __DEVICE_GENHD_H
+#define __DEVICE_GENHD_H
+#include "stdint.h"
+#include "list.h"
+#include "bitmap.h"
+#include "sync.h"
+#include "blk.h"
+
+// 与控制器无关的磁盘和分区，IDE、AHCI、virtio-blk和内存盘都用它们
+// 注册块设备、扫描分区，文件系统只认识这里的结构
+
+struct partition{
+  uint32_t start_lba;
+  uint32_t sec_cnt;
+  struct disk* my_disk;
+  struct block_device* bdev;  // 文件系统经它读写分区
+  struct list_elem part_tag;
+  char name[8];
+  struct super_block* sb;
+  struct bitmap block_bitmap;
+  struct bitmap inode_bitmap;
+  struct list open_inodes;
+  struct rwlock open_inodes_lock;  // 保护open_inodes，查找多于插入删除
+};
+
+struct ide_channel;
+struct disk {
+  char name[8];
+  struct ide_channel* my_channel;  // 只有IDE的盘有，其他为NULL
+  uint8_t dev_no;                  // IDE通道上的主从号，AHCI的盘为端口号
+  bool dma;  // 硬盘支持DMA且通道有总线主控，读写走DMA
+  bool lba48;
+  uint32_t sectors;   // IDENTIFY报告的总扇区数
+  uint8_t multi_cnt;  // READ/WRITE MULTIPLE每块的扇区数，1表示逐扇区传输
+  bool wcache;        // 打开了写缓存，sync时要FLUSH CACHE
+  struct block_device bdev;
+  struct request_queue queue;
+  struct partition prim_parts[4];
+  struct partition logic_parts[8];
+};
+
+extern struct list partition_list;
+extern const struct block_device_ops disk_bdev_ops;
+
+void genhd_init(void);
+void disk_submit(struct block_device* bdev, struct bio* bio);
+void disk_getgeo(struct block_device* bdev, struct blk_geometry* geo);
+void disk_register(struct disk* hd, const struct block_device_ops* ops);
+void disk_scan_partitions(struct disk* hd);
+#endif
@@ -10,6 +10,7 @@
 #include "debug.h"
 
 #include "io.h"
+#include "pci.h"
 #include "timer.h"
 
 #include "string.h"
@@ -35,39 +36,48 @@
 #define BIT_DEV_DEV 0x10
 
 #define CMD_IDENTIFY 0xec
+#define CMD_SET_MULTIPLE 0xc6
 #define CMD_READ_SECTOR 0x20
 #define CMD_WRITE_SECTOR 0x30
+#define CMD_READ_MULTIPLE 0xc4
+#define CMD_WRITE_MULTIPLE 0xc5
+#define CMD_READ_DMA 0xc8
+#define CMD_WRITE_DMA 0xca
+// LBA48版本，扇区数和LBA各写两次寄存器，先高后低
+#define CMD_READ_SECTOR_EXT 0x24
+#define CMD_WRITE_SECTOR_EXT 0x34
+#define CMD_READ_MULTIPLE_EXT 0x29
+#define CMD_WRITE_MULTIPLE_EXT 0x39
+#define CMD_READ_DMA_EXT 0x25
+#define CMD_WRITE_DMA_EXT 0x35
+#define CMD_FLUSH_CACHE 0xe7
+#define CMD_FLUSH_CACHE_EXT 0xea
 
-#define max_lba ((80 * 1024 * 1024 / 512) - 1)
+#define BIT_STAT_ERR 0x1
+#define BIT_CTL_SRST 0x4
 
-uint8_t channel_cnt;
-struct ide_channel channels[2];
-
-uint32_t ext_lba_base;
-
-uint8_t p_no = 0, l_no = 0;
+// 总线主控IDE寄存器，每个通道8个端口
+#define reg_bm_cmd(channel) (channel->bm_base + 0)
+#define reg_bm_status(channel) (channel->bm_base + 2)
+#define reg_bm_prdt(channel) (channel->bm_base + 4)
+#define BM_CMD_START 0x1
+#define BM_CMD_READ 0x8  // 设备写内存，即读磁盘
+#define BM_STATUS_ERR 0x2
+#define BM_STATUS_IRQ 0x4
+#define PRD_MAX (PG_SIZE / sizeof(struct prd_entry))
 
-struct list partition_list;
+#define LBA28_LIMIT (1 << 28)
+// 支持LBA48的盘单个请求的扇区数上限，DMA时512项的PRD表足以描述
+#define IDE_MAX_SECTORS_EXT 1024
+// 命令超时的ticks，1024个扇区的PIO请求也足够
+#define IDE_TIMEOUT_TICKS (10 * IRQ0_FREQUENCY)
+// 完成字第16位表示命令超时，同时置ERR位
+#define IDE_DONE_TIMEOUT (0x10000 | BIT_STAT_ERR)
+// 写命令发出后DRQ通常几微秒内置位，先查询这么多次，未就绪再交给定时器
+#define IDE_DRQ_SPIN 64
 
-
-struct partition_table_entry {
-  uint8_t bootable;
-  uint8_t start_head;
-  uint8_t start_sec;
-  uint8_t start_chs;
-  uint8_t fs_type;
-  uint8_t end_head;
-  uint8_t end_sec;
-  uint8_t end_chs;
-  uint32_t start_lba;
-  uint32_t sec_cnt;
-} __attribute__((packed));
-
-struct boot_sector {
-  uint8_t other[446];
-  struct partition_table_entry partition_table[4];
-  uint16_t signature;
-} __attribute__((packed));
+uint8_t channel_cnt;
+struct ide_channel channels[2];
 
 //因为读取磁盘是以字为单位进行读取，而一个字为两个字节，所以需要下面这个函数
 static void swap_pairs_bytes(const char* dst, char* buf, uint32_t len) {
@@ -88,114 +98,338 @@ static void select_disk(struct disk* hd) {
   outb(reg_dev(hd->my_channel), reg_device);
 }
 
-//选择读取的起始扇区
-static void select_sector(struct disk* hd, uint32_t lba, uint8_t sec_cnt) {
-  ASSERT(lba <= max_lba);
+// 写入起始扇区和扇区数，超出LBA28的范围或超过256个扇区时用LBA48的写法，
+// 返回是否需要发EXT命令
+static bool select_sector(struct disk* hd, uint32_t lba, uint32_t sec_cnt) {
+  ASSERT(lba + sec_cnt <= hd->sectors);
   struct ide_channel* channel = hd->my_channel;
-  outb(reg_sect_cnt(channel), sec_cnt);
+  uint8_t dev = BIT_DEV_LBA | BIT_DEV_MBS | (hd->dev_no == 1 ? BIT_DEV_DEV : 0);
+  if (hd->lba48 && (lba + sec_cnt > LBA28_LIMIT || sec_cnt > 256)) {
+    // 扇区数65536写作0；LBA只用低32位，第40~47位恒为0
+    outb(reg_sect_cnt(channel), sec_cnt >> 8);
+    outb(reg_lba_l(channel), lba >> 24);
+    outb(reg_lba_m(channel), 0);
+    outb(reg_lba_h(channel), 0);
+    outb(reg_sect_cnt(channel), sec_cnt);
+    outb(reg_lba_l(channel), lba);
+    outb(reg_lba_m(channel), lba >> 8);
+    outb(reg_lba_h(channel), lba >> 16);
+    outb(reg_dev(channel), dev);
+    return true;
+  }
+  ASSERT(sec_cnt <= 256);
+  outb(reg_sect_cnt(channel), sec_cnt);  // 256写作0
   outb(reg_lba_l(channel), lba);
   outb(reg_lba_m(channel), lba >> 8);
   outb(reg_lba_h(channel), lba >> 16);
-  outb(reg_dev(channel), (BIT_DEV_LBA | BIT_DEV_MBS |
-                          (hd->dev_no == 1 ? BIT_DEV_DEV : 0) | lba >> 24));
+  outb(reg_dev(channel), dev | lba >> 24);
+  return false;
 }
 
-//向磁盘输出要进行的命令
-static void cmd_out(struct ide_channel* channel, uint8_t cmd) {
-  channel->expecting_intr = true;
+// 向磁盘输出要进行的命令，同时设定中断处理程序的状态并开始计时
+static void cmd_out(struct ide_channel* channel, enum ide_state state,
+                    uint8_t cmd) {
+  channel->state = state;
+  add_timer(&channel->timeout, ticks + IDE_TIMEOUT_TICKS);
   outb(reg_cmd(channel), cmd);
 }
 
 //从磁盘读取数据
-static void read_from_sector(struct disk* hd, void* buf, uint8_t sec_cnt) {
-  uint32_t size_in_byte;
-  if (sec_cnt == 0) {
-    size_in_byte = 256 * 512;
-  } else {
-    size_in_byte = sec_cnt * 512;
-  }
-  insw(reg_data(hd->my_channel), buf, size_in_byte / 2);
+static void read_from_sector(struct disk* hd, void* buf, uint32_t sec_cnt) {
+  insw(reg_data(hd->my_channel), buf, sec_cnt * 512 / 2);
 }
 
 //向磁盘写入数据
-static void write2sector(struct disk* hd, void* buf, uint8_t sec_cnt) {
-  uint32_t size_in_byte;
-  if (sec_cnt == 0) {
-    size_in_byte = 256 * 512;
-  } else {
-    size_in_byte = sec_cnt * 512;
+static void write2sector(struct disk* hd, void* buf, uint32_t sec_cnt) {
+  outsw(reg_data(hd->my_channel), buf, sec_cnt * 512 / 2);
+}
+
+// 等待本通道的命令结束，返回完成字：低8位为ATA状态寄存器，
+// 8~15位为总线主控状态寄存器，超时为IDE_DONE_TIMEOUT
+static uint32_t wait_disk_done(struct ide_channel* channel) {
+  uint32_t status;
+  enum intr_status old_status = intr_disable();
+  while (!mpsc_ring_pop(&channel->done_ring, &status)) {
+    wait_queue_sleep(&channel->done_wq);
   }
-  outsw(reg_data(hd->my_channel), buf, size_in_byte / 2);
+  intr_set_status(old_status);
+  return status;
 }
 
-//繁忙等待，如果磁盘准备好了则会返回
-static bool busy_wait(struct disk* hd) {
-  struct ide_channel* channel = hd->my_channel;
-  uint32_t time_limit = 30 * 1000;
-  while (time_limit -= 10 >= 0) {
-    if (!(inb(reg_status(channel)) & BIT_ALT_STAT_BSY)) {
-      return (inb(reg_status(channel))& BIT_ALT_STAT_DRQ);
+// 发SET MULTIPLE MODE，返回是否成功
+static bool set_multiple_mode(struct disk* hd, uint8_t cnt) {
+  select_disk(hd);
+  outb(reg_sect_cnt(hd->my_channel), cnt);
+  cmd_out(hd->my_channel, IDE_CMD, CMD_SET_MULTIPLE);
+  return !(wait_disk_done(hd->my_channel) & BIT_STAT_ERR);
+}
+
+// 把buf按物理页追加到PRD表中，物理上连续且不跨64KB边界的相邻页合并为一项。
+// buf须2字节对齐，表项不够时返回false
+static bool prdt_add(struct prd_entry* prd, uint32_t* n, void* buf,
+                     uint32_t bytes) {
+  uint32_t vaddr = (uint32_t)buf;
+  if (vaddr & 1) {
+    return false;
+  }
+  while (bytes > 0) {
+    uint32_t phys = addr_v2p(vaddr);
+    uint32_t chunk = PG_SIZE - (vaddr & (PG_SIZE - 1));
+    if (chunk > bytes) {
+      chunk = bytes;
+    }
+    // 已满64KB的项byte_cnt为0，不会与后面的页相接
+    struct prd_entry* last = *n > 0 ? &prd[*n - 1] : NULL;
+    if (last != NULL && phys == last->phys_addr + last->byte_cnt &&
+        (phys & 0xffff) != 0) {
+      last->byte_cnt += chunk;  // 恰好64KB时为0
     } else {
-      mtime_sleep(10);
+      if (*n == PRD_MAX) {
+        return false;
+      }
+      prd[*n].phys_addr = phys;
+      prd[*n].byte_cnt = (uint16_t)chunk;
+      prd[*n].flags = 0;
+      (*n)++;
     }
+    vaddr += chunk;
+    bytes -= chunk;
   }
-  return false;
+  return true;
 }
 
-//从磁盘读取数据
-void ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
-  ASSERT(lba <= max_lba);
-  ASSERT(sec_cnt > 0);
-  lock_acquire(&hd->my_channel->lock);
-  select_disk(hd);
-  uint32_t secs_op;
-  uint32_t secs_done = 0;
-  while (secs_done < sec_cnt) {
-    if (secs_done + 256 <= sec_cnt) {
-      secs_op = 256;
+// 为请求中所有bio的缓冲区建立PRD表
+static bool build_prdt(struct ide_channel* channel, struct request* rq) {
+  uint32_t n = 0;
+  struct list_elem* elem = rq->bios.head.next;
+  while (elem != &rq->bios.tail) {
+    struct bio* bio = elem2entry(struct bio, bio_tag, elem);
+    if (!prdt_add(channel->prdt, &n, bio->buf, bio->sec_cnt * 512)) {
+      return false;
+    }
+    elem = elem->next;
+  }
+  channel->prdt[n - 1].flags = PRD_EOT;
+  return true;
+}
+
+// 用总线主控DMA发出请求，调用者持有通道锁。数据由控制器直接搬运，
+// CPU只在完成中断时被唤醒；缓冲区无法用PRD表描述时返回false
+static bool dma_start(struct disk* hd, struct request* rq) {
+  struct ide_channel* channel = hd->my_channel;
+  if (!build_prdt(channel, rq)) {
+    return false;
+  }
+  uint8_t dir = rq->write ? 0 : BM_CMD_READ;
+  outl(reg_bm_prdt(channel), addr_v2p((uint32_t)channel->prdt));
+  outb(reg_bm_cmd(channel), dir);
+  // 写1清除上次残留的中断和错误位
+  outb(reg_bm_status(channel),
+       inb(reg_bm_status(channel)) | BM_STATUS_ERR | BM_STATUS_IRQ);
+  if (select_sector(hd, rq->lba, rq->sec_cnt)) {
+    cmd_out(channel, IDE_DMA, rq->write ? CMD_WRITE_DMA_EXT : CMD_READ_DMA_EXT);
+  } else {
+    cmd_out(channel, IDE_DMA, rq->write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  }
+  outb(reg_bm_cmd(channel), dir | BM_CMD_START);
+  return true;
+}
+
+// 从请求的bio链中的(*elem, *off)处起搬运sec_cnt个扇区，并前移位置
+static void pio_move(struct disk* hd, struct request* rq,
+                     struct list_elem** elem, uint32_t* off,
+                     uint32_t sec_cnt) {
+  while (sec_cnt > 0) {
+    struct bio* bio = elem2entry(struct bio, bio_tag, *elem);
+    uint32_t cnt = bio->sec_cnt - *off;
+    if (cnt > sec_cnt) {
+      cnt = sec_cnt;
+    }
+    void* buf = (void*)((uint32_t)bio->buf + *off * 512);
+    if (rq->write) {
+      write2sector(hd, buf, cnt);
     } else {
-      secs_op = sec_cnt - secs_done;
+      read_from_sector(hd, buf, cnt);
     }
-    select_sector(hd, lba + secs_done, secs_op);
-    cmd_out(hd->my_channel, CMD_READ_SECTOR);
-    sema_down(&hd->my_channel->disk_done);
-    if (!busy_wait(hd)) {
-      char error[64];
-      sprintf(error, "%s raed sector %d failed!!!!!\n", hd->name, lba);
-      PANIC(error);
+    sec_cnt -= cnt;
+    *off += cnt;
+    if (*off == bio->sec_cnt) {
+      *elem = (*elem)->next;
+      *off = 0;
     }
-    read_from_sector(hd, (void*)((uint32_t)buf + secs_done * 512), secs_op);
-    secs_done += secs_op;
   }
-  lock_release(&hd->my_channel->lock);
 }
 
-//向磁盘写入数据
-void ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
-  ASSERT(lba <= max_lba);
-  ASSERT(sec_cnt > 0);
-  lock_acquire(&hd->my_channel->lock);
-  select_disk(hd);
-  uint32_t secs_op;
-  uint32_t secs_done = 0;
-  while (secs_done < sec_cnt) {
-    if (secs_done + 256 <= sec_cnt) {
-      secs_op = 256;
-    } else {
-      secs_op = sec_cnt - secs_done;
+// 结束当前命令，放入完成字并唤醒发命令的线程，须关中断调用
+static void ide_complete(struct ide_channel* channel, uint32_t done) {
+  del_timer(&channel->timeout);
+  del_timer(&channel->drq_poll);
+  channel->state = IDE_IDLE;
+  channel->cur_rq = NULL;
+  mpsc_ring_push(&channel->done_ring, done);
+  wake_up_one(&channel->done_wq);
+}
+
+// 命令超时，在softirq线程中执行。只放弃命令，复位由发命令的线程去做
+static void ide_timeout(struct timer_list* timer) {
+  struct ide_channel* channel = timer->data;
+  enum intr_status old_status = intr_disable();
+  if (channel->state != IDE_IDLE) {
+    if (channel->state == IDE_DMA) {
+      outb(reg_bm_cmd(channel), 0);
+    }
+    ide_complete(channel, IDE_DONE_TIMEOUT);
+  }
+  intr_set_status(old_status);
+}
+
+// 搬运当前PIO请求的下一块，须关中断调用。缓冲区都在内核空间，
+// 中断打断哪个任务都能直接访问
+static void pio_next_block(struct ide_channel* channel) {
+  struct disk* hd = channel->cur_disk;
+  uint32_t cnt = channel->left < hd->multi_cnt ? channel->left : hd->multi_cnt;
+  pio_move(hd, channel->cur_rq, &channel->cur_bio, &channel->cur_off, cnt);
+  channel->left -= cnt;
+}
+
+// PIO写的第一块：硬盘置DRQ后不发中断，就绪即送出，否则下个tick再查。
+// 之后每送完一块硬盘发一次中断
+static void pio_out_first(struct ide_channel* channel) {
+  enum intr_status old_status = intr_disable();
+  if (channel->state == IDE_PIO_OUT &&
+      channel->left == channel->cur_rq->sec_cnt) {
+    uint32_t spins = 0;
+    uint8_t status;
+    while (((status = inb(reg_alt_status(channel))) & BIT_ALT_STAT_BSY) &&
+           spins++ < IDE_DRQ_SPIN) {
+      asm volatile("pause" ::: "memory");
+    }
+    if (!(status & BIT_ALT_STAT_BSY) && (status & BIT_ALT_STAT_DRQ)) {
+      pio_next_block(channel);
+    } else if (!(status & BIT_STAT_ERR)) {
+      add_timer(&channel->drq_poll, ticks + 1);
     }
-    select_sector(hd, lba + secs_done, secs_op);
-    cmd_out(hd->my_channel, CMD_WRITE_SECTOR);
-    if (!busy_wait(hd)) {
-      char error[64];
-      sprintf(error, "%s write sector %d failed!!!!!\n", hd->name, lba);
-      PANIC(error);
+  }
+  intr_set_status(old_status);
+}
+
+static void pio_drq_poll(struct timer_list* timer) {
+  pio_out_first(timer->data);
+}
+
+// 软复位通道：SRST置位至少5微秒后清除，再等BSY清零，都用定时器睡眠等待。
+// 复位后两块盘的多扇区块大小恢复默认，需要重新设置
+static void ide_reset(struct ide_channel* channel) {
+  outb(reg_ctl(channel), BIT_CTL_SRST);
+  mtime_sleep(mil_seconds_per_intr);
+  outb(reg_ctl(channel), 0);
+  uint32_t deadline = ticks + 30 * IRQ0_FREQUENCY;
+  do {
+    mtime_sleep(mil_seconds_per_intr);
+  } while ((inb(reg_alt_status(channel)) & BIT_ALT_STAT_BSY) &&
+           (int32_t)(ticks - deadline) < 0);
+  uint8_t dev_no;
+  for (dev_no = 0; dev_no < 2; dev_no++) {
+    struct disk* hd = &channel->devices[dev_no];
+    if (hd->multi_cnt > 1 && !set_multiple_mode(hd, hd->multi_cnt)) {
+      hd->multi_cnt = 1;
     }
-    write2sector(hd, (void*)((uint32_t)buf + secs_done * 512), secs_op);
-    sema_down(&hd->my_channel->disk_done);
-    secs_done += secs_op;
   }
-  lock_release(&hd->my_channel->lock);
+  printk("%s reset\n", channel->name);
+}
+
+// 请求队列的驱动回调，在派发线程中执行，两块盘的派发线程通过通道锁互斥
+// 用PIO发出请求：一条命令传完整个请求。硬盘每准备好一个数据块(READ/WRITE
+// MULTIPLE时为multi_cnt个扇区，否则为1个)就置DRQ，读时先发中断再等取数据，
+// 写时取走数据后再发中断，数据都由中断处理程序搬运
+static void pio_start(struct disk* hd, struct request* rq) {
+  struct ide_channel* channel = hd->my_channel;
+  bool ext = select_sector(hd, rq->lba, rq->sec_cnt);
+  uint8_t cmd;
+  if (hd->multi_cnt > 1) {
+    cmd = rq->write ? (ext ? CMD_WRITE_MULTIPLE_EXT : CMD_WRITE_MULTIPLE)
+                    : (ext ? CMD_READ_MULTIPLE_EXT : CMD_READ_MULTIPLE);
+  } else {
+    cmd = rq->write ? (ext ? CMD_WRITE_SECTOR_EXT : CMD_WRITE_SECTOR)
+                    : (ext ? CMD_READ_SECTOR_EXT : CMD_READ_SECTOR);
+  }
+  channel->cur_disk = hd;
+  channel->cur_rq = rq;
+  channel->cur_bio = rq->bios.head.next;
+  channel->cur_off = 0;
+  channel->left = rq->sec_cnt;
+  cmd_out(channel, rq->write ? IDE_PIO_OUT : IDE_PIO_IN, cmd);
+  if (rq->write) {
+    pio_out_first(channel);
+  }
+}
+
+// 发出命令后睡眠，由中断处理程序推进并结束命令，超时则软复位通道
+static int32_t ide_do_request(struct request_queue* q, struct request* rq) {
+  struct disk* hd = q->queuedata;
+  struct ide_channel* channel = hd->my_channel;
+  int32_t error = 0;
+  mutex_lock(&channel->lock);
+  select_disk(hd);
+  bool dma = hd->dma && dma_start(hd, rq);
+  if (!dma) {
+    pio_start(hd, rq);
+  }
+  uint32_t done = wait_disk_done(channel);
+  if ((done & BIT_STAT_ERR) || (dma && ((done >> 8) & BM_STATUS_ERR))) {
+    printk("%s %s%s sector %d failed\n", hd->name, dma ? "dma " : "",
+           rq->write ? "write" : "read", rq->lba);
+    error = -1;
+  }
+  if (done == IDE_DONE_TIMEOUT) {
+    ide_reset(channel);
+  }
+  mutex_unlock(&channel->lock);
+  return error;
+}
+
+// 把硬盘写缓存中的数据写入盘片，在调用者线程中执行，与派发线程通过通道锁互斥
+static int32_t ide_flush(struct block_device* bdev) {
+  struct disk* hd = bdev->private;
+  struct ide_channel* channel = hd->my_channel;
+  if (!hd->wcache) {
+    return 0;
+  }
+  mutex_lock(&channel->lock);
+  select_disk(hd);
+  cmd_out(channel, IDE_CMD,
+          hd->lba48 ? CMD_FLUSH_CACHE_EXT : CMD_FLUSH_CACHE);
+  uint32_t done = wait_disk_done(channel);
+  if (done == IDE_DONE_TIMEOUT) {
+    ide_reset(channel);
+  }
+  mutex_unlock(&channel->lock);
+  return (done & BIT_STAT_ERR) ? -1 : 0;
+}
+
+static const struct block_device_ops ide_bdev_ops = {
+    .submit = disk_submit, .flush = ide_flush, .getgeo = disk_getgeo};
+
+//从磁盘读取数据，经请求队列提交并等待完成
+void ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+  ASSERT(lba + sec_cnt <= hd->sectors);
+  ASSERT(sec_cnt > 0);
+  if (blk_rw(&hd->queue, lba, buf, sec_cnt, false) != 0) {
+    char error[64];
+    sprintf(error, "%s raed sector %d failed!!!!!\n", hd->name, lba);
+    PANIC(error);
+  }
+}
+
+//向磁盘写入数据，经请求队列提交并等待完成
+void ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+  ASSERT(lba + sec_cnt <= hd->sectors);
+  ASSERT(sec_cnt > 0);
+  if (blk_rw(&hd->queue, lba, buf, sec_cnt, true) != 0) {
+    char error[64];
+    sprintf(error, "%s write sector %d failed!!!!!\n", hd->name, lba);
+    PANIC(error);
+  }
 }
 
 void intr_hd_handler(uint8_t irq_no) {
@@ -203,21 +437,59 @@ void intr_hd_handler(uint8_t irq_no) {
   uint8_t ch_no = irq_no - 0x2e;
   struct ide_channel* channel = &channels[ch_no];
   ASSERT(channel->irq_no == irq_no);
-  if (channel->expecting_intr) {
-    channel->expecting_intr = false;
-    sema_up(&channel->disk_done);
-    inb(reg_status(channel));
+  // 读状态寄存器即应答中断
+  uint8_t status = inb(reg_status(channel));
+  switch (channel->state) {
+    case IDE_IDLE:  // 超时后迟到的中断或复位产生的中断
+      break;
+    case IDE_CMD:
+      ide_complete(channel, status);
+      break;
+    case IDE_DMA: {
+      // 停止总线主控，写1清除它的中断和错误位
+      uint8_t bm_status = inb(reg_bm_status(channel));
+      outb(reg_bm_cmd(channel), inb(reg_bm_cmd(channel)) & ~BM_CMD_START);
+      outb(reg_bm_status(channel), bm_status);
+      ide_complete(channel, status | bm_status << 8);
+      break;
+    }
+    case IDE_PIO_IN:
+    case IDE_PIO_OUT:
+      // 写完最后一块后的中断表示命令结束；其余中断须置DRQ
+      if ((status & BIT_STAT_ERR) || channel->left == 0) {
+        ide_complete(channel, status);
+        break;
+      }
+      if (!(status & BIT_ALT_STAT_DRQ)) {
+        ide_complete(channel, status | BIT_STAT_ERR);
+        break;
+      }
+      pio_next_block(channel);
+      // 读完最后一块不再有中断
+      if (channel->state == IDE_PIO_IN && channel->left == 0) {
+        ide_complete(channel, status);
+      }
+      break;
+  }
+}
+
+// 第47字低8位是READ/WRITE MULTIPLE每块最多的扇区数，
+// 用SET MULTIPLE MODE设为该值，失败或不支持时每块1个扇区
+static void set_multiple(struct disk* hd, uint8_t max_cnt) {
+  hd->multi_cnt = 1;
+  if (max_cnt > 1 && set_multiple_mode(hd, max_cnt)) {
+    hd->multi_cnt = max_cnt;
   }
+  printk("      MULTIPLE: %d\n", hd->multi_cnt);
 }
 
 //获取键盘信息
 static void identify_disk(struct disk* hd) {
   char id_info[512];
   select_disk(hd);
-  cmd_out(hd->my_channel, CMD_IDENTIFY);
-  sema_down(&hd->my_channel->disk_done);
-
-  if (!busy_wait(hd)) {
+  cmd_out(hd->my_channel, IDE_CMD, CMD_IDENTIFY);
+  uint32_t status = wait_disk_done(hd->my_channel);
+  if ((status & BIT_STAT_ERR) || !(status & BIT_ALT_STAT_DRQ)) {
     char error[64];
     sprintf(error, "%s identify failed!!!!!\n", hd->name);
     PANIC(error);
@@ -230,49 +502,26 @@ static void identify_disk(struct disk* hd) {
   memset(buf, 0, sizeof(buf));
   swap_pairs_bytes(&id_info[md_start], buf, md_len);
   printk("      MODULE: %s\n", buf);
-  uint32_t sectors = *(uint32_t*)&id_info[60 * 2];
-  printk("      SECTORS: %d\n", sectors);
-  printk("      CAPACITY: %dMB\n", sectors * 512 / 1024 / 1024);
-}
-
-//分区扫描，这个函数会被递归调用
-static void partition_scan(struct disk* hd, uint32_t ext_lba) {
-  struct boot_sector* bs = sys_malloc(sizeof(struct boot_sector));
-  ide_read(hd, ext_lba, bs, 1);
-  uint8_t part_idx = 0;
-  struct partition_table_entry* p = bs->partition_table;
-  while (part_idx++ < 4) {
-    if (p->fs_type == 0x5) {
-      if (ext_lba_base != 0) {
-        partition_scan(hd, p->start_lba + ext_lba_base);
-      } else {
-        ext_lba_base = p->start_lba;
-        partition_scan(hd, p->start_lba);
-      }
-    } else if (p->fs_type != 0) {
-      if (ext_lba == 0) {
-        hd->prim_parts[p_no].start_lba = ext_lba + p->start_lba;
-        hd->prim_parts[p_no].sec_cnt = p->sec_cnt;
-        hd->prim_parts[p_no].my_disk = hd;
-        list_append(&partition_list, &hd->prim_parts[p_no].part_tag);
-        sprintf(hd->prim_parts[p_no].name, "%s%d", hd->name, p_no + 1);
-        p_no++;
-        ASSERT(p_no < 4);
-      } else {
-        hd->logic_parts[l_no].start_lba = ext_lba + p->start_lba;
-        hd->logic_parts[l_no].sec_cnt = p->sec_cnt;
-        hd->logic_parts[l_no].my_disk = hd;
-        list_append(&partition_list, &hd->logic_parts[l_no].part_tag);
-        sprintf(hd->logic_parts[l_no].name, "%s%d", hd->name, l_no + 5);
-        l_no++;
-        if (l_no >= 8) {
-          return;
-        }
-      }
-    }
-    p++;
+  uint16_t* id_words = (uint16_t*)id_info;
+  // 第83字第10位表示支持LBA48，此时容量取第100~103字，否则取第60~61字
+  hd->lba48 = id_words[83] & 0x400;
+  if (hd->lba48) {
+    hd->sectors = id_words[102] || id_words[103]
+                      ? 0xffffffff
+                      : id_words[100] | (uint32_t)id_words[101] << 16;
+  } else {
+    hd->sectors = id_words[60] | (uint32_t)id_words[61] << 16;
   }
-  sys_free(bs);
+  printk("      SECTORS: %d\n", hd->sectors);
+  printk("      CAPACITY: %dMB\n", hd->sectors >> 11);
+  printk("      LBA48: %s\n", hd->lba48 ? "yes" : "no");
+  // 第85字第5位表示写缓存已打开
+  hd->wcache = id_words[85] & 0x20;
+  set_multiple(hd, id_words[47] & 0xff);
+  // 第49字的第8位表示支持DMA
+  hd->dma = hd->my_channel->bm_base != 0 &&
+            (id_words[49] & 0x100);
+  printk("      DMA: %s\n", hd->dma ? "yes" : "no");
 }
 
 //打印分区信息
@@ -286,11 +535,20 @@ static bool partition_info(struct list_elem* pelem, int arg UNUSED) {
 //磁盘初始化
 void ide_init() {
   printk("  ide_init start\n");
-  uint8_t hd_cnt = *((uint8_t*)(0x475));
+  // BIOS数据区中的硬盘数，经高端映射访问：
+  // 此时CR3可能是沿用的用户进程页目录，没有低端的恒等映射
+  uint8_t hd_cnt = *((uint8_t*)(0xc0000475));
   ASSERT(hd_cnt > 0);
-  list_init(&partition_list);
   channel_cnt = DIV_ROUND_UP(hd_cnt, 2);
   
+  // prog-if第7位表示支持总线主控，BAR4是它的I/O端口基址，两个通道各占8个端口
+  struct pci_device* ide_pci = pci_find_class(0x01, 0x01);
+  uint16_t bm_base = 0;
+  if (ide_pci != NULL && (ide_pci->prog_if & 0x80) && (ide_pci->bar[4] & 1)) {
+    bm_base = ide_pci->bar[4] & 0xfffc;
+    pci_set_master(ide_pci);
+  }
+
   struct ide_channel* channel;
   uint8_t channel_no = 0, dev_no = 0;
   while (channel_no < channel_cnt) {
@@ -307,10 +565,20 @@ void ide_init() {
         channel->irq_no = 0x20 + 15;
         break;
     }
-    channel->expecting_intr = false;
-    
-    lock_init(&channel->lock);
-    sema_init(&channel->disk_done, 0);
+    channel->bm_base = 0;
+    channel->prdt = NULL;
+    if (bm_base != 0) {
+      channel->bm_base = bm_base + channel_no * 8;
+      channel->prdt = get_kernel_pages(1);
+    }
+
+    mutex_init(&channel->lock);
+    channel->state = IDE_IDLE;
+    timer_setup(&channel->timeout, ide_timeout, channel);
+    timer_setup(&channel->drq_poll, pio_drq_poll, channel);
+    mpsc_ring_init(&channel->done_ring, channel->done_data, 4,
+                   channel->done_committed, 4);
+    wait_queue_init(&channel->done_wq);
     register_handler(channel->irq_no, intr_hd_handler);
     while (dev_no < 2) {
       struct disk* hd = &channel->devices[dev_no];
@@ -318,10 +586,15 @@ void ide_init() {
       hd->dev_no = dev_no;
       sprintf(hd->name, "sd%c", 'a' + channel_no * 2 + dev_no);
       identify_disk(hd);
+      blk_queue_init(&hd->queue, hd->name, ide_do_request, hd);
+      hd->queue.max_segments = PRD_MAX;
+      if (hd->lba48) {
+        hd->queue.max_sectors = IDE_MAX_SECTORS_EXT;
+      }
+      disk_register(hd, &ide_bdev_ops);
       if (dev_no != 0) {
-        partition_scan(hd,0);
+        disk_scan_partitions(hd);
       }
-      p_no = 0, l_no = 0;
       dev_no++;
     }
     dev_no = 0;
@@ -2,41 +2,53 @@
 #define __DEVICE_IDE_H
 #include "stdint.h"
 #include "list.h"
-#include "bitmap.h"
 #include "sync.h"
+#include "mpsc_ring.h"
+#include "genhd.h"
+#include "timer.h"
 
-struct partition{
-  uint32_t start_lba;
-  uint32_t sec_cnt;
-  struct disk* my_disk;
-  struct list_elem part_tag;
-  char name[8];
-  struct super_block* sb;
-  struct bitmap block_bitmap;
-  struct bitmap inode_bitmap;
-  struct list open_inodes;
-};
+// 总线主控DMA的物理区域描述符，表本身须4字节对齐且不跨64KB
+struct prd_entry {
+  uint32_t phys_addr;
+  uint16_t byte_cnt;  // 0表示64KB
+  uint16_t flags;     // 最后一项置PRD_EOT
+} __attribute__((packed));
+#define PRD_EOT 0x8000
 
-struct disk {
-  char name[8];
-  struct ide_channel* my_channel;
-  uint8_t dev_no;
-  struct partition prim_parts[4];
-  struct partition logic_parts[8];
+// 通道上正在执行的命令，决定中断处理程序做什么
+enum ide_state {
+  IDE_IDLE,     // 没有命令，中断只需应答
+  IDE_CMD,      // 无数据或由发命令的线程取数据，如IDENTIFY
+  IDE_PIO_IN,   // PIO读，每个中断取走一块
+  IDE_PIO_OUT,  // PIO写，每个中断送出下一块
+  IDE_DMA
 };
 
 struct ide_channel {
   char name[8];
   uint16_t port_base;
   uint8_t irq_no;
-  struct lock lock;
-  bool expecting_intr;
-  struct semaphore disk_done;
+  struct mutex lock;
+  enum ide_state state;
+  // PIO请求的进度，由中断处理程序逐块推进
+  struct disk* cur_disk;
+  struct request* cur_rq;
+  struct list_elem* cur_bio;
+  uint32_t cur_off;            // cur_bio中已搬运的扇区数
+  uint32_t left;               // 请求中还未搬运的扇区数
+  struct timer_list timeout;   // 命令超时后放弃，由发命令的线程复位通道
+  struct timer_list drq_poll;  // PIO写的第一块没有中断，DRQ未置位时定时再查
+  uint16_t bm_base;          // 总线主控寄存器的端口基址，0表示不支持DMA
+  struct prd_entry* prdt;    // 占一页，最多PG_SIZE/8项
+  // 命令结束时中断处理程序或超时定时器放入完成字，发起命令的线程在done_wq上等待取走
+  struct mpsc_ring done_ring;
+  uint32_t done_data[4];
+  uint32_t done_committed[MPSC_RING_MAP_WORDS(4)];
+  struct wait_queue done_wq;
   struct disk devices[2];
 };
 extern uint8_t channel_cnt;
 extern struct ide_channel channels[2];
-extern struct list partition_list;
 
 void ide_init();
 void ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
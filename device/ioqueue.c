@@ -3,74 +3,70 @@
 #include "interrupt.h"
 
 void ioqueue_init(struct ioqueue* ioq) {
-  lock_init(&ioq->lock);
-  ioq->producer = ioq->consumer = NULL;
-  ioq->head = ioq->tail = 0;
-}
-
-static int32_t next_pos(uint32_t pos) {
-  return (pos + 1) % bufsize;
+  wait_queue_init(&ioq->producers);
+  wait_queue_init(&ioq->consumers);
+  mpsc_ring_init(&ioq->ring, ioq->data, 1, ioq->committed, bufsize);
 }
 
 bool ioq_full(struct ioqueue* ioq) {
-  ASSERT(intr_get_status() == INTR_OFF);
-  return next_pos(ioq->head) == ioq->tail;
+  return mpsc_ring_full(&ioq->ring);
 }
 
 bool ioq_empty(struct ioqueue* ioq) {
-  ASSERT(intr_get_status() == INTR_OFF);
-  return ioq->head == ioq->tail;
+  return mpsc_ring_empty(&ioq->ring);
 }
 
-static void ioq_wait(struct task_struct** waiter) {
-  ASSERT(waiter != NULL && *waiter == NULL);
-  *waiter = running_thread();
-  thread_block(TASK_BLOCKED);
-}
-
-static void weakup(struct task_struct** waiter) {
-  ASSERT(waiter != NULL);
-  thread_unblock(*waiter);
-  *waiter = NULL;
+// 读者之间靠关中断互斥，缓冲区空时睡眠
+char ioq_getchar(struct ioqueue* ioq) {
+  ASSERT(intr_get_status() == INTR_OFF);
+  uint32_t byte;
+  while (!mpsc_ring_pop(&ioq->ring, &byte)) {
+    wait_queue_sleep_killable(&ioq->consumers);
+  }
+  wake_up_one(&ioq->producers);
+  return (char)byte;
 }
 
-char ioq_getchar(struct ioqueue* ioq) {
+// 一次取走最多count个已有的字符，不等待，读者间同样须关中断互斥
+uint32_t ioq_read(struct ioqueue* ioq, char* buf, uint32_t count) {
   ASSERT(intr_get_status() == INTR_OFF);
-  while (ioq_empty(ioq)) {
-    lock_acquire(&ioq->lock);
-    ioq_wait(&ioq->consumer);
-    lock_release(&ioq->lock);
+  uint32_t batch[32];
+  uint32_t done = 0;
+  while (done < count) {
+    uint32_t want = count - done > 32 ? 32 : count - done;
+    uint32_t n = mpsc_ring_drain(&ioq->ring, batch, want);
+    for (uint32_t i = 0; i < n; i++) {
+      buf[done++] = (char)batch[i];
+    }
+    if (n < want) {
+      break;
+    }
   }
-  char byte = ioq->buf[ioq->tail];
-  ioq->tail = next_pos(ioq->tail);
-  if (ioq->producer != NULL) {
-    weakup(&ioq->producer);
+  if (done != 0) {
+    wake_up_all(&ioq->producers);
   }
-  return byte;
+  return done;
 }
 
-void ioq_putchar(struct ioqueue* ioq, char byte) {
-  ASSERT(intr_get_status() == INTR_OFF);
-  while (ioq_full(ioq)) {
-    lock_acquire(&ioq->lock);
-    ioq_wait(&ioq->producer);
-    lock_release(&ioq->lock);
+// 不睡眠的写入，供中断处理程序使用，缓冲区满时丢弃并返回false
+bool ioq_try_putchar(struct ioqueue* ioq, char byte) {
+  if (!mpsc_ring_push(&ioq->ring, (uint8_t)byte)) {
+    return false;
   }
-  ioq->buf[ioq->head] = byte;
-  ioq->head = next_pos(ioq->head);
+  wake_up_one(&ioq->consumers);
+  return true;
+}
 
-  if (ioq->consumer != NULL) {
-    weakup(&ioq->consumer);
+// 线程上下文的写入，缓冲区满时睡眠
+void ioq_putchar(struct ioqueue* ioq, char byte) {
+  ASSERT(intr_get_status() == INTR_OFF);
+  while (!mpsc_ring_push(&ioq->ring, (uint8_t)byte)) {
+    wait_queue_sleep_killable(&ioq->producers);
   }
+  wake_up_one(&ioq->consumers);
 }
 
 /* 返回环形缓冲区中的数据长度 */
 uint32_t ioq_length(struct ioqueue* ioq) {
-  uint32_t len = 0;
-  if (ioq->head >= ioq->tail) {
-    len = ioq->head - ioq->tail;
-  } else {
-    len = bufsize - (ioq->tail - ioq->head);
-  }
-  return len;
+  return mpsc_ring_count(&ioq->ring);
 }
@@ -3,20 +3,24 @@
 #include "stdint.h"
 #include "sync.h"
 #include "thread.h"
+#include "wait_queue.h"
+#include "mpsc_ring.h"
 
+// 容量须为2的幂，整个ioqueue要能放进一页(管道用一页存放它)
 #define bufsize 2048
 struct ioqueue {
-  struct lock lock;
-  struct task_struct* producer;
-  struct task_struct* consumer;
-  char buf[bufsize];
-  int32_t head;
-  int32_t tail;
+  struct wait_queue producers;  // 缓冲区满时等待的写者
+  struct wait_queue consumers;  // 缓冲区空时等待的读者
+  struct mpsc_ring ring;        // 写入无锁，中断处理程序可直接放入
+  uint8_t data[bufsize];
+  uint32_t committed[MPSC_RING_MAP_WORDS(bufsize)];
 };
 void ioqueue_init(struct ioqueue* ioq);
 bool ioq_full(struct ioqueue* ioq);
 bool ioq_empty(struct ioqueue* ioq);
 char ioq_getchar(struct ioqueue* ioq);
 void ioq_putchar(struct ioqueue* ioq, char byte);
+bool ioq_try_putchar(struct ioqueue* ioq, char byte);
+uint32_t ioq_read(struct ioqueue* ioq, char* buf, uint32_t count);
 uint32_t ioq_length(struct ioqueue *ioq);
-#endif
\ No newline at end of file
+#endif
@@ -153,9 +153,7 @@ static void intr_keyboard_handler() {
           (ctrl_status && cur_char == 'u')) {
         cur_char -= 'a';
       }
-      if (!ioq_full(&kbd_buf)) {
-        ioq_putchar(&kbd_buf, cur_char);
-      }
+      ioq_try_putchar(&kbd_buf, cur_char);  // 缓冲区满时丢弃
       return;
     }
 
@@ -0,0 +1,113 @@
+#include "pci.h"
+#include "io.h"
+#include "print.h"
+#include "stdio-kernel.h"
+
+// 通过0xcf8/0xcfc端口(配置机制1)访问配置空间
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+static struct pci_device pci_devices[PCI_MAX_DEVICES];
+static uint32_t pci_device_cnt;
+
+static uint32_t config_addr(uint8_t bus, uint8_t dev, uint8_t func,
+                            uint8_t offset) {
+  return 0x80000000 | (bus << 16) | (dev << 11) | (func << 8) |
+         (offset & 0xfc);
+}
+
+static uint32_t config_read(uint8_t bus, uint8_t dev, uint8_t func,
+                            uint8_t offset) {
+  outl(PCI_CONFIG_ADDRESS, config_addr(bus, dev, func, offset));
+  return inl(PCI_CONFIG_DATA);
+}
+
+uint32_t pci_config_read(struct pci_device* pdev, uint8_t offset) {
+  return config_read(pdev->bus, pdev->dev, pdev->func, offset);
+}
+
+void pci_config_write(struct pci_device* pdev, uint8_t offset, uint32_t val) {
+  outl(PCI_CONFIG_ADDRESS,
+       config_addr(pdev->bus, pdev->dev, pdev->func, offset));
+  outl(PCI_CONFIG_DATA, val);
+}
+
+// 打开I/O和内存空间译码，并允许设备作为总线主控发起DMA
+void pci_set_master(struct pci_device* pdev) {
+  uint32_t cmd = pci_config_read(pdev, PCI_COMMAND) & 0xffff;
+  pci_config_write(pdev, PCI_COMMAND, cmd | PCI_COMMAND_IO |
+                                          PCI_COMMAND_MEMORY |
+                                          PCI_COMMAND_MASTER);
+}
+
+static void probe_function(uint8_t bus, uint8_t dev, uint8_t func) {
+  uint32_t id = config_read(bus, dev, func, PCI_VENDOR_ID);
+  if ((id & 0xffff) == 0xffff || pci_device_cnt == PCI_MAX_DEVICES) {
+    return;
+  }
+  struct pci_device* pdev = &pci_devices[pci_device_cnt++];
+  pdev->bus = bus;
+  pdev->dev = dev;
+  pdev->func = func;
+  pdev->vendor_id = id & 0xffff;
+  pdev->device_id = id >> 16;
+  uint32_t class_rev = config_read(bus, dev, func, PCI_CLASS_REVISION);
+  pdev->class_code = class_rev >> 24;
+  pdev->subclass = (class_rev >> 16) & 0xff;
+  pdev->prog_if = (class_rev >> 8) & 0xff;
+  pdev->irq_line = config_read(bus, dev, func, PCI_INTERRUPT_LINE) & 0xff;
+  for (uint8_t i = 0; i < 6; i++) {
+    pdev->bar[i] = config_read(bus, dev, func, PCI_BAR0 + i * 4);
+  }
+  printk("    pci %d:%d.%d %x:%x class %x:%x\n", bus, dev, func,
+         pdev->vendor_id, pdev->device_id, pdev->class_code, pdev->subclass);
+}
+
+// 枚举所有总线上的设备，多功能设备逐个功能探测
+void pci_init(void) {
+  put_str("  pci_init start\n");
+  pci_device_cnt = 0;
+  for (uint32_t bus = 0; bus < 256; bus++) {
+    for (uint8_t dev = 0; dev < 32; dev++) {
+      if ((config_read(bus, dev, 0, PCI_VENDOR_ID) & 0xffff) == 0xffff) {
+        continue;
+      }
+      probe_function(bus, dev, 0);
+      uint8_t header_type =
+          (config_read(bus, dev, 0, PCI_HEADER_TYPE & 0xfc) >> 16) & 0xff;
+      if (header_type & 0x80) {
+        for (uint8_t func = 1; func < 8; func++) {
+          probe_function(bus, dev, func);
+        }
+      }
+    }
+  }
+  put_str("  pci_init done\n");
+}
+
+struct pci_device* pci_find_class(uint8_t class_code, uint8_t subclass) {
+  for (uint32_t i = 0; i < pci_device_cnt; i++) {
+    if (pci_devices[i].class_code == class_code &&
+        pci_devices[i].subclass == subclass) {
+      return &pci_devices[i];
+    }
+  }
+  return NULL;
+}
+
+// 从prev之后(prev为NULL时从头)找下一个匹配的设备，用于同型号的多个设备
+struct pci_device* pci_find_next(uint16_t vendor_id, uint16_t device_id,
+                                 struct pci_device* prev) {
+  uint32_t i = prev == NULL ? 0 : (uint32_t)(prev - pci_devices) + 1;
+  for (; i < pci_device_cnt; i++) {
+    if (pci_devices[i].vendor_id == vendor_id &&
+        pci_devices[i].device_id == device_id) {
+      return &pci_devices[i];
+    }
+  }
+  return NULL;
+}
+
+struct pci_device* pci_find_device(uint16_t vendor_id, uint16_t device_id) {
+  return pci_find_next(vendor_id, device_id, NULL);
+}
@@ -0,0 +1,41 @@
+#ifndef __DEVICE_PCI_H
+#define __DEVICE_PCI_H
+#include "stdint.h"
+#include "global.h"
+
+// 配置空间中的寄存器偏移
+#define PCI_VENDOR_ID 0x00
+#define PCI_COMMAND 0x04
+#define PCI_CLASS_REVISION 0x08  // 高24位依次为class、subclass、prog-if
+#define PCI_HEADER_TYPE 0x0e
+#define PCI_BAR0 0x10
+#define PCI_INTERRUPT_LINE 0x3c
+
+#define PCI_COMMAND_IO 0x1
+#define PCI_COMMAND_MEMORY 0x2
+#define PCI_COMMAND_MASTER 0x4
+
+#define PCI_MAX_DEVICES 32
+
+struct pci_device {
+  uint8_t bus;
+  uint8_t dev;
+  uint8_t func;
+  uint16_t vendor_id;
+  uint16_t device_id;
+  uint8_t class_code;
+  uint8_t subclass;
+  uint8_t prog_if;
+  uint8_t irq_line;
+  uint32_t bar[6];
+};
+
+void pci_init(void);
+uint32_t pci_config_read(struct pci_device* pdev, uint8_t offset);
+void pci_config_write(struct pci_device* pdev, uint8_t offset, uint32_t val);
+struct pci_device* pci_find_class(uint8_t class_code, uint8_t subclass);
+struct pci_device* pci_find_device(uint16_t vendor_id, uint16_t device_id);
+struct pci_device* pci_find_next(uint16_t vendor_id, uint16_t device_id,
+                                 struct pci_device* prev);
+void pci_set_master(struct pci_device* pdev);
+#endif
@@ -0,0 +1,75 @@
+#include "ramdisk.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "stdio.h"
+#include "stdio-kernel.h"
+#include "string.h"
+
+static uint8_t ramdisk_cnt;
+
+// 在提交者的上下文中直接复制，不经请求队列，返回前已完成
+static void ramdisk_submit(struct block_device* bdev, struct bio* bio) {
+  struct ramdisk* rd = bdev->private;
+  ASSERT(bio->lba + bio->sec_cnt <= rd->disk.sectors);
+  uint8_t* addr = rd->data + bio->lba * 512;
+  if (bio->write) {
+    memcpy(addr, bio->buf, bio->sec_cnt * 512);
+  } else {
+    memcpy(bio->buf, addr, bio->sec_cnt * 512);
+  }
+  if (bio->end_io != NULL) {
+    enum intr_status old_status = intr_disable();
+    bio->end_io(bio);
+    intr_set_status(old_status);
+  }
+}
+
+static void ramdisk_getgeo(struct block_device* bdev,
+                           struct blk_geometry* geo) {
+  struct ramdisk* rd = bdev->private;
+  geo->sectors = rd->disk.sectors;
+  geo->sector_size = 512;
+}
+
+static const struct block_device_ops ramdisk_bdev_ops = {
+    .submit = ramdisk_submit, .flush = NULL, .getgeo = ramdisk_getgeo};
+
+// 创建sectors个扇区的内存盘，整块盘作为一个分区挂到partition_list上
+struct disk* ramdisk_create(uint32_t sectors) {
+  uint32_t pg_cnt = DIV_ROUND_UP(sectors * 512, PG_SIZE);
+  struct ramdisk* rd = sys_malloc(sizeof(struct ramdisk));
+  if (rd == NULL) {
+    return NULL;
+  }
+  rd->data = get_kernel_pages(pg_cnt);
+  if (rd->data == NULL) {
+    sys_free(rd);
+    return NULL;
+  }
+  // 新页内容不确定，清零使分区不会被误认为已有文件系统
+  memset(rd->data, 0, pg_cnt * PG_SIZE);
+
+  struct disk* hd = &rd->disk;
+  memset(hd, 0, sizeof(struct disk));
+  sprintf(hd->name, "ram%d", ramdisk_cnt++);
+  hd->sectors = sectors;
+  hd->multi_cnt = 1;
+  bdev_register(&hd->bdev, hd->name, &ramdisk_bdev_ops, rd);
+
+  struct partition* part = &hd->prim_parts[0];
+  part->start_lba = 0;
+  part->sec_cnt = sectors;
+  part->my_disk = hd;
+  part->bdev = &hd->bdev;
+  strcpy(part->name, hd->name);
+  list_append(&partition_list, &part->part_tag);
+  printk("  %s: %dKB\n", hd->name, sectors / 2);
+  return hd;
+}
+
+void ramdisk_init(void) {
+  if (RAMDISK_SECTORS > 0 && ramdisk_create(RAMDISK_SECTORS) == NULL) {
+    PANIC("ramdisk_init: out of memory");
+  }
+}
@@ -0,0 +1,21 @@
+#ifndef __DEVICE_RAMDISK_H
+#define __DEVICE_RAMDISK_H
+#include "stdint.h"
+#include "global.h"
+#include "genhd.h"
+
+// ram0的扇区数，由cmake缓存变量RAMDISK_SECTORS传入(如cmake -DRAMDISK_SECTORS=4096
+// 即2MB)，非0才创建内存盘。整块盘作为一个分区ram0，由filesys_init像硬盘分区一样格式化，
+// 此时ram0默认就是根分区，见fs.h的ROOT_PART
+#ifndef RAMDISK_SECTORS
+#define RAMDISK_SECTORS 0
+#endif
+
+struct ramdisk {
+  struct disk disk;
+  uint8_t* data;
+};
+
+struct disk* ramdisk_create(uint32_t sectors);
+void ramdisk_init(void);
+#endif
@@ -4,8 +4,11 @@
 #include "thread.h"
 #include "debug.h"
 #include "interrupt.h"
+#include "softirq.h"
+#include "acct.h"
+#include "sched.h"
+#include "wait_exit.h"
 
-#define IRQ0_FREQUENCY 100
 #define INPUT_FREQUENCY 1193180
 #define COUNTRE0_VALUE INPUT_FREQUENCY / IRQ0_FREQUENCY
 #define COUNTRE0_PORT 0x40
@@ -13,9 +16,12 @@
 #define COUNTRE_MODE 2
 #define READ_WRITE_LATCH 3
 #define PIT_CONTROL_PORT 0x43
-#define mil_seconds_per_intr (1000 / IRQ0_FREQUENCY)
 
 uint32_t ticks;
+static struct list timer_list_head;  // 按到期时间升序排列的定时器
+
+// a是否不早于b，考虑ticks回绕
+#define time_after_eq(a, b) ((int32_t)((a) - (b)) >= 0)
 
 //设置定时器频率
 static void frequency_set(uint8_t counter_port,
@@ -32,23 +38,103 @@ static void frequency_set(uint8_t counter_port,
 
 
 
-static void intr_timer_handler(){
+// frame是中断入口传入的被打断现场
+static void intr_timer_handler(uint8_t vec_nr UNUSED,
+                               struct intr_stack* frame) {
   struct task_struct* cur_thread = running_thread();
   ASSERT(cur_thread->stack_magic == 0x13421342);
   cur_thread->elapsed_ticks++;
+  acct_tick(cur_thread, (frame->cs & 3) == 3);
   ticks++;
-  if(cur_thread->ticks == 0){
+  if (!list_empty(&timer_list_head)) {
+    struct timer_list* first =
+        elem2entry(struct timer_list, timer_tag, timer_list_head.head.next);
+    if (time_after_eq(ticks, first->expires)) {
+      raise_softirq(TIMER_SOFTIRQ);
+    }
+  }
+  // 时间片、实时和deadline预算的检查都在sched_tick中
+  if (sched_tick(cur_thread)) {
+    cur_thread->acct.involuntary = true;
     schedule();
-  }else{
-    cur_thread->ticks--;
+  }
+  // 线程组正在退出，从用户态被打断的线程不再返回用户态
+  if (cur_thread->killed && (frame->cs & 3) == 3) {
+    sys_thread_exit(NULL);
   }
 }
 
-static void ticks_to_sleep(uint32_t sleep_ticks){
-  uint32_t start_ticks = ticks;
-  while(ticks - start_ticks < sleep_ticks){
-    thread_yield();
+void timer_setup(struct timer_list* timer,
+                 void (*function)(struct timer_list*),
+                 void* data) {
+  timer->timer_tag.prev = timer->timer_tag.next = NULL;
+  timer->function = function;
+  timer->data = data;
+}
+
+bool timer_pending(struct timer_list* timer) {
+  return elem_linked(&timer->timer_tag);
+}
+
+// 在expires时刻触发timer，已在队列中的定时器会被重新排队
+void add_timer(struct timer_list* timer, uint32_t expires) {
+  enum intr_status old_status = intr_disable();
+  if (timer_pending(timer)) {
+    list_remove(&timer->timer_tag);
+  }
+  timer->expires = expires;
+  struct list_elem* pos = timer_list_head.head.next;
+  while (pos != &timer_list_head.tail) {
+    struct timer_list* t = elem2entry(struct timer_list, timer_tag, pos);
+    if (!time_after_eq(expires, t->expires)) {
+      break;
+    }
+    pos = pos->next;
+  }
+  list_insert_before(pos, &timer->timer_tag);
+  intr_set_status(old_status);
+}
+
+// 取消尚未触发的定时器，返回它是否还在队列中
+bool del_timer(struct timer_list* timer) {
+  enum intr_status old_status = intr_disable();
+  bool pending = timer_pending(timer);
+  if (pending) {
+    list_remove(&timer->timer_tag);
+  }
+  intr_set_status(old_status);
+  return pending;
+}
+
+// TIMER_SOFTIRQ的处理函数，依次调用所有已到期定时器
+static void run_timers(void) {
+  enum intr_status old_status = intr_disable();
+  while (!list_empty(&timer_list_head)) {
+    struct timer_list* timer =
+        elem2entry(struct timer_list, timer_tag, timer_list_head.head.next);
+    if (!time_after_eq(ticks, timer->expires)) {
+      break;
+    }
+    list_remove(&timer->timer_tag);
+    intr_set_status(old_status);
+    timer->function(timer);
+    intr_disable();
   }
+  intr_set_status(old_status);
+}
+
+static void sleep_timeout(struct timer_list* timer) {
+  thread_unblock((struct task_struct*)timer->data);
+}
+
+// 挂一个定时器后阻塞，到期由softirq线程唤醒，不再忙等
+static void ticks_to_sleep(uint32_t sleep_ticks){
+  struct timer_list timer;
+  timer_setup(&timer, sleep_timeout, running_thread());
+  enum intr_status old_status = intr_disable();
+  add_timer(&timer, ticks + sleep_ticks);
+  thread_block(TASK_BLOCKED);
+  intr_set_status(old_status);
 }
 
 void mtime_sleep(uint32_t m_seconds){
@@ -60,6 +146,8 @@ void mtime_sleep(uint32_t m_seconds){
 void timer_init(){
   frequency_set(COUNTRE0_PORT, COUNTRE0_NO, READ_WRITE_LATCH, COUNTRE_MODE,
                 COUNTRE0_VALUE);
+  list_init(&timer_list_head);
+  open_softirq(TIMER_SOFTIRQ, run_timers);
   register_handler(0x20, intr_timer_handler);
   put_str("  timer_init done\n");
 }
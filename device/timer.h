@@ -1,6 +1,27 @@
 #ifndef __DEVICE_TIME_H
 #define __DEVICE_TIME_H
 #include "stdint.h"
+#include "list.h"
+
+#define IRQ0_FREQUENCY 100
+#define mil_seconds_per_intr (1000 / IRQ0_FREQUENCY)
+
+// 内核定时器，到期后在softirq线程中调用function
+struct timer_list {
+  struct list_elem timer_tag;
+  uint32_t expires;  // 到期的ticks
+  void (*function)(struct timer_list* timer);
+  void* data;
+};
+
+extern uint32_t ticks;
+
 void timer_init();
 void mtime_sleep(uint32_t m_seconds);
+void timer_setup(struct timer_list* timer,
+                 void (*function)(struct timer_list*),
+                 void* data);
+void add_timer(struct timer_list* timer, uint32_t expires);
+bool del_timer(struct timer_list* timer);
+bool timer_pending(struct timer_list* timer);
 #endif
@@ -0,0 +1,333 @@
+#include "virtio_blk.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "io.h"
+#include "memory.h"
+#include "pci.h"
+#include "stdio.h"
+#include "stdio-kernel.h"
+
+// 传统virtio PCI设备的I/O端口寄存器
+#define VIRTIO_PCI_HOST_FEATURES 0x00
+#define VIRTIO_PCI_GUEST_FEATURES 0x04
+#define VIRTIO_PCI_QUEUE_PFN 0x08
+#define VIRTIO_PCI_QUEUE_NUM 0x0c
+#define VIRTIO_PCI_QUEUE_SEL 0x0e
+#define VIRTIO_PCI_QUEUE_NOTIFY 0x10
+#define VIRTIO_PCI_STATUS 0x12
+#define VIRTIO_PCI_ISR 0x13     // 读后清零
+#define VIRTIO_PCI_CONFIG 0x14  // 未启用MSI-X时设备配置从这里开始
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 1
+#define VIRTIO_STATUS_DRIVER 2
+#define VIRTIO_STATUS_DRIVER_OK 4
+#define VIRTIO_STATUS_FAILED 0x80
+
+#define VIRTIO_BLK_F_SEG_MAX (1u << 2)
+#define VIRTIO_RING_F_EVENT_IDX (1u << 29)
+
+// virtio-blk配置空间：capacity(8字节)、size_max、seg_max
+#define VIRTIO_BLK_CFG_CAPACITY 0
+#define VIRTIO_BLK_CFG_SEG_MAX 12
+
+#define VIRTIO_VENDOR_ID 0x1af4
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+
+static struct virtio_blk vblks[VIRTIO_BLK_MAX_DISKS];
+static struct disk vblk_disks[VIRTIO_BLK_MAX_DISKS];
+static uint8_t vblk_cnt;
+
+// x86只会把写后的读提前，带lock前缀的指令是完整的内存屏障
+static inline void mb(void) {
+  asm volatile("lock; addl $0, 0(%%esp)" ::: "memory");
+}
+
+// 编译器屏障，x86上写与写、读与读之间不会乱序
+static inline void wmb(void) {
+  asm volatile("" ::: "memory");
+}
+
+static inline volatile uint16_t* vring_used_event(struct virtqueue* vq) {
+  return (volatile uint16_t*)((uint32_t)vq->avail + 4 + 2 * vq->num);
+}
+
+static inline volatile uint16_t* vring_avail_event(struct virtqueue* vq) {
+  return (volatile uint16_t*)&vq->used->ring[vq->num];
+}
+
+// 传统接口的vring布局：已用环对齐到页，整体所占的页数
+static uint32_t vring_pages(uint16_t num) {
+  uint32_t avail_end = sizeof(struct vring_desc) * num + 6 + 2 * num;
+  uint32_t used_size = 6 + sizeof(struct vring_used_elem) * num;
+  return DIV_ROUND_UP(avail_end, PG_SIZE) + DIV_ROUND_UP(used_size, PG_SIZE);
+}
+
+static void vring_init(struct virtqueue* vq, void* mem, uint16_t num) {
+  vq->num = num;
+  vq->desc = mem;
+  vq->avail = (struct vring_avail*)((uint32_t)mem +
+                                    sizeof(struct vring_desc) * num);
+  uint32_t avail_end = (uint32_t)&vq->avail->ring[num] + 2;
+  vq->used =
+      (struct vring_used*)(DIV_ROUND_UP(avail_end, PG_SIZE) * PG_SIZE);
+  uint16_t idx;
+  for (idx = 0; idx < num - 1; idx++) {
+    vq->desc[idx].next = idx + 1;
+  }
+  vq->free_head = 0;
+  vq->num_free = num;
+  vq->last_used_idx = vq->avail_idx = vq->kicked_idx = 0;
+}
+
+// 新的可用项对设备可见后，按对方的要求决定是否通知设备
+static void vq_kick(struct virtio_blk* vblk) {
+  struct virtqueue* vq = &vblk->vq;
+  mb();
+  bool notify;
+  if (vblk->event_idx) {
+    // 设备要求在可用索引越过avail_event时才通知
+    uint16_t event = *vring_avail_event(vq);
+    notify = (uint16_t)(vq->avail_idx - event - 1) <
+             (uint16_t)(vq->avail_idx - vq->kicked_idx);
+  } else {
+    notify = !(vq->used->flags & VRING_USED_F_NO_NOTIFY);
+  }
+  vq->kicked_idx = vq->avail_idx;
+  if (notify) {
+    outw(vblk->iobase + VIRTIO_PCI_QUEUE_NOTIFY, 0);
+  }
+}
+
+// 归还从head开始的描述符链
+static void vq_free_chain(struct virtqueue* vq, uint16_t head) {
+  uint16_t idx = head;
+  vq->num_free++;
+  while (vq->desc[idx].flags & VRING_DESC_F_NEXT) {
+    idx = vq->desc[idx].next;
+    vq->num_free++;
+  }
+  vq->desc[idx].next = vq->free_head;
+  vq->free_head = head;
+}
+
+static uint16_t vq_alloc_desc(struct virtqueue* vq) {
+  ASSERT(vq->num_free > 0);
+  uint16_t idx = vq->free_head;
+  vq->free_head = vq->desc[idx].next;
+  vq->num_free--;
+  return idx;
+}
+
+// 把缓冲区按物理页拆成数据段，物理上相接的合并，返回新的段数
+static uint32_t sg_add(uint32_t* seg_addr, uint32_t* seg_len, uint32_t n,
+                       void* buf, uint32_t bytes) {
+  uint32_t vaddr = (uint32_t)buf;
+  while (bytes > 0) {
+    uint32_t phys = addr_v2p(vaddr);
+    uint32_t chunk = PG_SIZE - (vaddr & (PG_SIZE - 1));
+    if (chunk > bytes) {
+      chunk = bytes;
+    }
+    if (n > 0 && seg_addr[n - 1] + seg_len[n - 1] == phys) {
+      seg_len[n - 1] += chunk;
+    } else {
+      ASSERT(n < VIRTIO_BLK_MAX_SEGS);
+      seg_addr[n] = phys;
+      seg_len[n] = chunk;
+      n++;
+    }
+    vaddr += chunk;
+    bytes -= chunk;
+  }
+  return n;
+}
+
+// 请求队列的驱动回调：头部、各数据段、状态字节串成一条描述符链放入可用环，
+// 设备完成后由中断结束请求
+static int32_t virtio_blk_do_request(struct request_queue* q,
+                                     struct request* rq) {
+  struct virtio_blk* vblk = q->queuedata;
+  struct virtqueue* vq = &vblk->vq;
+  uint32_t seg_addr[VIRTIO_BLK_MAX_SEGS], seg_len[VIRTIO_BLK_MAX_SEGS];
+  uint32_t seg_cnt = 0;
+  struct list_elem* elem = rq->bios.head.next;
+  while (elem != &rq->bios.tail) {
+    struct bio* bio = elem2entry(struct bio, bio_tag, elem);
+    seg_cnt = sg_add(seg_addr, seg_len, seg_cnt, bio->buf, bio->sec_cnt * 512);
+    elem = elem->next;
+  }
+
+  enum intr_status old_status = intr_disable();
+  // queue_depth保证了在途请求的描述符总数不超过队列长度
+  ASSERT(vq->num_free >= seg_cnt + 2);
+  uint16_t head = vq_alloc_desc(vq);
+  vblk->hdrs[head].type = rq->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  vblk->hdrs[head].reserved = 0;
+  vblk->hdrs[head].sector = rq->lba;
+  vblk->status[head] = 0xff;
+  vblk->head_rq[head] = rq;
+  vq->desc[head].addr = addr_v2p((uint32_t)&vblk->hdrs[head]);
+  vq->desc[head].len = sizeof(struct virtio_blk_outhdr);
+  vq->desc[head].flags = VRING_DESC_F_NEXT;
+
+  uint16_t prev = head;
+  uint32_t idx;
+  for (idx = 0; idx < seg_cnt; idx++) {
+    uint16_t d = vq_alloc_desc(vq);
+    vq->desc[prev].next = d;
+    vq->desc[d].addr = seg_addr[idx];
+    vq->desc[d].len = seg_len[idx];
+    vq->desc[d].flags =
+        VRING_DESC_F_NEXT | (rq->write ? 0 : VRING_DESC_F_WRITE);
+    prev = d;
+  }
+  uint16_t d = vq_alloc_desc(vq);
+  vq->desc[prev].next = d;
+  vq->desc[d].addr = addr_v2p((uint32_t)&vblk->status[head]);
+  vq->desc[d].len = 1;
+  vq->desc[d].flags = VRING_DESC_F_WRITE;
+
+  vq->avail->ring[vq->avail_idx & (vq->num - 1)] = head;
+  wmb();  // 先让环中的项可见，再更新索引
+  vq->avail->idx = ++vq->avail_idx;
+  vq_kick(vblk);
+  intr_set_status(old_status);
+  return BLK_QUEUED;
+}
+
+// 回收已用环中的所有项并结束对应的请求。用事件索引时把used_event设为
+// 已处理到的位置，设备只在之后再有完成时才发中断；设好后再检查一遍，
+// 以免漏掉设置前刚完成的项
+static void virtio_blk_complete(struct virtio_blk* vblk) {
+  struct virtqueue* vq = &vblk->vq;
+  do {
+    while (vq->last_used_idx != vq->used->idx) {
+      struct vring_used_elem* e =
+          &vq->used->ring[vq->last_used_idx & (vq->num - 1)];
+      uint16_t head = e->id;
+      struct request* rq = vblk->head_rq[head];
+      int32_t error = vblk->status[head] == 0 ? 0 : -1;
+      vblk->head_rq[head] = NULL;
+      vq_free_chain(vq, head);
+      vq->last_used_idx++;
+      blk_complete_request(&vblk->disk->queue, rq, error);
+    }
+    if (vblk->event_idx) {
+      *vring_used_event(vq) = vq->last_used_idx;
+    }
+    mb();
+  } while (vq->last_used_idx != vq->used->idx);
+}
+
+// 每个设备各挂一个处理程序，中断线可能共用，读ISR判断是不是自己发的
+static void intr_virtio_blk_handler(void* dev_id) {
+  struct virtio_blk* vblk = dev_id;
+  if (inb(vblk->iobase + VIRTIO_PCI_ISR) & 1) {
+    virtio_blk_complete(vblk);
+  }
+}
+
+// 按传统接口的流程协商特性、建立0号队列，成功返回true
+static bool virtio_blk_probe(struct virtio_blk* vblk) {
+  uint16_t iobase = vblk->iobase;
+  outb(iobase + VIRTIO_PCI_STATUS, 0);  // 复位
+  outb(iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+  outb(iobase + VIRTIO_PCI_STATUS,
+       VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+  uint32_t features = inl(iobase + VIRTIO_PCI_HOST_FEATURES) &
+                      (VIRTIO_BLK_F_SEG_MAX | VIRTIO_RING_F_EVENT_IDX);
+  outl(iobase + VIRTIO_PCI_GUEST_FEATURES, features);
+  vblk->event_idx = features & VIRTIO_RING_F_EVENT_IDX;
+
+  outw(iobase + VIRTIO_PCI_QUEUE_SEL, 0);
+  uint16_t num = inw(iobase + VIRTIO_PCI_QUEUE_NUM);
+  if (num == 0 || (num & (num - 1)) != 0 || num > PG_SIZE) {
+    outb(iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+    return false;
+  }
+  void* ring = get_kernel_pages_contig(vring_pages(num));
+  vblk->hdrs = get_kernel_pages(
+      DIV_ROUND_UP(num * sizeof(struct virtio_blk_outhdr), PG_SIZE));
+  vblk->status = get_kernel_pages(1);
+  vblk->head_rq = sys_malloc(num * sizeof(struct request*));
+  if (ring == NULL || vblk->hdrs == NULL || vblk->status == NULL ||
+      vblk->head_rq == NULL) {
+    outb(iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+    return false;
+  }
+  vring_init(&vblk->vq, ring, num);
+  outl(iobase + VIRTIO_PCI_QUEUE_PFN, addr_v2p((uint32_t)ring) / PG_SIZE);
+  return true;
+}
+
+void virtio_blk_init(void) {
+  struct pci_device* pdev = NULL;
+  while (vblk_cnt < VIRTIO_BLK_MAX_DISKS &&
+         (pdev = pci_find_next(VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID,
+                               pdev)) != NULL) {
+    // 8259A只有16根中断线，没有可用中断线的设备不用
+    if (!(pdev->bar[0] & 1) || pdev->irq_line >= 16) {
+      continue;
+    }
+    if (vblk_cnt == 0) {
+      printk("  virtio_blk_init start\n");
+    }
+    struct virtio_blk* vblk = &vblks[vblk_cnt];
+    struct disk* hd = &vblk_disks[vblk_cnt];
+    vblk->pdev = pdev;
+    vblk->iobase = pdev->bar[0] & 0xfffc;
+    vblk->disk = hd;
+    sprintf(hd->name, "vd%c", 'a' + vblk_cnt);
+    pci_set_master(pdev);
+    if (!virtio_blk_probe(vblk)) {
+      printk("    %s: virtqueue setup failed\n", hd->name);
+      continue;
+    }
+
+    uint32_t cfg = vblk->iobase + VIRTIO_PCI_CONFIG;
+    hd->my_channel = NULL;
+    hd->dev_no = vblk_cnt;
+    hd->dma = true;
+    hd->lba48 = true;
+    hd->multi_cnt = 1;
+    hd->sectors = inl(cfg + VIRTIO_BLK_CFG_CAPACITY + 4) != 0
+                      ? 0xffffffff
+                      : inl(cfg + VIRTIO_BLK_CFG_CAPACITY);
+    uint32_t max_segs = VIRTIO_BLK_MAX_SEGS;
+    uint32_t seg_max = inl(cfg + VIRTIO_BLK_CFG_SEG_MAX);
+    if ((inl(vblk->iobase + VIRTIO_PCI_GUEST_FEATURES) &
+         VIRTIO_BLK_F_SEG_MAX) &&
+        seg_max >= 2 && seg_max < max_segs) {
+      max_segs = seg_max;
+    }
+    // 每个请求最多占max_segs + 2个描述符
+    uint32_t depth = vblk->vq.num / (max_segs + 2);
+    if (depth > BLK_NR_REQUESTS) {
+      depth = BLK_NR_REQUESTS;
+    }
+    ASSERT(depth > 0);
+    printk("    %s: %dMB, queue %d, depth %d%s\n", hd->name, hd->sectors >> 11,
+           vblk->vq.num, depth, vblk->event_idx ? ", event idx" : "");
+
+    vblk_cnt++;
+    if (request_irq(pdev->irq_line, intr_virtio_blk_handler, vblk) != 0) {
+      PANIC("virtio_blk_init: irq busy");
+    }
+    blk_queue_init(&hd->queue, hd->name, virtio_blk_do_request, vblk);
+    hd->queue.queue_depth = depth;
+    hd->queue.max_segments = max_segs;
+    // 单个bio最多跨max_segs页
+    hd->queue.max_sectors = VIRTIO_BLK_MAX_SECTORS;
+    if ((max_segs - 1) * (PG_SIZE / 512) < hd->queue.max_sectors) {
+      hd->queue.max_sectors = (max_segs - 1) * (PG_SIZE / 512);
+    }
+    outb(vblk->iobase + VIRTIO_PCI_STATUS,
+         VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER |
+             VIRTIO_STATUS_DRIVER_OK);
+    disk_register(hd, &disk_bdev_ops);
+    disk_scan_partitions(hd);
+  }
+  if (vblk_cnt > 0) {
+    printk("  virtio_blk_init done\n");
+  }
+}
@@ -0,0 +1,74 @@
+#ifndef __DEVICE_VIRTIO_BLK_H
+#define __DEVICE_VIRTIO_BLK_H
+#include "stdint.h"
+#include "global.h"
+#include "genhd.h"
+
+#define VIRTIO_BLK_MAX_DISKS 4
+#define VIRTIO_BLK_MAX_SEGS 32     // 每个请求的数据段上限，另加头部和状态两个描述符
+#define VIRTIO_BLK_MAX_SECTORS 128
+
+// 分离式virtqueue：描述符表、驱动写的可用环、设备写的已用环，
+// 传统接口要求三者物理连续，已用环从页边界开始
+struct vring_desc {
+  uint64_t addr;
+  uint32_t len;
+  uint16_t flags;
+  uint16_t next;
+} __attribute__((packed));
+#define VRING_DESC_F_NEXT 1
+#define VRING_DESC_F_WRITE 2  // 设备写入的缓冲区
+
+struct vring_avail {
+  uint16_t flags;
+  volatile uint16_t idx;
+  uint16_t ring[0];  // 之后是used_event
+} __attribute__((packed));
+
+struct vring_used_elem {
+  uint32_t id;  // 描述符链的首项
+  uint32_t len;
+} __attribute__((packed));
+
+struct vring_used {
+  volatile uint16_t flags;
+  volatile uint16_t idx;
+  struct vring_used_elem ring[0];  // 之后是avail_event
+} __attribute__((packed));
+#define VRING_USED_F_NO_NOTIFY 1
+
+struct virtqueue {
+  uint16_t num;  // 队列长度，2的幂
+  struct vring_desc* desc;
+  struct vring_avail* avail;
+  struct vring_used* used;
+  uint16_t free_head;  // 空闲描述符经next串成链
+  uint16_t num_free;
+  uint16_t last_used_idx;
+  uint16_t avail_idx;  // 已放入可用环的项数，上次通知设备时为kicked_idx
+  uint16_t kicked_idx;
+};
+
+// 每个请求的头部，设备只读
+struct virtio_blk_outhdr {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t sector;
+} __attribute__((packed));
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+
+struct virtio_blk {
+  struct pci_device* pdev;
+  uint16_t iobase;
+  bool event_idx;  // 双方都支持VIRTIO_RING_F_EVENT_IDX，用事件索引抑制中断和通知
+  struct virtqueue vq;
+  // 以下按描述符链首项索引
+  struct virtio_blk_outhdr* hdrs;
+  uint8_t* status;
+  struct request** head_rq;
+  struct disk* disk;
+};
+
+void virtio_blk_init(void);
+#endif
@@ -0,0 +1,352 @@
+#include "buffer.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "stdio.h"
+#include "string.h"
+#include "sync.h"
+#include "thread.h"
+#include "wait_queue.h"
+#include "workqueue.h"
+
+static struct buffer_head* buffers;
+static struct list hash_table[BUFFER_HASH];
+static struct list lru_list;         // 未被引用的缓冲区，表头最久未用
+static struct wait_queue buffer_wq;  // 等待读写完成或有缓冲区可回收
+static uint32_t nr_dirty;
+
+static struct delayed_work flush_work;  // 在system_wq中执行的写回工作
+static struct mutex flush_lock;      // 保护flush_list
+static struct buffer_head* flush_list[NR_BUFFERS];
+
+#define bhash(bdev, lba) \
+  (&hash_table[((uint32_t)(bdev) ^ (lba)) % BUFFER_HASH])
+
+// 立即安排一次写回，周期写回的定时器保持不变，须关中断调用
+static void wake_flusher(void) {
+  queue_work(system_wq, &flush_work.work);
+}
+
+// 在哈希表中查找缓冲区，须关中断调用
+static struct buffer_head* find_buffer(struct block_device* bdev,
+                                       uint32_t lba) {
+  struct list* bucket = bhash(bdev, lba);
+  struct list_elem* elem = bucket->head.next;
+  while (elem != &bucket->tail) {
+    struct buffer_head* bh = elem2entry(struct buffer_head, hash_tag, elem);
+    if (bh->b_bdev == bdev && bh->b_lba == lba) {
+      return bh;
+    }
+    elem = elem->next;
+  }
+  return NULL;
+}
+
+// 增加一个引用，须关中断调用
+static void get_bh(struct buffer_head* bh) {
+  if (bh->b_count++ == 0) {
+    list_remove(&bh->lru_tag);
+  }
+}
+
+// 取得(bdev, lba)的缓冲区并增加引用，不在缓存中时回收LRU上最久未用的干净缓冲区，
+// 没有可回收的缓冲区时返回NULL。须关中断调用
+static struct buffer_head* getblk(struct block_device* bdev, uint32_t lba) {
+  struct buffer_head* bh = find_buffer(bdev, lba);
+  if (bh == NULL) {
+    struct list_elem* elem = lru_list.head.next;
+    while (elem != &lru_list.tail) {
+      bh = elem2entry(struct buffer_head, lru_tag, elem);
+      if (!(bh->b_state & BH_DIRTY)) {
+        break;
+      }
+      elem = elem->next;
+    }
+    if (elem == &lru_list.tail) {
+      return NULL;
+    }
+    if (bh->b_bdev != NULL) {
+      list_remove(&bh->hash_tag);
+    }
+    bh->b_bdev = bdev;
+    bh->b_lba = lba;
+    bh->b_state = 0;
+    list_push(bhash(bdev, lba), &bh->hash_tag);
+  }
+  get_bh(bh);
+  return bh;
+}
+
+// 同getblk，没有可回收的缓冲区时安排bdflush写回脏块并等待。须关中断调用
+static struct buffer_head* getblk_wait(struct block_device* bdev,
+                                       uint32_t lba) {
+  struct buffer_head* bh;
+  while ((bh = getblk(bdev, lba)) == NULL) {
+    wake_flusher();
+    wait_queue_sleep(&buffer_wq);
+  }
+  return bh;
+}
+
+// 释放一个引用，可在中断中调用
+void brelse(struct buffer_head* bh) {
+  enum intr_status old_status = intr_disable();
+  ASSERT(bh->b_count > 0);
+  if (--bh->b_count == 0) {
+    list_append(&lru_list, &bh->lru_tag);
+    wake_up_all(&buffer_wq);
+  }
+  intr_set_status(old_status);
+}
+
+static void mark_dirty(struct buffer_head* bh) {
+  if (!(bh->b_state & BH_DIRTY)) {
+    bh->b_state |= BH_DIRTY;
+    if (++nr_dirty >= BUFFER_DIRTY_HIGH) {
+      wake_flusher();
+    }
+  }
+}
+
+// 读入或写回完成，在派发线程或中断中关中断调用。写回失败的缓冲区仍为脏，
+// 下次写回时重试
+static void buffer_end_io(struct bio* bio) {
+  struct buffer_head* bh = bio->private;
+  bh->b_state &= ~BH_LOCKED;
+  if (bio->error != 0) {
+    bh->b_state |= BH_ERROR;
+    if (bio->write) {
+      mark_dirty(bh);
+    } else {
+      bh->b_state &= ~BH_UPTODATE;
+    }
+  } else if (!bio->write) {
+    bh->b_state |= BH_UPTODATE;
+  }
+  wake_up_all(&buffer_wq);
+  brelse(bh);
+}
+
+// 异步读写缓冲区，bio持有一个引用直到完成。须关中断调用
+static void start_io(struct buffer_head* bh, bool write) {
+  if (write) {
+    bh->b_state &= ~BH_DIRTY;
+    nr_dirty--;
+  }
+  bh->b_state = (bh->b_state & ~BH_ERROR) | BH_LOCKED;
+  get_bh(bh);
+  bio_init(&bh->b_bio, bh->b_lba, bh->b_data, 1, write);
+  bh->b_bio.end_io = buffer_end_io;
+  bh->b_bio.private = bh;
+  bh->b_bdev->ops->submit(bh->b_bdev, &bh->b_bio);
+}
+
+// 为不在缓存中的扇区发出异步读，没有可回收的缓冲区时放弃并返回false，
+// 须关中断调用
+static bool prefetch(struct block_device* bdev, uint32_t lba) {
+  struct buffer_head* bh = getblk(bdev, lba);
+  if (bh == NULL) {
+    return false;
+  }
+  if (!(bh->b_state & (BH_UPTODATE | BH_LOCKED))) {
+    start_io(bh, false);
+  }
+  brelse(bh);
+  return true;
+}
+
+// 读一个扇区，返回已引用的缓冲区，用完后brelse，修改后调用bwrite。
+// 正在写回的缓冲区等写完再返回，读失败时重试一次
+struct buffer_head* bread(struct block_device* bdev, uint32_t lba) {
+  bool retried = false;
+  enum intr_status old_status = intr_disable();
+  struct buffer_head* bh = getblk_wait(bdev, lba);
+  while (!(bh->b_state & BH_UPTODATE) || (bh->b_state & BH_LOCKED)) {
+    if (!(bh->b_state & (BH_UPTODATE | BH_LOCKED))) {
+      if (bh->b_state & BH_ERROR) {
+        if (retried) {
+          char error[64];
+          sprintf(error, "%s read sector %d failed!!!!!\n", bdev->name, lba);
+          PANIC(error);
+        }
+        retried = true;
+      }
+      start_io(bh, false);
+      continue;  // 同步完成的设备此时已读完
+    }
+    wait_queue_sleep(&buffer_wq);
+  }
+  intr_set_status(old_status);
+  return bh;
+}
+
+// 标记bread得到的缓冲区已修改，由bdflush写回
+void bwrite(struct buffer_head* bh) {
+  enum intr_status old_status = intr_disable();
+  ASSERT(bh->b_count > 0 && (bh->b_state & BH_UPTODATE));
+  mark_dirty(bh);
+  intr_set_status(old_status);
+}
+
+// 预读：为不在缓存中的扇区发出异步读后立即返回。在关中断下一次提交完，
+// 派发线程取请求前相邻扇区已合并成一个请求。缓存中没有可回收的缓冲区时
+// 停下，返回前面已在缓存或已发出读的扇区数
+uint32_t breada(struct block_device* bdev, uint32_t* lbas, uint32_t cnt) {
+  enum intr_status old_status = intr_disable();
+  uint32_t idx;
+  for (idx = 0; idx < cnt; idx++) {
+    if (!prefetch(bdev, lbas[idx])) {
+      break;
+    }
+  }
+  intr_set_status(old_status);
+  return idx;
+}
+
+// 经缓存读连续的sec_cnt个扇区，未命中的先一起发出
+void buffer_read(struct block_device* bdev, uint32_t lba, void* buf,
+                 uint32_t sec_cnt) {
+  enum intr_status old_status = intr_disable();
+  uint32_t idx;
+  for (idx = 1; idx < sec_cnt; idx++) {
+    prefetch(bdev, lba + idx);
+  }
+  intr_set_status(old_status);
+  for (idx = 0; idx < sec_cnt; idx++) {
+    struct buffer_head* bh = bread(bdev, lba + idx);
+    memcpy((uint8_t*)buf + idx * 512, bh->b_data, 512);
+    brelse(bh);
+  }
+}
+
+// 写入缓存并标脏。正在读入或写回的缓冲区等I/O结束后再改
+void buffer_write(struct block_device* bdev, uint32_t lba, void* buf,
+                  uint32_t sec_cnt) {
+  enum intr_status old_status = intr_disable();
+  uint32_t idx;
+  for (idx = 0; idx < sec_cnt; idx++) {
+    struct buffer_head* bh = getblk_wait(bdev, lba + idx);
+    while (bh->b_state & BH_LOCKED) {
+      wait_queue_sleep(&buffer_wq);
+    }
+    memcpy(bh->b_data, (uint8_t*)buf + idx * 512, 512);
+    bh->b_state |= BH_UPTODATE;
+    mark_dirty(bh);
+    brelse(bh);
+  }
+  intr_set_status(old_status);
+}
+
+// 在缓存中将从lba开始的sec_cnt个扇区清零，不必先读盘
+void buffer_zero(struct block_device* bdev, uint32_t lba, uint32_t sec_cnt) {
+  enum intr_status old_status = intr_disable();
+  uint32_t idx;
+  for (idx = 0; idx < sec_cnt; idx++) {
+    struct buffer_head* bh = getblk_wait(bdev, lba + idx);
+    while (bh->b_state & BH_LOCKED) {
+      wait_queue_sleep(&buffer_wq);
+    }
+    memset(bh->b_data, 0, 512);
+    bh->b_state |= BH_UPTODATE;
+    mark_dirty(bh);
+    brelse(bh);
+  }
+  intr_set_status(old_status);
+}
+
+// 把bdev(NULL表示所有块设备)的脏缓冲区按(设备, 扇区号)排序后在关中断下一起提交，
+// 相邻扇区在请求队列中合并成一次写。wait为true时还等待已在写回的缓冲区，
+// 全部写完后返回，有失败返回-1
+static int32_t flush_buffers(struct block_device* bdev, bool wait) {
+  int32_t error = 0;
+  mutex_lock(&flush_lock);
+  enum intr_status old_status = intr_disable();
+  uint32_t n = 0, idx;
+  for (idx = 0; idx < NR_BUFFERS; idx++) {
+    struct buffer_head* bh = &buffers[idx];
+    bool writing = (bh->b_state & BH_LOCKED) && bh->b_bio.write;
+    if ((bdev != NULL && bh->b_bdev != bdev) ||
+        !((bh->b_state & BH_DIRTY) || (wait && writing))) {
+      continue;
+    }
+    uint32_t pos = n++;
+    while (pos > 0 && (flush_list[pos - 1]->b_bdev > bh->b_bdev ||
+                       (flush_list[pos - 1]->b_bdev == bh->b_bdev &&
+                        flush_list[pos - 1]->b_lba > bh->b_lba))) {
+      flush_list[pos] = flush_list[pos - 1];
+      pos--;
+    }
+    flush_list[pos] = bh;
+  }
+  for (idx = 0; idx < n; idx++) {
+    struct buffer_head* bh = flush_list[idx];
+    // 等待时要持有引用，防止写完后被回收
+    if (wait) {
+      get_bh(bh);
+    }
+    if (bh->b_state & BH_DIRTY) {
+      start_io(bh, true);
+    }
+  }
+  if (wait) {
+    for (idx = 0; idx < n; idx++) {
+      struct buffer_head* bh = flush_list[idx];
+      while (bh->b_state & BH_LOCKED) {
+        wait_queue_sleep(&buffer_wq);
+      }
+      if (bh->b_state & BH_ERROR) {
+        error = -1;
+      }
+      brelse(bh);
+    }
+  }
+  intr_set_status(old_status);
+  mutex_unlock(&flush_lock);
+  return error;
+}
+
+// 写回bdev(NULL表示所有块设备)的全部脏块并等待完成，再让设备把写缓存写入介质
+int32_t buffer_sync(struct block_device* bdev) {
+  int32_t error = flush_buffers(bdev, true);
+  struct list_elem* elem = bdev_list.head.next;
+  while (elem != &bdev_list.tail) {
+    struct block_device* dev =
+        elem2entry(struct block_device, bdev_tag, elem);
+    if ((bdev == NULL || dev == bdev) && dev->ops->flush != NULL &&
+        dev->ops->flush(dev) != 0) {
+      error = -1;
+    }
+    elem = elem->next;
+  }
+  return error;
+}
+
+// 写回工作，每BUFFER_FLUSH_TICKS执行一次，脏块过多时提前入队。
+// 定时器仍在等待时重新安排会失败，周期不受提前写回影响
+static void bdflush(struct work_struct* work UNUSED) {
+  flush_buffers(NULL, false);
+  queue_delayed_work(system_wq, &flush_work, BUFFER_FLUSH_TICKS);
+}
+
+void buffer_init(void) {
+  buffers = sys_malloc(sizeof(struct buffer_head) * NR_BUFFERS);
+  uint8_t* data = get_kernel_pages(NR_BUFFERS * 512 / PG_SIZE);
+  if (buffers == NULL || data == NULL) {
+    PANIC("buffer_init: alloc failed");
+  }
+  uint32_t idx;
+  for (idx = 0; idx < BUFFER_HASH; idx++) {
+    list_init(&hash_table[idx]);
+  }
+  list_init(&lru_list);
+  wait_queue_init(&buffer_wq);
+  for (idx = 0; idx < NR_BUFFERS; idx++) {
+    struct buffer_head* bh = &buffers[idx];
+    memset(bh, 0, sizeof(struct buffer_head));
+    bh->b_data = data + idx * 512;
+    list_append(&lru_list, &bh->lru_tag);
+  }
+  mutex_init(&flush_lock);
+  init_delayed_work(&flush_work, bdflush);
+  queue_delayed_work(system_wq, &flush_work, BUFFER_FLUSH_TICKS);
+}
@@ -0,0 +1,45 @@
+#ifndef __FS_BUFFER_H
+#define __FS_BUFFER_H
+#include "stdint.h"
+#include "global.h"
+#include "list.h"
+#include "blk.h"
+#include "timer.h"
+
+// 块缓存：按(块设备, 扇区号)缓存扇区，未被引用的干净缓冲区按LRU回收。
+// 预读的块异步读入，相邻扇区在请求队列中合并成一次多扇区传输。
+// 写只改缓存并标脏，由system_wq中的bdflush工作定期或脏块过多时按扇区号顺序写回，
+// sync/fsync等待写回完成
+#define NR_BUFFERS 1024  // 512KiB，一半用于预读时够4KiB块的64块窗口
+#define BUFFER_HASH 256
+#define BUFFER_DIRTY_HIGH (NR_BUFFERS / 2)   // 脏块达到此数时立即安排bdflush
+#define BUFFER_FLUSH_TICKS (5 * IRQ0_FREQUENCY)
+
+#define BH_UPTODATE 0x1  // 数据有效
+#define BH_LOCKED 0x2    // 正在读入或写回
+#define BH_DIRTY 0x4     // 比磁盘上的新
+#define BH_ERROR 0x8     // 上次读入或写回失败
+
+struct buffer_head {
+  struct block_device* b_bdev;  // NULL表示未使用
+  uint32_t b_lba;
+  uint8_t* b_data;      // 一个扇区
+  uint32_t b_count;     // 引用计数，进行中的bio也算一个，为0时在LRU链上
+  uint8_t b_state;
+  struct bio b_bio;
+  struct list_elem hash_tag;
+  struct list_elem lru_tag;
+};
+
+void buffer_init(void);
+struct buffer_head* bread(struct block_device* bdev, uint32_t lba);
+void bwrite(struct buffer_head* bh);
+void brelse(struct buffer_head* bh);
+uint32_t breada(struct block_device* bdev, uint32_t* lbas, uint32_t cnt);
+void buffer_read(struct block_device* bdev, uint32_t lba, void* buf,
+                 uint32_t sec_cnt);
+void buffer_write(struct block_device* bdev, uint32_t lba, void* buf,
+                  uint32_t sec_cnt);
+void buffer_zero(struct block_device* bdev, uint32_t lba, uint32_t sec_cnt);
+int32_t buffer_sync(struct block_device* bdev);
+#endif
@@ -32,13 +32,10 @@ void create_dir_entry(char* filename,
                       uint32_t inode_no,
                       uint8_t file_type,
                       struct dir_entry* p_de);
-bool sync_dir_entry(struct dir* parent_dir,
-                    struct dir_entry* p_de,
-                    void* io_buf);
+bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de);
 bool delete_dir_entry(struct partition* part,
                       struct dir* pdir,
-                      uint32_t inode_no,
-                      void* io_buf);
+                      uint32_t inode_no);
 struct dir_entry* dir_read(struct dir* dir);
 bool dir_is_empty(struct dir* dir);
 int32_t dir_remove(struct dir* parent_dir, struct dir* child_dir);
@@ -1,4 +1,5 @@
 #include "file.h"
+#include "buffer.h"
 #include "debug.h"
 #include "dir.h"
 #include "fs.h"
@@ -30,7 +31,7 @@ int32_t get_free_slot_in_global() {
 // 在task_struct中获取空闲fd，并写入全局的file_table的下标
 int32_t pcb_fd_install(int32_t globa_fd_idx) {
   uint8_t local_fd_idx = 3;
-  struct task_struct* cur = running_thread();
+  struct task_struct* cur = proc_of(running_thread());
   while (local_fd_idx < MAX_FILES_OPEN_PER_PROC) {
     if (cur->fd_table[local_fd_idx] == -1) {
       cur->fd_table[local_fd_idx] = globa_fd_idx;
@@ -55,20 +56,64 @@ int32_t inode_bitmap_alloc(struct partition* part) {
   return bit_idx;
 }
 
-// 在block_bitmap申请一个空闲的block，并将对应位置置1，若没有空闲，则返回-1,返回的是空闲块的lba地址
-int32_t block_bitmap_alloc(struct partition* part) {
-  int32_t bit_idx = bitmap_scan(&part->block_bitmap, 1);
-  if (bit_idx == -1) {
-    return -1;
+// 将块位图中从bit_idx开始的cnt位所在的扇区同步到硬盘
+static void block_bitmap_sync(struct partition* part, uint32_t bit_idx,
+                              uint32_t cnt) {
+  uint32_t end = bit_idx + cnt;
+  while (bit_idx < end) {
+    bitmap_sync(part, bit_idx, BLOCK_BITMAP);
+    bit_idx = (bit_idx / BIT_PER_SECTOR + 1) * BIT_PER_SECTOR;
+  }
+}
+
+// 在block_bitmap申请最多cnt个连续的block并同步位图，返回首块首扇区的lba，
+// *got为实际块数。
+// 优先从goal处接着分配，使文件的块尽量连续；否则找足够长的空闲段，
+// 实在没有则从第一个空闲块开始能分多少分多少。没有空闲块返回-1
+int32_t block_bitmap_alloc_run(struct partition* part, uint32_t goal,
+                               uint32_t cnt, uint32_t* got) {
+  struct bitmap* btmp = &part->block_bitmap;
+  uint32_t bit_len = btmp->btmp_bytes_len * 8;
+  uint32_t sects_per_block = part->sb->block_size / SECTOR_SIZE;
+  uint32_t goal_idx = (goal - part->sb->data_start_lba) / sects_per_block;
+  int32_t bit_idx = -1;
+  if (goal >= part->sb->data_start_lba && goal_idx < bit_len &&
+      !bitmap_scan_test(btmp, goal_idx)) {
+    bit_idx = goal_idx;
+  } else if ((bit_idx = bitmap_scan(btmp, cnt)) == -1) {
+    bit_idx = bitmap_scan(btmp, 1);
+    if (bit_idx == -1) {
+      return -1;
+    }
   }
-  bitmap_set(&part->block_bitmap, bit_idx, 1);
-  return (part->sb->data_start_lba + bit_idx);
+
+  uint32_t n = 0;
+  while (n < cnt && bit_idx + n < bit_len &&
+         !bitmap_scan_test(btmp, bit_idx + n)) {
+    bitmap_set(btmp, bit_idx + n, 1);
+    n++;
+  }
+  block_bitmap_sync(part, bit_idx, n);
+  *got = n;
+  return (part->sb->data_start_lba + bit_idx * sects_per_block);
+}
+
+// 释放从lba开始的cnt个block并同步位图
+void block_bitmap_free(struct partition* part, uint32_t lba, uint32_t cnt) {
+  ASSERT(lba > part->sb->data_start_lba);
+  uint32_t bit_idx =
+      (lba - part->sb->data_start_lba) / (part->sb->block_size / SECTOR_SIZE);
+  uint32_t n;
+  for (n = 0; n < cnt; n++) {
+    bitmap_set(&part->block_bitmap, bit_idx + n, 0);
+  }
+  block_bitmap_sync(part, bit_idx, cnt);
 }
 
 // 将对应位图的内容同步到硬盘
 void bitmap_sync(struct partition* part, uint32_t bit_idx, uint8_t btmp) {
-  uint32_t off_sec = bit_idx / 4096;
-  uint32_t off_size = off_sec * BLOCK_SIZE;
+  uint32_t off_sec = bit_idx / BIT_PER_SECTOR;
+  uint32_t off_size = off_sec * SECTOR_SIZE;
 
   uint32_t sec_lba;
   uint8_t* bitmap_off;
@@ -82,17 +127,11 @@ void bitmap_sync(struct partition* part, uint32_t bit_idx, uint8_t btmp) {
       bitmap_off = part->block_bitmap.bits + off_size;
       break;
   }
-  ide_write(part->my_disk, sec_lba, bitmap_off, 1);
+  buffer_write(part->bdev, sec_lba, bitmap_off, 1);
 }
 
 // 创建文件，打开，并将其加载至用户进程的fd_table
 int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
-  void* io_buf = sys_malloc(1024);
-  if (io_buf == NULL) {
-    printk("in file_create: sys_malloc for io_buf failed\n");
-    return -1;
-  }
-
   uint8_t rollback_step = 0;
 
   int32_t inode_no = inode_bitmap_alloc(cur_part);
@@ -108,7 +147,7 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
     rollback_step = 1;
     goto rollback;
   }
-  inode_init(inode_no, new_file_inode);
+  inode_init(cur_part, inode_no, new_file_inode);
   int fd_idx = get_free_slot_in_global();
   if (fd_idx == -1) {
     printk("exceed max open files\n");
@@ -119,28 +158,30 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
   file_table[fd_idx].fd_flag = flag;
   file_table[fd_idx].fd_inode = new_file_inode;
   file_table[fd_idx].fd_pos = 0;
+  file_table[fd_idx].ra_prev = 0;
+  file_table[fd_idx].ra_size = 0;
+  file_table[fd_idx].ra_end = 0;
   file_table[fd_idx].fd_inode->write_deny = false;
 
   struct dir_entry new_dir_entry;
   memset(&new_dir_entry, 0, sizeof(struct dir_entry));
 
   create_dir_entry(filename, inode_no, FT_REGULAR, &new_dir_entry);
-  if (!sync_dir_entry(parent_dir, &new_dir_entry, io_buf)) {
+  if (!sync_dir_entry(parent_dir, &new_dir_entry)) {
     printk("file_create: sync_dir_entry failed!\n");
     rollback_step = 3;
     goto rollback;
   }
 
-  memset(io_buf, 0, 1024);
-  inode_sync(cur_part, parent_dir->inode, io_buf);
-  memset(io_buf, 0, 1024);
-  inode_sync(cur_part, new_file_inode, io_buf);
+  inode_sync(cur_part, parent_dir->inode);
+  inode_sync(cur_part, new_file_inode);
   bitmap_sync(cur_part, inode_no, INODE_BITMAP);
 
+  write_lock(&cur_part->open_inodes_lock);
   list_push(&cur_part->open_inodes, &new_file_inode->inode_tag);
   new_file_inode->open_cnts = 1;
+  write_unlock(&cur_part->open_inodes_lock);
 
-  sys_free(io_buf);
   return pcb_fd_install(fd_idx);
 
 rollback:
@@ -153,7 +194,6 @@ rollback:
       bitmap_set(&cur_part->inode_bitmap, inode_no, 0);
       break;
   }
-  sys_free(io_buf);
   return -1;
 }
 
@@ -168,6 +208,9 @@ int32_t file_open(uint32_t inode_no, uint8_t flag) {
   file_table[fd_idx].fd_flag = flag;
   file_table[fd_idx].fd_inode = inode_open(cur_part, inode_no);
   file_table[fd_idx].fd_pos = 0;
+  file_table[fd_idx].ra_prev = 0;
+  file_table[fd_idx].ra_size = 0;
+  file_table[fd_idx].ra_end = 0;
   bool* write_deny = &file_table[fd_idx].fd_inode->write_deny;
 
   if (flag & O_WRONLY || flag & O_RDWD) {
@@ -198,168 +241,57 @@ int32_t file_close(struct file* file) {
 
 // 对文件进行写入
 int32_t file_write(struct file* file, const void* buf, uint32_t count) {
-  if ((file->fd_inode->i_size + count) > BLOCK_SIZE * 140) {
-    printk("execeed max file_size 71680 bytes,write file failed!\n");
-    return -1;
-  }
-  uint8_t* io_buf = (uint8_t*)sys_malloc(BLOCK_SIZE);
-  if (io_buf == NULL) {
-    printk("file_write: sys_malloc for io_buf failed!\n");
+  struct inode* inode = file->fd_inode;
+  if (inode->i_size + count < inode->i_size) {
+    printk("execeed max file_size, write file failed!\n");
     return -1;
   }
-
-  uint32_t* all_blocks = (uint32_t*)sys_malloc(BLOCK_SIZE + 48);
-  if (all_blocks == NULL) {
-    printk("file_write: sys_malloc for all_blocks failed!\n");
+  // 一次为新增的块分配尽量连续的空间
+  uint32_t block_size = cur_part->sb->block_size;
+  uint32_t file_has_used_blocks = DIV_ROUND_UP(inode->i_size, block_size);
+  uint32_t file_will_use_blocks =
+      DIV_ROUND_UP(inode->i_size + count, block_size);
+  if (file_will_use_blocks > file_has_used_blocks &&
+      !inode_grow(cur_part, inode, file_has_used_blocks,
+                  file_will_use_blocks - file_has_used_blocks)) {
+    printk("file_write: allocate blocks failed!\n");
     return -1;
   }
 
+  struct block_device* bdev = cur_part->bdev;
   const uint8_t* src = buf;
-  uint32_t bytes_written = 0;     // 已经写入的数据字节数
-  uint32_t size_left = count;     // 未写入的字节数
-  int32_t block_lba = -1;         // 用于分配块时的lba地址
-  uint32_t block_bitmap_idx = 0;  // 用于分配块时的位图索引
-
-  uint32_t sec_idx;              // 数据写入时的应写入块数
-  uint32_t sec_lba;              // 数据写入时应写入块(扇区)的lba地址
-  uint32_t sec_off_bytes;        // 第一次写入时块的使用字节数
-  uint32_t sec_left_bytes;       // 第一次写入时块的空闲字节数
-  uint32_t chunk_size;           // 每次写入磁盘的字节数
-  int32_t indirect_block_table;  // 间接块地址的lba地址
-  uint32_t block_idx;            // all_blocks的索引
-
-  if (file->fd_inode->i_sectors[0] == 0) {
-    block_lba = block_bitmap_alloc(cur_part);
-    if (block_lba == -1) {
-      printk("file_write: block_bitmap_alloc failed!\n");
-      return -1;
-    }
-    file->fd_inode->i_sectors[0] = block_lba;
-    block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-    bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-  }
-
-  uint32_t file_has_used_blocks = file->fd_inode->i_size / BLOCK_SIZE + 1;
-  uint32_t file_will_use_blocks =
-      (file->fd_inode->i_size + count) / BLOCK_SIZE + 1;
-
-  ASSERT(file_will_use_blocks <= 140);
-  uint32_t add_blocks = file_will_use_blocks - file_has_used_blocks;
-
-  if (add_blocks == 0) {  // 不需要创建新的块
-    if (file_has_used_blocks <= 12) {
-      block_idx = file_has_used_blocks - 1;
-      all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-    } else {
-      ASSERT(file->fd_inode->i_sectors[12] != 0);
-      indirect_block_table = file->fd_inode->i_sectors[12];
-      ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-    }
-  } else {                             // 创建新的块
-    if (file_will_use_blocks <= 12) {  // 创建后的块都是直接块
-      block_idx = file_has_used_blocks - 1;
-      ASSERT(file->fd_inode->i_sectors[block_idx] != 0);
-      all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-
-      block_idx = file_has_used_blocks;
-      // 循环创建新的块
-      while (block_idx < file_will_use_blocks) {
-        block_lba = block_bitmap_alloc(cur_part);
-        if (block_lba == -1) {
-          printk("file_write: block_bitmap_alloc for situation 1 failed\n");
-          return -1;
-        }
-
-        ASSERT(file->fd_inode->i_sectors[block_idx] == 0);
-        file->fd_inode->i_sectors[block_idx] = all_blocks[block_idx] =
-            block_lba;
-        block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-        bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-        block_idx++;
-      }
-    } else if (file_has_used_blocks <= 12 && file_will_use_blocks > 12) {
-      // 目前12个直接块还有未分配的，但又需要分配间接块
-      block_idx = file_has_used_blocks - 1;
-      all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-
-      block_lba = block_bitmap_alloc(cur_part);
-      if (block_lba == -1) {
-        printk("file_write: block_bitmap_alloc for situation 2 failed\n");
-        return -1;
-      }
-      ASSERT(file->fd_inode->i_sectors[12] == 0);
-
-      indirect_block_table = file->fd_inode->i_sectors[12] = block_lba;
-      block_idx = file_has_used_blocks;
-      while (block_idx < file_will_use_blocks) {
-        block_lba = block_bitmap_alloc(cur_part);
-        if (block_lba == -1) {
-          printk("file_write: block_bitmap_alloc for situation 2 failed\n");
-          return -1;
-        }
-
-        if (block_idx < 12) {
-          ASSERT(file->fd_inode->i_sectors[block_idx] == 0);
-          file->fd_inode->i_sectors[block_idx] = all_blocks[block_idx] =
-              block_lba;
-        } else {
-          all_blocks[block_idx] = block_lba;
-        }
-        block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-        bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-        block_idx++;
-      }
-      ide_write(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-    } else if (file_has_used_blocks > 12) {  // 只需要分配间接块
-      ASSERT(file->fd_inode->i_sectors[12] != 0);
-      indirect_block_table = file->fd_inode->i_sectors[12];
-      ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-
-      block_idx = file_has_used_blocks;
-      while (block_idx < file_will_use_blocks) {
-        block_lba = block_bitmap_alloc(cur_part);
-        if (block_lba == -1) {
-          printk("file_write: block_bitmap_alloc for situation 3 failed\n");
-          return -1;
-        }
-        all_blocks[block_idx] = block_lba;
-        block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-        bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-        block_idx++;
-      }
-      ide_write(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-    }
-  }
+  uint32_t bytes_written = 0;  // 已经写入的数据字节数
+  uint32_t size_left = count;  // 未写入的字节数
+  uint32_t sec_lba, sec_off_bytes, chunk_size, run;
 
-  bool first_write_block = true;
-  file->fd_pos = file->fd_inode->i_size - 1;
-  // 进行循环写入
+  file->fd_pos = inode->i_size - 1;
+  // 进行循环写入，不满一个扇区的部分在缓存中改，
+  // 整扇区按区段内的连续扇区一次写入
   while (bytes_written < count) {
-    memset(io_buf, 0, BLOCK_SIZE);
-    sec_idx = file->fd_inode->i_size / BLOCK_SIZE;
-    sec_lba = all_blocks[sec_idx];
-    sec_off_bytes = file->fd_inode->i_size % BLOCK_SIZE;
-    // 第一次进行写入时可能为非0,但后续一定为0，所以sec_left_bytes在第二次及之后一定为BLOCK_SIZE
-    sec_left_bytes = BLOCK_SIZE - sec_off_bytes;
-
-    chunk_size = size_left < sec_left_bytes ? size_left : sec_left_bytes;
-    if (first_write_block) {
-      ide_read(cur_part->my_disk, sec_lba, io_buf, 1);
-      first_write_block = false;
+    sec_lba =
+        inode_sec_map(cur_part, inode, inode->i_size / SECTOR_SIZE, &run);
+    ASSERT(sec_lba != 0);
+    sec_off_bytes = inode->i_size % SECTOR_SIZE;
+    if (sec_off_bytes != 0 || size_left < SECTOR_SIZE) {
+      chunk_size = SECTOR_SIZE - sec_off_bytes;
+      chunk_size = size_left < chunk_size ? size_left : chunk_size;
+      struct buffer_head* bh = bread(bdev, sec_lba);
+      memcpy(bh->b_data + sec_off_bytes, src, chunk_size);
+      bwrite(bh);
+      brelse(bh);
+    } else {
+      run = size_left / SECTOR_SIZE < run ? size_left / SECTOR_SIZE : run;
+      chunk_size = run * SECTOR_SIZE;
+      buffer_write(bdev, sec_lba, (void*)src, run);
     }
-    memcpy(io_buf + sec_off_bytes, src, chunk_size);
-    ide_write(cur_part->my_disk, sec_lba, io_buf, 1);
-    printk("file write at lba 0x%x\n", sec_lba);
 
     src += chunk_size;
-    file->fd_inode->i_size += chunk_size;
+    inode->i_size += chunk_size;
     file->fd_pos += chunk_size;
     bytes_written += chunk_size;
     size_left -= chunk_size;
   }
-  inode_sync(cur_part, file->fd_inode, io_buf);
-  sys_free(all_blocks);
-  sys_free(io_buf);
+  inode_sync(cur_part, inode);
   return bytes_written;
 }
 
@@ -376,79 +308,105 @@ int32_t file_read(struct file* file, void* buf, uint32_t count) {
       return -1;
     }
   }
+  if (size == 0) {
+    return 0;
+  }
 
-  uint8_t* io_buf = (uint8_t*)sys_malloc(BLOCK_SIZE);
-  if (io_buf == NULL) {
-    printk("file_read: sys_malloc for io_buf failed!\n");
-    return -1;
+  struct inode* inode = file->fd_inode;
+  struct block_device* bdev = cur_part->bdev;
+  uint32_t block_size = cur_part->sb->block_size;
+  uint32_t sects_per_block = block_size / SECTOR_SIZE;
+  uint32_t start_idx = file->fd_pos / block_size;
+  uint32_t end_idx = (file->fd_pos + size - 1) / block_size;
+  uint32_t file_blocks = DIV_ROUND_UP(inode->i_size, block_size);
+
+  // 从上次读停下的块接着读视为顺序读。未读的预读块不足半个窗口时，
+  // 窗口翻倍并接着已预读的部分再发一批；随机读关闭预读
+  uint32_t ra_start = 0, ra_cnt = 0;
+  if (start_idx == file->ra_prev || start_idx == file->ra_prev + 1) {
+    if (file->ra_end <= end_idx) {
+      file->ra_end = end_idx + 1;
+    }
+    if (file->ra_end - end_idx - 1 <= file->ra_size / 2 &&
+        file->ra_end < file_blocks) {
+      uint32_t ra_max = RA_MAX_SECTORS / sects_per_block;
+      file->ra_size = file->ra_size == 0 ? RA_MIN_BLOCKS : file->ra_size * 2;
+      if (file->ra_size > ra_max) {
+        file->ra_size = ra_max;
+      }
+      // 要读的块和预读的块合起来不超过ra_max，大块读时少预读或不预读
+      uint32_t demand = end_idx - start_idx + 1;
+      uint32_t ra_room = demand < ra_max ? ra_max - demand : 0;
+      ra_start = file->ra_end;
+      ra_cnt = file_blocks - ra_start < file->ra_size ? file_blocks - ra_start
+                                                      : file->ra_size;
+      if (ra_cnt > ra_room) {
+        ra_cnt = ra_room;
+      }
+      file->ra_end += ra_cnt;
+    }
+  } else {
+    file->ra_size = 0;
+    file->ra_end = 0;
   }
+  file->ra_prev = end_idx;
 
-  uint32_t* all_blocks = (uint32_t*)sys_malloc(BLOCK_SIZE + 48);
-  if (all_blocks == NULL) {
-    printk("file_read: sys_malloc for all_blocks failed!\n");
+  uint32_t lba_max = (end_idx - start_idx + 1 + ra_cnt) * sects_per_block;
+  uint32_t* lbas = (uint32_t*)sys_malloc(sizeof(uint32_t) * lba_max);
+  if (lbas == NULL) {
+    printk("file_read: sys_malloc for lbas failed!\n");
     return -1;
   }
 
-  uint32_t block_read_start_idx = file->fd_pos / BLOCK_SIZE;
-  uint32_t block_read_end_idx = (file->fd_pos + size) / BLOCK_SIZE;
-  uint32_t read_blocks = block_read_start_idx - block_read_end_idx;
-  ASSERT(block_read_end_idx < 139 && block_read_start_idx < 139);
-
-  int32_t indirect_block_size;
-  uint32_t block_idx;
-
-  //将要读取的块加载入all_blocks
-  if (read_blocks == 0) {
-    ASSERT(block_read_end_idx == block_read_start_idx);
-    if (block_read_end_idx < 12) {
-      block_idx = block_read_end_idx;
-      all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-    } else {
-      indirect_block_size = file->fd_inode->i_sectors[12];
-      ide_read(cur_part->my_disk, indirect_block_size, all_blocks + 12, 1);
+  // 要读的块和预读的块的所有扇区一起异步提交，相邻扇区合并成一个请求；
+  // 块地址按区段查，每个区段只查一次
+  uint32_t last_idx = ra_cnt > 0 ? ra_start + ra_cnt - 1 : end_idx;
+  uint32_t block_idx = start_idx, lba_cnt = 0;
+  uint32_t lba = 0, run = 0, sec;
+  while (block_idx <= last_idx) {
+    if (block_idx > end_idx && block_idx < ra_start) {
+      block_idx = ra_start;
+      run = 0;
     }
-  } else {
-    if (block_read_end_idx < 12) {
-      block_idx = block_read_start_idx;
-      while (block_idx <= block_read_end_idx) {
-        all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-        block_idx++;
-      }
-    } else if (block_read_start_idx < 12 && block_read_end_idx >= 12) {
-      block_idx = block_read_start_idx;
-      while (block_idx < 12) {
-        all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-        block_idx++;
-      }
-      ASSERT(file->fd_inode->i_sectors[12] != 0);
-      indirect_block_size = file->fd_inode->i_sectors[12];
-      ide_read(cur_part->my_disk, indirect_block_size, all_blocks + 12, 1);
-
-    } else {
-      ASSERT(file->fd_inode->i_sectors[12] != 0);
-      indirect_block_size = file->fd_inode->i_sectors[12];
-      ide_read(cur_part->my_disk, indirect_block_size, all_blocks + 12, 1);
+    if (run == 0) {
+      lba = inode_bmap(cur_part, inode, block_idx, &run);
+      ASSERT(lba != 0);
+    }
+    for (sec = 0; sec < sects_per_block; sec++) {
+      lbas[lba_cnt++] = lba++;
     }
+    run--;
+    block_idx++;
+  }
+  // 缓存不够时预读只发出了一部分，ra_end退回到第一个没发出的块，
+  // 窗口缩成实际发出的大小，下次顺序读再补上
+  uint32_t ra_first = (end_idx - start_idx + 1) * sects_per_block;
+  // 异步提交同样不超过RA_MAX_SECTORS，超出的部分由下面的bread同步读
+  uint32_t async_cnt = lba_cnt < RA_MAX_SECTORS ? lba_cnt : RA_MAX_SECTORS;
+  uint32_t issued = breada(bdev, lbas, async_cnt);
+  if (ra_cnt > 0 && issued < lba_cnt) {
+    uint32_t ra_done =
+        issued > ra_first ? (issued - ra_first) / sects_per_block : 0;
+    file->ra_end = ra_start + ra_done;
+    file->ra_size = ra_done;
   }
 
-  uint32_t sec_idx, sec_lba, sec_off_bytes, sec_left_bytes, chunk_size;
+  uint32_t sec_off_bytes, sec_left_bytes, chunk_size;
   uint32_t bytes_read = 0;
+  uint32_t idx = file->fd_pos % block_size / SECTOR_SIZE;  // 起始块内的扇区
   while (bytes_read < size) {
-    sec_idx = file->fd_pos / BLOCK_SIZE;
-    sec_lba = all_blocks[sec_idx];
-    sec_off_bytes = file->fd_pos % BLOCK_SIZE;
-    sec_left_bytes = BLOCK_SIZE - sec_off_bytes;
+    struct buffer_head* bh = bread(bdev, lbas[idx++]);
+    sec_off_bytes = file->fd_pos % SECTOR_SIZE;
+    sec_left_bytes = SECTOR_SIZE - sec_off_bytes;
     chunk_size = size_left < sec_left_bytes ? size_left : sec_left_bytes;
-    memset(io_buf, 0, BLOCK_SIZE);
-    ide_read(cur_part->my_disk, sec_lba, io_buf, 1);
-    memcpy(buf_dst, io_buf + sec_off_bytes, chunk_size);
+    memcpy(buf_dst, bh->b_data + sec_off_bytes, chunk_size);
+    brelse(bh);
 
     buf_dst += chunk_size;
     file->fd_pos += chunk_size;
     bytes_read += chunk_size;
     size_left -= chunk_size;
   }
-  sys_free(all_blocks);
-  sys_free(io_buf);
+  sys_free(lbas);
   return bytes_read;
 }
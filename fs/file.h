@@ -1,9 +1,15 @@
 #ifndef __FS_FILE_H
 #define __FS_FILE_H
+#include "buffer.h"
 #include "dir.h"
 #include "inode.h"
 #include "stdint.h"
 #define MAX_FILES_OPEN 32
+// 顺序读的预读窗口，以块计，每发一次预读翻倍。
+// 上限按扇区计，要读的块加预读的块最多占块缓存的一半(4KiB块时为64块)，
+// 否则预读的扇区会互相挤出缓存
+#define RA_MIN_BLOCKS 4
+#define RA_MAX_SECTORS (NR_BUFFERS / 2)
 
 //file_table 的表项，记录文件的指针，文件的打开方式，以及inode的指针，
 //该结构每打开一次文件就会创建一次，对同一文件，不同的进程进行打开也会创建多次，也就是说不同的进程对同一文件的指针是独立的
@@ -11,6 +17,10 @@ struct file {
   uint32_t fd_pos;//读写位置
   uint32_t fd_flag;//打开方式
   struct inode* fd_inode;//inode指针
+  // 预读状态，以文件内的块号计
+  uint32_t ra_prev;  // 上次读的最后一块，下次从这块或下一块开始读视为顺序读
+  uint32_t ra_size;  // 当前预读窗口，0表示未检测到顺序读
+  uint32_t ra_end;   // 已发出预读的块的上界(不含)
 };
 
 //标准输入，标准输出，标准错误
@@ -25,7 +35,9 @@ extern struct file file_table[MAX_FILES_OPEN];
 int32_t get_free_slot_in_global();
 int32_t pcb_fd_install(int32_t globa_fd_idx);
 int32_t inode_bitmap_alloc(struct partition* part);
-int32_t block_bitmap_alloc(struct partition* part);
+int32_t block_bitmap_alloc_run(struct partition* part, uint32_t goal,
+                               uint32_t cnt, uint32_t* got);
+void block_bitmap_free(struct partition* part, uint32_t lba, uint32_t cnt);
 void bitmap_sync(struct partition* part, uint32_t bit_idx, uint8_t btmp);
 int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag);
 int32_t file_open(uint32_t inode_no, uint8_t flag);
@@ -1,9 +1,10 @@
 #include "fs.h"
+#include "buffer.h"
 #include "console.h"
 #include "debug.h"
 #include "dir.h"
 #include "file.h"
-#include "ide.h"
+#include "genhd.h"
 #include "inode.h"
 #include "ioqueue.h"
 #include "keyboard.h"
@@ -22,15 +23,25 @@ static bool mount_partition(struct list_elem* pelem, int arg) {
   struct partition* part = elem2entry(struct partition, part_tag, pelem);
   if (!strcmp(part_name, part->name)) {  // 是要挂载的分区
     cur_part = part;
-    struct disk* hd = cur_part->my_disk;
+    struct block_device* bdev = cur_part->bdev;
     struct super_block* sb_buf = (struct super_block*)sys_malloc(SECTOR_SIZE);
     cur_part->sb = (struct super_block*)sys_malloc(sizeof(struct super_block));
     if (cur_part->sb == NULL || sb_buf == NULL) {
       PANIC("alloc memort failed!");
     }
     memset(sb_buf, 0, SECTOR_SIZE);
-    ide_read(hd, cur_part->start_lba + 1, sb_buf, 1);
+    buffer_read(bdev, cur_part->start_lba + 1, sb_buf, 1);
     memcpy(cur_part->sb, sb_buf, sizeof(struct super_block));
+    if (sb_buf->magic != FS_MAGIC || sb_buf->version != FS_VERSION) {
+      // 不认识的格式不能挂载，留给mkfs处理，系统照常运行
+      printk("  %s: no filesystem of version %d, not mounted\n", part->name,
+             FS_VERSION);
+      sys_free(cur_part->sb);
+      cur_part->sb = NULL;
+      cur_part = NULL;
+      sys_free(sb_buf);
+      return true;
+    }
 
     // block_bitmap
     cur_part->block_bitmap.bits =
@@ -40,8 +51,8 @@ static bool mount_partition(struct list_elem* pelem, int arg) {
     }
     cur_part->block_bitmap.btmp_bytes_len =
         sb_buf->block_bitmap_sects * SECTOR_SIZE;
-    ide_read(hd, sb_buf->block_bitmap_lba, cur_part->block_bitmap.bits,
-             sb_buf->block_bitmap_sects);
+    buffer_read(bdev, sb_buf->block_bitmap_lba, cur_part->block_bitmap.bits,
+                sb_buf->block_bitmap_sects);
 
     // inode_bitmap
     cur_part->inode_bitmap.bits =
@@ -52,23 +63,32 @@ static bool mount_partition(struct list_elem* pelem, int arg) {
     }
     cur_part->inode_bitmap.btmp_bytes_len =
         sb_buf->inode_bitmap_sects * SECTOR_SIZE;
-    ide_read(hd, sb_buf->inode_bitmap_lba, cur_part->inode_bitmap.bits,
-             sb_buf->inode_bitmap_sects);
+    buffer_read(bdev, sb_buf->inode_bitmap_lba, cur_part->inode_bitmap.bits,
+                sb_buf->inode_bitmap_sects);
 
     list_init(&cur_part->open_inodes);
+    rwlock_init(&cur_part->open_inodes_lock);
     printk("  mount %s done!\n", part->name);
-    printk("  sdb1's block_bitmap_lba: %x\n", sb_buf->block_bitmap_lba);
-    printk("  sdb1's inode_bitmap_lba: %x\n", sb_buf->inode_bitmap_lba);
-    printk("  sdb1's inode_table_lba: %x\n", sb_buf->inode_table_lba);
-    printk("  sdb1's data_start_lba: %x\n", sb_buf->data_start_lba);
+    printk("  %s's block_bitmap_lba: %x\n", part->name, sb_buf->block_bitmap_lba);
+    printk("  %s's inode_bitmap_lba: %x\n", part->name, sb_buf->inode_bitmap_lba);
+    printk("  %s's inode_table_lba: %x\n", part->name, sb_buf->inode_table_lba);
+    printk("  %s's data_start_lba: %x\n", part->name, sb_buf->data_start_lba);
     sys_free(sb_buf);
     return true;
   }
   return false;
 }
 
-// 初始化分区，其实就是为分区的超级块填充该分区的数据和魔数
-static void partition_format(struct partition* part) {
+// 初始化分区，其实就是为分区的超级块填充该分区的数据和魔数。
+// block_size为块的字节数，可为1024、2048或4096
+static void partition_format(struct partition* part, uint32_t block_size) {
+  struct blk_geometry geo;
+  part->bdev->ops->getgeo(part->bdev, &geo);
+  ASSERT(geo.sector_size == SECTOR_SIZE &&
+         part->start_lba + part->sec_cnt <= geo.sectors);
+  ASSERT(block_size == 1024 || block_size == 2048 || block_size == 4096);
+  uint32_t sects_per_block = block_size / SECTOR_SIZE;
+
   uint32_t boot_sector_sects = 1;
   uint32_t super_block_sects = 1;
 
@@ -76,27 +96,36 @@ static void partition_format(struct partition* part) {
       DIV_ROUND_UP(MAX_FILES_PER_PART, BIT_PER_SECTOR);
 
   uint32_t inode_table_sects =
-      DIV_ROUND_UP(((sizeof(struct inode) * MAX_FILES_PER_PART)), SECTOR_SIZE);
+      DIV_ROUND_UP(((INODE_DISK_SIZE * MAX_FILES_PER_PART)), SECTOR_SIZE);
 
   uint32_t used_sects = boot_sector_sects + super_block_sects +
                         inode_bitmap_sects + inode_table_sects;
   uint32_t free_sects = part->sec_cnt - used_sects;
 
-  uint32_t now_total_free_sects = free_sects;  // 定义一个现在总的可用扇区数
-  uint32_t prev_block_bitmap_sects = 0;        // 之前的块位图扇区数
-  uint32_t block_bitmap_sects =
-      DIV_ROUND_UP(now_total_free_sects, BIT_PER_SECTOR);  // 初始估算
+  uint32_t prev_block_bitmap_sects = 0;  // 之前的块位图扇区数
+  uint32_t block_bitmap_sects = DIV_ROUND_UP(free_sects / sects_per_block,
+                                             BIT_PER_SECTOR);  // 初始估算
   uint32_t block_bitmap_bit_len;
+  uint32_t data_start_lba;
 
   while (block_bitmap_sects != prev_block_bitmap_sects) {
     prev_block_bitmap_sects = block_bitmap_sects;
+    // 数据区起始按块大小对齐，其后的整块可用
+    data_start_lba =
+        DIV_ROUND_UP(part->start_lba + used_sects + block_bitmap_sects,
+                     sects_per_block) *
+        sects_per_block;
     /* block_bitmap_bit_len是位图中位的长度,也是可用块的数量 */
-    block_bitmap_bit_len = now_total_free_sects - block_bitmap_sects;
+    block_bitmap_bit_len =
+        (part->start_lba + part->sec_cnt - data_start_lba) / sects_per_block;
     block_bitmap_sects = DIV_ROUND_UP(block_bitmap_bit_len, BIT_PER_SECTOR);
   }
 
   struct super_block sb;
-  sb.magic = 0x20060127;
+  memset(&sb, 0, sizeof(struct super_block));
+  sb.magic = FS_MAGIC;
+  sb.version = FS_VERSION;
+  sb.block_size = block_size;
   sb.sec_cnt = part->sec_cnt;
   sb.inode_cnt = MAX_FILES_PER_PART;
   sb.part_lba_base = part->start_lba;
@@ -110,7 +139,7 @@ static void partition_format(struct partition* part) {
   sb.inode_table_lba = sb.inode_bitmap_lba + sb.inode_bitmap_sects;
   sb.inode_table_sects = inode_table_sects;
 
-  sb.data_start_lba = sb.inode_table_lba + sb.inode_table_sects;
+  sb.data_start_lba = data_start_lba;
 
   sb.root_inode_no = 0;
   sb.dir_entry_size = sizeof(struct dir_entry);
@@ -121,12 +150,14 @@ static void partition_format(struct partition* part) {
       "inode_cnt:0x%x\n     block_bitmap_lba:0x%x\n     "
       "block_bitmap_sectors:0x%x\n     inode_bitmap_lba:0x%x\n     "
       "inode_bitmap_sectors:0x%x\n     inode_table_lba:0x%x\n     "
-      "inode_table_sectors:0x%x\n     data_start_lba:0x%x\n",
+      "inode_table_sectors:0x%x\n     data_start_lba:0x%x\n     "
+      "block_size:0x%x\n",
       sb.magic, sb.part_lba_base, sb.sec_cnt, sb.inode_cnt, sb.block_bitmap_lba,
       sb.block_bitmap_sects, sb.inode_bitmap_lba, sb.inode_bitmap_sects,
-      sb.inode_table_lba, sb.inode_table_sects, sb.data_start_lba);
-  struct disk* hd = part->my_disk;
-  ide_write(hd, part->start_lba + 1, &sb, 1);
+      sb.inode_table_lba, sb.inode_table_sects, sb.data_start_lba,
+      sb.block_size);
+  struct block_device* bdev = part->bdev;
+  buffer_write(bdev, part->start_lba + 1, &sb, 1);
   printk("    super_block_lba: 0x%x\n", part->start_lba + 1);
   uint32_t buf_size =
       (sb.block_bitmap_sects >= sb.inode_bitmap_sects ? sb.block_bitmap_sects
@@ -146,18 +177,20 @@ static void partition_format(struct partition* part) {
   while (bit_idx < block_bitmap_last_bit) {
     buf[block_bitmap_last_byte] &= ~(1 << bit_idx++);
   }
-  ide_write(hd, sb.block_bitmap_lba, buf, sb.block_bitmap_sects);
+  buffer_write(bdev, sb.block_bitmap_lba, buf, sb.block_bitmap_sects);
   // inode_bitmap
   memset(buf, 0, buf_size);
   buf[0] |= 0x1;
-  ide_write(hd, sb.inode_bitmap_lba, buf, sb.inode_bitmap_sects);
+  buffer_write(bdev, sb.inode_bitmap_lba, buf, sb.inode_bitmap_sects);
   // inode_table
   memset(buf, 0, buf_size);
   struct inode* i = (struct inode*)buf;
   i->i_size = sb.dir_entry_size * 2;
   i->i_no = 0;
-  i->i_sectors[0] = sb.data_start_lba;
-  ide_write(hd, sb.inode_table_lba, buf, sb.inode_table_sects);
+  i->i_entries = 1;
+  i->i_extents[0].e_start = sb.data_start_lba;
+  i->i_extents[0].e_len = 1;
+  buffer_write(bdev, sb.inode_table_lba, buf, sb.inode_table_sects);
   // 根目录
   memset(buf, 0, buf_size);
   struct dir_entry* p_de = (struct dir_entry*)buf;
@@ -171,64 +204,75 @@ static void partition_format(struct partition* part) {
   p_de->i_no = 0;
   p_de->f_type = FT_DIRECTORY;
 
-  ide_write(hd, sb.data_start_lba, buf, 1);
+  ASSERT(buf_size >= block_size);
+  buffer_write(bdev, sb.data_start_lba, buf, sects_per_block);
   printk("    root_dir_lba: 0x%x\n", sb.data_start_lba);
   printk("  %s format done\n", part->name);
   sys_free(buf);
 }
 
+// 只有要挂载的根分区和内存盘可以自动格式化，其他分区可能属于别的系统
+static bool partition_formattable(struct partition* part) {
+  return !strcmp(part->name, ROOT_PART) || !memcmp(part->name, "ram", 3);
+}
+
+// 检查分区上是否有文件系统，可格式化的分区上没有则格式化，供list_traversal调用
+static bool partition_check(struct list_elem* pelem, int arg) {
+  struct partition* part = elem2entry(struct partition, part_tag, pelem);
+  struct super_block* sb_buf = (struct super_block*)arg;
+  memset(sb_buf, 0, SECTOR_SIZE);
+  buffer_read(part->bdev, part->start_lba + 1, sb_buf, 1);
+  if (sb_buf->magic == FS_MAGIC && sb_buf->version == FS_VERSION) {
+    // 识别到了自定义的文件系统
+    printk("  %s has filesystem\n", part->name);
+  } else if (sb_buf->magic == FS_MAGIC) {
+    // 旧版本的数据不能用当前格式读写，也不能自动格式化掉，留给用户mkfs
+    printk("  %s: filesystem version %d, need %d, not mounted\n", part->name,
+           sb_buf->version, FS_VERSION);
+  } else if (!partition_formattable(part)) {
+    printk("  %s: unknown filesystem, skipped\n", part->name);
+  } else {  // 没有文件系统，进行初始化
+    printk("  formatting %s's partition %s......\n", part->bdev->name,
+           part->name);
+    partition_format(part, FS_BLOCK_SIZE);
+  }
+  return false;
+}
+
 // 文件系统初始化
 void filesys_init() {
-  uint8_t channel_no = 0, dev_no = 0, part_index = 0;
   struct super_block* sb_buf = (struct super_block*)sys_malloc(SECTOR_SIZE);
   if (sb_buf == NULL) {
     PANIC("alloc memory failed!");
   }
+  buffer_init();
   printk("  searching filesystem......\n");
-  while (channel_no < channel_cnt) {
-    dev_no = 0;
-
-    while (dev_no < 2) {
-      if (dev_no == 0) {
-        dev_no++;
-        continue;  // 跳过hd60M.img
-      }
-      struct disk* hd = &channels[channel_no].devices[dev_no];
-      struct partition* part = hd->prim_parts;
-      part_index = 0;
-      while (part_index < 12) {
-        if (part_index == 4) {
-          part = hd->logic_parts;
-        }
-        if (part->sec_cnt != 0) {
-          memset(sb_buf, 0, SECTOR_SIZE);
-          ide_read(hd, part->start_lba + 1, sb_buf, 1);
-          if (sb_buf->magic == 0x20060127) {  // 识别到了自定义的文件系统
-            printk("  %s has filesystem\n", part->name);
-
-          } else {  // 不是支持的，进行文件系统初始化
-            printk("  formatting %s's partition %s......\n", hd->name,
-                   part->name);
-            partition_format(part);
-          }
-        }
-        part_index++;
-        part++;
-      }
-      dev_no++;
-    }
-    channel_no++;
-  }
+  list_traversal(&partition_list, partition_check, (int)sb_buf);
   sys_free(sb_buf);
-  char default_part[8] = "sdb1";
+  char default_part[8] = ROOT_PART;
   list_traversal(&partition_list, mount_partition, (int)default_part);
-  open_root_dir(cur_part);
+  if (cur_part == NULL && strcmp(ROOT_PART, "ram0")) {
+    // 根分区不存在或不可用时退到内存盘，没配内存盘时找不到ram0，什么也不做
+    char ram_part[8] = "ram0";
+    list_traversal(&partition_list, mount_partition, (int)ram_part);
+  }
+  if (cur_part != NULL) {
+    open_root_dir(cur_part);
+  } else {
+    printk("  root partition %s not mounted, run \"mkfs %s\" to format it\n",
+           ROOT_PART, ROOT_PART);
+  }
   uint32_t fd_idx = 0;
   while (fd_idx < MAX_FILES_OPEN) {
     file_table[fd_idx++].fd_inode = NULL;
   }
 }
 
+// 根分区没有挂载时，按路径访问文件的系统调用都直接失败
+static bool fs_mounted(void) {
+  return cur_part != NULL;
+}
+
 // 分割文件名并放入name_store，返回下一次要进行分割的文件路径，有点像strtok
 char* path_parse(char* pathname, char* name_store) {
   while ((*pathname) == '/') {
@@ -319,6 +363,9 @@ static int search_file(const char* pathname,
 
 // 以对应方式打开文件
 int32_t sys_open(const char* pathname, uint8_t flags) {
+  if (!fs_mounted()) {
+    return -1;
+  }
   if (pathname[strlen(pathname) - 1] == '/') {
     printk("can't open a directory %s\n", pathname);
     return -1;
@@ -376,7 +423,7 @@ int32_t sys_open(const char* pathname, uint8_t flags) {
 
 // 将对应的fd转换为file_table的下标
 uint32_t fd_local2global(uint32_t local_fd) {
-  struct task_struct* cur = running_thread();
+  struct task_struct* cur = proc_of(running_thread());
   int32_t global_fd = cur->fd_table[local_fd];
   ASSERT(global_fd >= 0 && global_fd < MAX_FILES_OPEN);
   return (uint32_t)global_fd;
@@ -397,7 +444,7 @@ int32_t sys_close(int32_t fd) {
     } else {
       ret = file_close(&file_table[global_fd]);
     }
-    running_thread()->fd_table[fd] = -1;  // 使该文件描述符位可用
+    proc_of(running_thread())->fd_table[fd] = -1;  // 使该文件描述符位可用
   }
   return ret;
 }
@@ -492,6 +539,9 @@ int32_t sys_lseek(int32_t fd, int32_t offset, uint8_t whence) {
 // 删除文件
 int32_t sys_unlink(const char* pathname) {
   ASSERT(strlen(pathname) < MAX_PATH_LEN);
+  if (!fs_mounted()) {
+    return -1;
+  }
 
   struct path_search_record searched_record;
   int inode_no = search_file(pathname, &searched_record);
@@ -524,18 +574,10 @@ int32_t sys_unlink(const char* pathname) {
     return -1;
   }
   ASSERT(file_idx == MAX_FILES_OPEN);
-  void* io_buf = sys_malloc(SECTOR_SIZE * 2);
-  if (io_buf == NULL) {
-    dir_close(searched_record.parent_dir);
-    printk("sys_unlink: malloc for io_buf failed!\n");
-    return -1;
-  }
 
   struct dir* parent_dir = searched_record.parent_dir;
-  delete_dir_entry(cur_part, parent_dir, inode_no, io_buf);
-  memset(io_buf, 0, SECTOR_SIZE * 2);
+  delete_dir_entry(cur_part, parent_dir, inode_no);
   inode_release(cur_part, inode_no);
-  sys_free(io_buf);
   dir_close(searched_record.parent_dir);
   return 0;
 }
@@ -543,9 +585,7 @@ int32_t sys_unlink(const char* pathname) {
 // 创建目录
 int32_t sys_mkdir(const char* pathname) {
   uint8_t rollback_step = 0;
-  void* io_buf = sys_malloc(SECTOR_SIZE * 2);
-  if (io_buf == NULL) {
-    printk("sys_mkdir: sys_malloc for io_buf failed\n");
+  if (!fs_mounted()) {
     return -1;
   }
 
@@ -581,23 +621,19 @@ int32_t sys_mkdir(const char* pathname) {
   }
 
   struct inode new_dir_inode;
-  inode_init(inode_no, &new_dir_inode);
+  inode_init(cur_part, inode_no, &new_dir_inode);
 
   // 创建新的块存放 .. 和 .
-  uint32_t block_bitmap_idx;
-  int32_t block_lba = -1;
-  block_lba = block_bitmap_alloc(cur_part);
-  if (block_lba == -1) {
+  if (!inode_grow(cur_part, &new_dir_inode, 0, 1)) {
     printk("sys_mkdir: alloc block failed!\n");
     rollback_step = 2;
     goto rollback;
   }
-  block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-  ASSERT(block_bitmap_idx > 0);
-  bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-  new_dir_inode.i_sectors[0] = block_lba;
-  memset(io_buf, 0, SECTOR_SIZE * 2);
-  struct dir_entry* p_de = (struct dir_entry*)io_buf;
+  uint32_t block_lba = inode_bmap(cur_part, &new_dir_inode, 0, NULL);
+  buffer_zero(cur_part->bdev, block_lba,
+              cur_part->sb->block_size / SECTOR_SIZE);
+  struct buffer_head* bh = bread(cur_part->bdev, block_lba);
+  struct dir_entry* p_de = (struct dir_entry*)bh->b_data;
   memcpy(p_de->filename, ".", 1);
   p_de->i_no = inode_no;
   p_de->f_type = FT_DIRECTORY;
@@ -606,7 +642,8 @@ int32_t sys_mkdir(const char* pathname) {
   memcpy(p_de->filename, "..", 2);
   p_de->i_no = parent_dir->inode->i_no;
   p_de->f_type = FT_DIRECTORY;
-  ide_write(cur_part->my_disk, block_lba, io_buf, 1);
+  bwrite(bh);
+  brelse(bh);
 
   new_dir_inode.i_size = 2 * cur_part->sb->dir_entry_size;
 
@@ -614,26 +651,21 @@ int32_t sys_mkdir(const char* pathname) {
   struct dir_entry new_dir_entry;
   memset(&new_dir_entry, 0, sizeof(struct dir_entry));
   create_dir_entry(dirname, inode_no, FT_DIRECTORY, &new_dir_entry);
-  memset(io_buf, 0, SECTOR_SIZE * 2);
-  if (!sync_dir_entry(parent_dir, &new_dir_entry, io_buf)) {
+  if (!sync_dir_entry(parent_dir, &new_dir_entry)) {
     printk("sys_mkdir: sync_dir_entry to disk failed!\n");
     rollback_step = 2;
     goto rollback;
   }
 
   // 更新父目录 inode
-  memset(io_buf, 0, SECTOR_SIZE * 2);
-  inode_sync(cur_part, parent_dir->inode, io_buf);
+  inode_sync(cur_part, parent_dir->inode);
 
   // 更新新目录 inode
-  memset(io_buf, 0, SECTOR_SIZE * 2);
-  inode_sync(cur_part, &new_dir_inode, io_buf);
+  inode_sync(cur_part, &new_dir_inode);
 
   // 更新inode_bitmap
   bitmap_sync(cur_part, inode_no, INODE_BITMAP);
 
-  sys_free(io_buf);
-
   dir_close(parent_dir);
   return 0;
 
@@ -645,13 +677,15 @@ rollback:
       dir_close(searched_record.parent_dir);
       break;
   }
-  sys_free(io_buf);
   return -1;
 }
 
 // 打开目录
 struct dir* sys_opendir(const char* name) {
   ASSERT(strlen(name) < MAX_PATH_LEN);
+  if (!fs_mounted()) {
+    return NULL;
+  }
   if (name[0] == '/' && (name[1] == 0 || name[0] == '.')) {
     return &root_dir;
   }
@@ -696,6 +730,9 @@ void sys_rewinddir(struct dir* dir) {
 
 // 删除空目录
 int32_t sys_rmdir(const char* pathname) {
+  if (!fs_mounted()) {
+    return -1;
+  }
   struct path_search_record searched_record;
   memset(&searched_record, 0, sizeof(struct path_search_record));
   int inode_no = search_file(pathname, &searched_record);
@@ -729,10 +766,10 @@ int32_t sys_rmdir(const char* pathname) {
 // 获取对应文件的父目录的inode号
 static uint32_t get_parent_dir_inode_nr(uint32_t child_inode_nr, void* io_buf) {
   struct inode* child_inode = inode_open(cur_part, child_inode_nr);
-  uint32_t block_lba = child_inode->i_sectors[0];
+  uint32_t block_lba = inode_bmap(cur_part, child_inode, 0, NULL);
   ASSERT(block_lba >= cur_part->sb->data_start_lba);
   inode_close(child_inode);
-  ide_read(cur_part->my_disk, block_lba, io_buf, 1);
+  buffer_read(cur_part->bdev, block_lba, io_buf, 1);
   struct dir_entry* dir_e = (struct dir_entry*)io_buf;
   ASSERT(dir_e[1].i_no < 4096 && dir_e[1].f_type == FT_DIRECTORY);
   return dir_e[1].i_no;
@@ -744,39 +781,35 @@ static int get_child_dir_name(uint32_t p_inode_nr,
                               char* path,
                               void* io_buf) {
   struct inode* parent_dir_inode = inode_open(cur_part, p_inode_nr);
-  uint8_t block_idx = 0;
-  uint32_t all_blocks[140] = {0}, block_cnt = 12;
-  while (block_idx < 12) {
-    all_blocks[block_idx] = parent_dir_inode->i_sectors[block_idx];
-    block_idx++;
-  }
-  if (parent_dir_inode->i_sectors[12] != 0) {
-    ide_read(cur_part->my_disk, parent_dir_inode->i_sectors[12],
-             all_blocks + 12, 1);
-    block_cnt = 140;
-  }
-  inode_close(parent_dir_inode);
-
   struct dir_entry* dir_e = (struct dir_entry*)io_buf;
   uint32_t dir_entry_size = cur_part->sb->dir_entry_size;
   uint32_t dir_entrys_per_sec = (512 / dir_entry_size);
-  block_idx = 0;
-  while (block_idx < block_cnt) {
-    if (all_blocks[block_idx] != 0) {
-      ide_read(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
-      uint8_t dir_e_idx = 0;
-      while (dir_e_idx < dir_entrys_per_sec) {
-        if ((dir_e + dir_e_idx)->i_no == c_inode_nr) {
-          strcat(path, "/");
-          strcat(path, (dir_e + dir_e_idx)->filename);
-          return 0;
-        }
-        dir_e_idx++;
+  uint32_t sec_idx = 0, sec_lba, run;
+  int ret = -1;
+  while (ret == -1) {
+    sec_lba = inode_sec_map(cur_part, parent_dir_inode, sec_idx, &run);
+    if (sec_lba == 0 && run == 0) {
+      break;
+    }
+    if (sec_lba == 0) {
+      sec_idx += run;
+      continue;
+    }
+    buffer_read(cur_part->bdev, sec_lba, io_buf, 1);
+    uint8_t dir_e_idx = 0;
+    while (dir_e_idx < dir_entrys_per_sec) {
+      if ((dir_e + dir_e_idx)->i_no == c_inode_nr) {
+        strcat(path, "/");
+        strcat(path, (dir_e + dir_e_idx)->filename);
+        ret = 0;
+        break;
       }
+      dir_e_idx++;
     }
-    block_idx++;
+    sec_idx++;
   }
-  return -1;
+  inode_close(parent_dir_inode);
+  return ret;
 }
 
 // 获取当前进程工作目录
@@ -826,6 +859,9 @@ char* sys_getcwd(char* buf, uint32_t size) {
 // 改变当前进程工作目录
 int32_t sys_chdir(const char* path) {
   int32_t ret = -1;
+  if (!fs_mounted()) {
+    return -1;
+  }
   struct path_search_record searched_record;
   memset(&searched_record, 0, sizeof(struct path_search_record));
   int inode_no = search_file(path, &searched_record);
@@ -843,6 +879,9 @@ int32_t sys_chdir(const char* path) {
 
 // 获取对用文件的属性并写入buf
 int32_t sys_stat(const char* path, struct stat* buf) {
+  if (!fs_mounted()) {
+    return -1;
+  }
   if (!strcmp(path, "/") || !strcmp(path, "/.") || !strcmp(path, "/..")) {
     buf->st_filetype = FT_DIRECTORY;
     buf->st_ino = 0;
@@ -869,6 +908,55 @@ int32_t sys_stat(const char* path, struct stat* buf) {
   return ret;
 }
 
+// 把缓存中的全部脏块写回磁盘
+int32_t sys_sync(void) {
+  return buffer_sync(NULL);
+}
+
+// 把文件所在磁盘的脏块写回，返回时文件的数据和inode都已落盘
+int32_t sys_fsync(int32_t fd) {
+  // 未打开的fd在fd_table中是-1，不能拿去查file_table
+  if (fd <= stderr_no || fd >= MAX_FILES_OPEN_PER_PROC ||
+      proc_of(running_thread())->fd_table[fd] == -1 || is_pipe(fd)) {
+    printk("sys_fsync: fd error\n");
+    return -1;
+  }
+  uint32_t global_fd = fd_local2global(fd);
+  struct inode* inode = file_table[global_fd].fd_inode;
+  if (inode == NULL) {
+    return -1;
+  }
+  return buffer_sync(inode->i_part->bdev);
+}
+
+// 在名为part_name的分区上新建文件系统，原有数据全部丢失。
+// 已挂载的分区不能格式化；根分区此前没能挂载的，格式化后立即挂载
+int32_t sys_mkfs(const char* part_name) {
+  struct partition* part = NULL;
+  struct list_elem* elem = partition_list.head.next;
+  while (elem != &partition_list.tail) {
+    struct partition* p = elem2entry(struct partition, part_tag, elem);
+    if (!strcmp(p->name, part_name)) {
+      part = p;
+      break;
+    }
+    elem = elem->next;
+  }
+  if (part == NULL || part == cur_part) {
+    return -1;
+  }
+  partition_format(part, FS_BLOCK_SIZE);
+  if (cur_part == NULL && !strcmp(part->name, ROOT_PART)) {
+    char default_part[8] = ROOT_PART;
+    list_traversal(&partition_list, mount_partition, (int)default_part);
+    if (cur_part == NULL) {
+      return -1;
+    }
+    open_root_dir(cur_part);
+  }
+  return 0;
+}
+
 void sys_putchar(char char_asci) {
   console_put_char(char_asci);
 }
@@ -885,7 +973,9 @@ void sys_help(void) {
        rm: remove a regular file\n\
        pwd: show current work directory\n\
        ps: show process information\n\
+       sched: show or set scheduling groups, policies and cpu affinity\n\
        clear: clear screen\n\
+       mkfs: format a partition that is not mounted\n\
  shortcut key:\n\
        ctrl+l: clear screen\n\
        ctrl+u: clear input\n\n");
@@ -4,7 +4,16 @@
 #define MAX_FILES_PER_PART 4096
 #define BIT_PER_SECTOR 4096
 #define SECTOR_SIZE 512
-#define BLOCK_SIZE SECTOR_SIZE
+#define FS_BLOCK_SIZE 4096  // 格式化时选用的块大小，可为1024、2048或4096
+// 挂载的根分区。编译时配置了内存盘(cmake -DRAMDISK_SECTORS=n)时默认为ram0，
+// 也可以直接-DROOT_PART指定
+#ifndef ROOT_PART
+#if defined(RAMDISK_SECTORS) && RAMDISK_SECTORS > 0
+#define ROOT_PART "ram0"
+#else
+#define ROOT_PART "sdb1"
+#endif
+#endif
 
 #define MAX_PATH_LEN 512
 
@@ -49,6 +58,9 @@ int32_t sys_rmdir(const char* pathname);
 int32_t sys_chdir(const char* path);
 char* sys_getcwd(char* buf, uint32_t size);
 int32_t sys_stat(const char* path, struct stat* buf);
+int32_t sys_sync(void);
+int32_t sys_fsync(int32_t fd);
+int32_t sys_mkfs(const char* part_name);
 void sys_putchar(char char_asci);
 uint32_t fd_local2global(uint32_t local_fd);
 void sys_help(void);
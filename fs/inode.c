@@ -1,8 +1,10 @@
 #include "inode.h"
+#include "buffer.h"
 #include "debug.h"
 #include "file.h"
-#include "ide.h"
+#include "genhd.h"
 #include "interrupt.h"
+#include "stdio-kernel.h"
 #include "string.h"
 #include "super_block.h"
 
@@ -20,7 +22,7 @@ static void inode_locate(struct partition* part,
   ASSERT(inode_no < 4096);
   uint32_t inode_table_lba = part->sb->inode_table_lba;
 
-  uint32_t inode_size = sizeof(struct inode);
+  uint32_t inode_size = INODE_DISK_SIZE;
   uint32_t off_size = inode_no * inode_size;
 
   uint32_t off_sec = off_size / 512;
@@ -36,10 +38,37 @@ static void inode_locate(struct partition* part,
   inode_pos->off_size = off_size_in_sec;
 }
 
+// 在块缓存中读出或写入位于inode_pos的inode，inode可能跨两个扇区
+static void inode_copy(struct partition* part, struct inode_position* pos,
+                       struct inode* inode, bool to_disk) {
+  uint8_t* p = (uint8_t*)inode;
+  uint32_t lba = pos->sec_lba;
+  uint32_t off = pos->off_size;
+  uint32_t left = INODE_DISK_SIZE;
+  while (left > 0) {
+    uint32_t chunk = SECTOR_SIZE - off;
+    if (chunk > left) {
+      chunk = left;
+    }
+    struct buffer_head* bh = bread(part->bdev, lba);
+    if (to_disk) {
+      memcpy(bh->b_data + off, p, chunk);
+      bwrite(bh);
+    } else {
+      memcpy(p, bh->b_data + off, chunk);
+    }
+    brelse(bh);
+    p += chunk;
+    left -= chunk;
+    lba++;
+    off = 0;
+  }
+}
+
 // 将inode的信息同步入磁盘
-void inode_sync(struct partition* part, struct inode* inode, void* io_buf) {
+void inode_sync(struct partition* part, struct inode* inode) {
   // 获取inode位置信息
-  uint8_t inode_no = inode->i_no;
+  uint32_t inode_no = inode->i_no;
   struct inode_position inode_pos;
   inode_locate(part, inode_no, &inode_pos);
 
@@ -53,32 +82,38 @@ void inode_sync(struct partition* part, struct inode* inode, void* io_buf) {
   pure_inode.write_deny = false;
   pure_inode.inode_tag.next = pure_inode.inode_tag.prev = NULL;
 
-  // 写入磁盘
-  char* inode_buf = (char*)io_buf;
-  if (inode_pos.two_sec) {
-    ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
-    memcpy((inode_buf + inode_pos.off_size), &pure_inode, sizeof(struct inode));
-    ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
-  } else {
-    ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
-    memcpy((inode_buf + inode_pos.off_size), &pure_inode, sizeof(struct inode));
-    ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
-  }
+  // 直接在块缓存中修改，读-改-写不经过临时缓冲区
+  inode_copy(part, &inode_pos, &pure_inode, true);
 }
 
-// 打开对应编号的inode
-struct inode* inode_open(struct partition* part, uint32_t inode_no) {
+// 在已打开的inode链表中查找，找到则增加打开次数，调用者需持有open_inodes_lock
+static struct inode* open_inodes_find(struct partition* part,
+                                      uint32_t inode_no) {
   struct list_elem* elem = part->open_inodes.head.next;
   struct inode* inode_found;
-  // 若发现该inode已经打开，即能在open_inode中找到，则直接返回
   while (elem != &part->open_inodes.tail) {
     inode_found = elem2entry(struct inode, inode_tag, elem);
     if (inode_found->i_no == inode_no) {
+      // 读锁可被多个线程同时持有，计数需要关中断修改
+      enum intr_status old_status = intr_disable();
       inode_found->open_cnts++;
+      intr_set_status(old_status);
       return inode_found;
     }
     elem = elem->next;
   }
+  return NULL;
+}
+
+// 打开对应编号的inode
+struct inode* inode_open(struct partition* part, uint32_t inode_no) {
+  // 若发现该inode已经打开，即能在open_inode中找到，则直接返回
+  read_lock(&part->open_inodes_lock);
+  struct inode* inode_found = open_inodes_find(part, inode_no);
+  read_unlock(&part->open_inodes_lock);
+  if (inode_found != NULL) {
+    return inode_found;
+  }
 
   // 获取inode位置信息
   struct inode_position inode_pos;
@@ -92,24 +127,31 @@ struct inode* inode_open(struct partition* part, uint32_t inode_no) {
   cur->pgdir = cur_pagedir_bak;
 
   // 读取inode
-  char* inode_buf;
-  if (inode_pos.two_sec) {
-    inode_buf = (char*)sys_malloc(1024);
-    ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
-  } else {
-    inode_buf = (char*)sys_malloc(512);
-    ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+  inode_copy(part, &inode_pos, inode_found, false);
+  inode_found->i_part = part;
+  rwlock_init(&inode_found->dir_lock);
+
+  // 读盘期间可能已有其他线程打开了同一inode，加写锁后需再查一次
+  write_lock(&part->open_inodes_lock);
+  struct inode* inode_raced = open_inodes_find(part, inode_no);
+  if (inode_raced != NULL) {
+    write_unlock(&part->open_inodes_lock);
+    cur->pgdir = NULL;
+    sys_free(inode_found);
+    cur->pgdir = cur_pagedir_bak;
+    return inode_raced;
   }
-  memcpy(inode_found, (inode_buf + inode_pos.off_size), sizeof(struct inode));
   // 将inode加入open_inode
   list_push(&part->open_inodes, &inode_found->inode_tag);
   inode_found->open_cnts = 1;
-  sys_free(inode_buf);
+  write_unlock(&part->open_inodes_lock);
   return inode_found;
 }
 
 //关闭inode
 void inode_close(struct inode* inode) {
+  struct partition* part = inode->i_part;
+  write_lock(&part->open_inodes_lock);
   enum intr_status old_status = intr_disable();
   //有点像shared_ptr
   if (--inode->open_cnts == 0) {
@@ -122,38 +164,32 @@ void inode_close(struct inode* inode) {
     cur->pgdir = cur_pagedir_bak;
   }
   intr_set_status(old_status);
+  write_unlock(&part->open_inodes_lock);
 }
 
 //初始化inode
-void inode_init(uint32_t inode_no, struct inode* new_inode) {
+void inode_init(struct partition* part, uint32_t inode_no,
+                struct inode* new_inode) {
   new_inode->i_no = inode_no;
   new_inode->i_size = 0;
   new_inode->open_cnts = 0;
   new_inode->write_deny = false;
-  uint8_t sec_idx = 0;
-  while (sec_idx < 13) {
-    new_inode->i_sectors[sec_idx] = 0;
-    sec_idx++;
-  }
+  new_inode->i_depth = 0;
+  new_inode->i_entries = 0;
+  memset(new_inode->i_extents, 0, sizeof(new_inode->i_extents));
+  new_inode->i_part = part;
+  rwlock_init(&new_inode->dir_lock);
 }
 
 //删除inode，即将硬盘上的inode_table的对应inode位置置0,但这步实际上是不需要的，因为对应的inode是否可用取决于inode_bitmap
-void inode_delete(struct partition* part, uint32_t inode_no, void* io_buf) {
+void inode_delete(struct partition* part, uint32_t inode_no) {
   ASSERT(inode_no < 4096);
   struct inode_position inode_pos;
   inode_locate(part, inode_no, &inode_pos);
   ASSERT(inode_pos.sec_lba <= (part->start_lba + part->sec_cnt));
-  char* inode_buf = (char*)io_buf;
-
-  if (inode_pos.two_sec) {
-    ide_read(part->my_disk, inode_pos.sec_lba, io_buf, 2);
-    memset((io_buf + inode_pos.off_size), 0, sizeof(struct inode));
-    ide_write(part->my_disk, inode_pos.sec_lba, io_buf, 2);
-  } else {
-    ide_read(part->my_disk, inode_pos.sec_lba, io_buf, 1);
-    memset((io_buf + inode_pos.off_size), 0, sizeof(struct inode));
-    ide_write(part->my_disk, inode_pos.sec_lba, io_buf, 1);
-  }
+  struct inode zero_inode;
+  memset(&zero_inode, 0, sizeof(struct inode));
+  inode_copy(part, &inode_pos, &zero_inode, true);
 }
 
 //释放inode，是删除一个文件的步骤之一
@@ -161,44 +197,317 @@ void inode_release(struct partition* part, uint32_t inode_no) {
   struct inode* inode_to_del = inode_open(part, inode_no);
   ASSERT(inode_to_del->i_no == inode_no);
 
-  uint8_t block_idx = 0, block_cnt = 12;
-  uint32_t block_bitmap_idx;
-  uint32_t all_blocks[140] = {0};
+  //释放所有块，整段删除不会拆分区段
+  inode_shrink(part, inode_to_del, 0, 0xffffffff);
+
+  //回收对应的inode
+  bitmap_set(&part->inode_bitmap, inode_no, 0);
+  bitmap_sync(cur_part, inode_no, INODE_BITMAP);
 
-  while (block_idx < 12) {
-    all_blocks[block_idx] = inode_to_del->i_sectors[block_idx];
-    block_idx++;
+  inode_delete(part, inode_no);
+  inode_close(inode_to_del);
+}
+
+// 查文件内第block_idx块首扇区的lba。*run为从该块起在同一区段内还有多少块；
+// 是空洞时返回0，*run为到下一区段的块数，已过最后一个区段则*run为0
+uint32_t inode_bmap(struct partition* part, struct inode* inode,
+                    uint32_t block_idx, uint32_t* run) {
+  struct extent* ext = inode->i_extents;
+  uint32_t cnt = inode->i_entries;
+  uint32_t next = 0;  // 下一个区段块的起始块号，0表示没有
+  struct buffer_head* bh = NULL;
+  uint32_t lba = 0, left = 0, leaf_lba = 0;
+  uint32_t sects_per_block = part->sb->block_size / SECTOR_SIZE;
+
+  if (inode->i_depth > 0) {
+    uint32_t leaf = 0;
+    while (leaf + 1 < cnt && ext[leaf + 1].e_block <= block_idx) {
+      leaf++;
+    }
+    if (leaf + 1 < cnt) {
+      next = ext[leaf + 1].e_block;
+    }
+    leaf_lba = ext[leaf].e_start;
+    bh = bread(part->bdev, leaf_lba);
+    cnt = ext[leaf].e_len;
+    ext = (struct extent*)bh->b_data;
+  }
+
+  // 找第一个结束位置在block_idx之后的区段，区段块逐个扇区查
+  struct extent* found = NULL;
+  uint32_t idx = 0;
+  while (idx < cnt && found == NULL) {
+    uint32_t n = cnt - idx, i;
+    if (leaf_lba != 0) {
+      if (idx > 0) {
+        brelse(bh);
+        bh = bread(part->bdev, leaf_lba + idx / EXTENTS_PER_SECTOR);
+        ext = (struct extent*)bh->b_data;
+      }
+      n = n < EXTENTS_PER_SECTOR ? n : EXTENTS_PER_SECTOR;
+    }
+    for (i = 0; i < n; i++) {
+      if (ext[i].e_block + ext[i].e_len > block_idx) {
+        found = &ext[i];
+        break;
+      }
+    }
+    idx += n;
+  }
+  if (found != NULL && found->e_block <= block_idx) {
+    lba = found->e_start + (block_idx - found->e_block) * sects_per_block;
+    left = found->e_len - (block_idx - found->e_block);
+  } else if (found != NULL) {
+    left = found->e_block - block_idx;
+  } else if (next != 0) {
+    left = next - block_idx;
   }
 
-  if (inode_to_del->i_sectors[12] != 0) {
-    ide_read(part->my_disk, inode_to_del->i_sectors[12], all_blocks + 12, 1);
-    block_cnt = 140;
+  if (bh != NULL) {
+    brelse(bh);
+  }
+  if (run != NULL) {
+    *run = left;
+  }
+  return lba;
+}
 
-    block_bitmap_idx = inode_to_del->i_sectors[12] - part->sb->data_start_lba;
-    ASSERT(block_bitmap_idx > 0);
-    // 释放间接块表
-    bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
-    bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
+// 同inode_bmap，但按文件内的扇区查，*run以扇区计
+uint32_t inode_sec_map(struct partition* part, struct inode* inode,
+                       uint32_t sec_idx, uint32_t* run) {
+  uint32_t sects_per_block = part->sb->block_size / SECTOR_SIZE;
+  uint32_t off = sec_idx % sects_per_block;
+  uint32_t blocks;
+  uint32_t lba = inode_bmap(part, inode, sec_idx / sects_per_block, &blocks);
+  if (run != NULL) {
+    *run = blocks == 0 ? 0 : blocks * sects_per_block - off;
   }
-  block_idx = 0;
-  //释放所有块
-  while (block_idx < block_cnt) {
-    if (all_blocks[block_idx] != 0) {
-      block_bitmap_idx = 0;
-      block_bitmap_idx = all_blocks[block_idx] - part->sb->data_start_lba;
-      ASSERT(block_bitmap_idx > 0);
-      bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
-      bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
+  return lba == 0 ? 0 : lba + off;
+}
+
+// 把inode的全部区段按块号顺序读入list，返回区段数
+static uint32_t ext_load(struct partition* part, struct inode* inode,
+                         struct extent* list) {
+  if (inode->i_depth == 0) {
+    memcpy(list, inode->i_extents, inode->i_entries * sizeof(struct extent));
+    return inode->i_entries;
+  }
+  uint32_t cnt = 0, leaf;
+  for (leaf = 0; leaf < inode->i_entries; leaf++) {
+    uint32_t lba = inode->i_extents[leaf].e_start;
+    uint32_t left = inode->i_extents[leaf].e_len;
+    while (left > 0) {
+      uint32_t n = left < EXTENTS_PER_SECTOR ? left : EXTENTS_PER_SECTOR;
+      struct buffer_head* bh = bread(part->bdev, lba++);
+      memcpy(list + cnt, bh->b_data, n * sizeof(struct extent));
+      brelse(bh);
+      cnt += n;
+      left -= n;
     }
-    block_idx++;
   }
+  return cnt;
+}
 
-  //回收对应的inode
-  bitmap_set(&part->inode_bitmap, inode_no, 0);
-  bitmap_sync(cur_part, inode_no, INODE_BITMAP);
+// 用list重建inode的区段树：放得下就存在inode内，否则依次装满区段块。
+// 已有的区段块沿用，不够的新分配，多余的释放。失败时inode不变
+static bool ext_store(struct partition* part, struct inode* inode,
+                      struct extent* list, uint32_t cnt) {
+  uint32_t per_block = EXTENTS_PER_BLOCK(part);
+  uint32_t leaves = cnt <= INODE_EXTENTS ? 0 : DIV_ROUND_UP(cnt, per_block);
+  if (leaves > INODE_EXTENTS) {
+    return false;
+  }
+  uint32_t old_leaves = inode->i_depth > 0 ? inode->i_entries : 0;
+  uint32_t leaf_lba[INODE_EXTENTS];
+  uint32_t leaf, got;
+  for (leaf = 0; leaf < leaves; leaf++) {
+    if (leaf < old_leaves) {
+      leaf_lba[leaf] = inode->i_extents[leaf].e_start;
+      continue;
+    }
+    int32_t lba = block_bitmap_alloc_run(part, 0, 1, &got);
+    if (lba == -1) {
+      while (leaf-- > old_leaves) {
+        block_bitmap_free(part, leaf_lba[leaf], 1);
+      }
+      return false;
+    }
+    leaf_lba[leaf] = lba;
+  }
+  for (leaf = leaves; leaf < old_leaves; leaf++) {
+    block_bitmap_free(part, inode->i_extents[leaf].e_start, 1);
+  }
 
-  void* io_buf = sys_malloc(BLOCK_SIZE * 2);
-  inode_delete(part, inode_no, io_buf);
-  sys_free(io_buf);
-  inode_close(inode_to_del);
+  if (leaves == 0) {
+    inode->i_depth = 0;
+    inode->i_entries = cnt;
+    memcpy(inode->i_extents, list, cnt * sizeof(struct extent));
+    return true;
+  }
+  inode->i_depth = 1;
+  inode->i_entries = leaves;
+  uint32_t done = 0;
+  for (leaf = 0; leaf < leaves; leaf++) {
+    uint32_t n = cnt - done < per_block ? cnt - done : per_block;
+    inode->i_extents[leaf].e_block = list[done].e_block;
+    inode->i_extents[leaf].e_start = leaf_lba[leaf];
+    inode->i_extents[leaf].e_len = n;
+    // 内容没变的扇区不标脏，追加写时通常只有最后一个扇区变了
+    uint32_t lba = leaf_lba[leaf];
+    while (n > 0) {
+      uint32_t chunk = n < EXTENTS_PER_SECTOR ? n : EXTENTS_PER_SECTOR;
+      struct buffer_head* bh = bread(part->bdev, lba++);
+      if (memcmp(bh->b_data, list + done, chunk * sizeof(struct extent))) {
+        memcpy(bh->b_data, list + done, chunk * sizeof(struct extent));
+        bwrite(bh);
+      }
+      brelse(bh);
+      done += chunk;
+      n -= chunk;
+    }
+  }
+  return true;
+}
+
+// 释放list中文件内块号落在[from, to)的数据块
+static void ext_free_range(struct partition* part, struct extent* list,
+                           uint32_t cnt, uint32_t from, uint32_t to) {
+  uint32_t sects_per_block = part->sb->block_size / SECTOR_SIZE;
+  uint32_t idx;
+  for (idx = 0; idx < cnt; idx++) {
+    uint32_t start = list[idx].e_block > from ? list[idx].e_block : from;
+    uint32_t end = list[idx].e_block + list[idx].e_len;
+    end = end < to ? end : to;
+    if (start < end) {
+      block_bitmap_free(
+          part,
+          list[idx].e_start + (start - list[idx].e_block) * sects_per_block,
+          end - start);
+    }
+  }
+}
+
+// 为文件内从block_idx开始的cnt块(须是空洞或文件末尾之后)分配数据块。
+// 从前一区段的末尾接着分配，连续的块并入同一区段。失败时已分配的块全部释放
+bool inode_grow(struct partition* part, struct inode* inode,
+                uint32_t block_idx, uint32_t cnt) {
+  uint32_t max_extents = MAX_EXTENTS(part);
+  struct extent* list =
+      (struct extent*)sys_malloc((max_extents + 1) * sizeof(struct extent));
+  if (list == NULL) {
+    printk("inode_grow: sys_malloc for list failed!\n");
+    return false;
+  }
+  uint32_t n = ext_load(part, inode, list);
+  uint32_t pos = 0;
+  while (pos < n && list[pos].e_block <= block_idx) {
+    pos++;
+  }
+  ASSERT(pos == 0 ||
+         list[pos - 1].e_block + list[pos - 1].e_len <= block_idx);
+  ASSERT(pos == n || block_idx + cnt <= list[pos].e_block);
+
+  uint32_t sects_per_block = part->sb->block_size / SECTOR_SIZE;
+  uint32_t goal =
+      pos > 0 ? list[pos - 1].e_start + list[pos - 1].e_len * sects_per_block
+              : 0;
+  uint32_t done = 0, got;
+  bool ok = true;
+  while (done < cnt) {
+    int32_t lba = block_bitmap_alloc_run(part, goal, cnt - done, &got);
+    if (lba == -1) {
+      ok = false;
+      break;
+    }
+    struct extent* prev = pos > 0 ? &list[pos - 1] : NULL;
+    if (prev != NULL && prev->e_block + prev->e_len == block_idx + done &&
+        prev->e_start + prev->e_len * sects_per_block == (uint32_t)lba) {
+      prev->e_len += got;
+    } else if (n <= max_extents) {
+      uint32_t idx;
+      for (idx = n; idx > pos; idx--) {
+        list[idx] = list[idx - 1];
+      }
+      list[pos].e_block = block_idx + done;
+      list[pos].e_start = lba;
+      list[pos].e_len = got;
+      n++;
+      pos++;
+    } else {
+      block_bitmap_free(part, lba, got);
+      ok = false;
+      break;
+    }
+    done += got;
+    goal = lba + got * sects_per_block;
+  }
+
+  // 与后一个区段首尾相接时合并
+  if (pos > 0 && pos < n &&
+      list[pos - 1].e_block + list[pos - 1].e_len == list[pos].e_block &&
+      list[pos - 1].e_start + list[pos - 1].e_len * sects_per_block ==
+          list[pos].e_start) {
+    list[pos - 1].e_len += list[pos].e_len;
+    n--;
+    uint32_t idx;
+    for (idx = pos; idx < n; idx++) {
+      list[idx] = list[idx + 1];
+    }
+  }
+
+  if (ok) {
+    ok = ext_store(part, inode, list, n);
+  }
+  if (!ok) {
+    ext_free_range(part, list, n, block_idx, block_idx + done);
+  }
+  sys_free(list);
+  return ok;
+}
+
+// 释放文件内从block_idx开始的cnt块，区段被挖空中间时一分为二。
+// 拆分后区段树放不下时什么都不做，返回false
+bool inode_shrink(struct partition* part, struct inode* inode,
+                  uint32_t block_idx, uint32_t cnt) {
+  uint32_t sects_per_block = part->sb->block_size / SECTOR_SIZE;
+  uint32_t from = block_idx;
+  uint32_t to = cnt > 0xffffffff - block_idx ? 0xffffffff : block_idx + cnt;
+  uint32_t max_extents = MAX_EXTENTS(part);
+  struct extent* list =
+      (struct extent*)sys_malloc(2 * (max_extents + 1) * sizeof(struct extent));
+  if (list == NULL) {
+    printk("inode_shrink: sys_malloc for list failed!\n");
+    return false;
+  }
+  struct extent* new_list = list + max_extents + 1;
+  uint32_t n = ext_load(part, inode, list);
+  uint32_t new_n = 0, idx;
+  for (idx = 0; idx < n && new_n <= max_extents; idx++) {
+    struct extent* e = &list[idx];
+    uint32_t end = e->e_block + e->e_len;
+    if (end <= from || e->e_block >= to) {
+      new_list[new_n++] = *e;
+      continue;
+    }
+    if (e->e_block < from) {  // 保留头部
+      new_list[new_n].e_block = e->e_block;
+      new_list[new_n].e_start = e->e_start;
+      new_list[new_n].e_len = from - e->e_block;
+      new_n++;
+    }
+    if (end > to && new_n <= max_extents) {  // 保留尾部
+      new_list[new_n].e_block = to;
+      new_list[new_n].e_start =
+          e->e_start + (to - e->e_block) * sects_per_block;
+      new_list[new_n].e_len = end - to;
+      new_n++;
+    }
+  }
+
+  bool ok = new_n <= max_extents && ext_store(part, inode, new_list, new_n);
+  if (ok) {
+    ext_free_range(part, list, n, from, to);
+  }
+  sys_free(list);
+  return ok;
 }
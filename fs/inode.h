@@ -2,8 +2,23 @@
 #define __FS_INODE_H
 #include "stdint.h"
 #include "list.h"
-#include "ide.h"
+#include "genhd.h"
+#include "fs.h"
 
+// 区段：文件内连续的e_len块映射到从e_start开始的连续扇区。
+// 索引项中e_start是区段块的lba，e_len是该块中的区段数。
+// 区段块的每个扇区放EXTENTS_PER_SECTOR项，区段不跨扇区
+struct extent {
+  uint32_t e_block;  // 起始的文件内块号
+  uint32_t e_start;
+  uint32_t e_len;
+};
+
+#define INODE_EXTENTS 4  // inode内的区段(或索引项)数
+#define EXTENTS_PER_SECTOR (SECTOR_SIZE / sizeof(struct extent))
+#define EXTENTS_PER_BLOCK(part) \
+  ((part)->sb->block_size / SECTOR_SIZE * EXTENTS_PER_SECTOR)
+#define MAX_EXTENTS(part) (INODE_EXTENTS * EXTENTS_PER_BLOCK(part))
 
 struct inode{
   uint32_t i_no;//inode号
@@ -12,13 +27,30 @@ struct inode{
   uint32_t open_cnts;//打开次数，该成员在硬盘上无意义
   bool write_deny;//是否正在被写入，该成员在硬盘上无意义
 
-  uint32_t i_sectors[13];//文件占用的block地址
+  // 区段树，按e_block升序。深度为0时i_extents就是区段；
+  // 深度为1时是索引项，区段放不下时溢出到最多INODE_EXTENTS个区段块中
+  uint16_t i_depth;
+  uint16_t i_entries;  // i_extents中的有效项数
+  struct extent i_extents[INODE_EXTENTS];
   struct list_elem inode_tag;//在分区中打开inode链表中的tag
-  
+  // 以下成员只在内存中，不占inode表的空间
+  struct partition* i_part;  // inode所在的分区
+  struct rwlock dir_lock;    // 目录inode的目录项：查找和遍历取读锁，增删取写锁
 };
-void inode_sync(struct partition* part, struct inode* inode, void* io_buf);
+// inode表中每项的大小，不含只在内存中的成员
+#define INODE_DISK_SIZE ((uint32_t)offset(struct inode, i_part))
+void inode_sync(struct partition* part, struct inode* inode);
 struct inode* inode_open(struct partition* part, uint32_t inode_no);
 void inode_close(struct inode* inode);
-void inode_init(uint32_t inode_no, struct inode* new_inode);
+void inode_init(struct partition* part, uint32_t inode_no,
+                struct inode* new_inode);
 void inode_release(struct partition* part, uint32_t inode_no);
-#endif
\ No newline at end of file
+uint32_t inode_bmap(struct partition* part, struct inode* inode,
+                    uint32_t block_idx, uint32_t* run);
+uint32_t inode_sec_map(struct partition* part, struct inode* inode,
+                       uint32_t sec_idx, uint32_t* run);
+bool inode_grow(struct partition* part, struct inode* inode,
+                uint32_t block_idx, uint32_t cnt);
+bool inode_shrink(struct partition* part, struct inode* inode,
+                  uint32_t block_idx, uint32_t cnt);
+#endif
@@ -2,6 +2,10 @@
 #define __FS_SUPER_BLOCK_H
 #include "stdint.h"
 
+#define FS_MAGIC 0x20060127
+// 1: 12个直接块加一个间接块，2: 区段树，3: 块大小可配置，区段块用满整块
+#define FS_VERSION 3
+
 struct super_block {
   uint32_t magic;
   uint32_t sec_cnt;
@@ -20,8 +24,10 @@ struct super_block {
   uint32_t data_start_lba;
   uint32_t root_inode_no;
   uint32_t dir_entry_size;
+  uint32_t version;
+  uint32_t block_size;  // 字节，块由连续扇区组成，块位图每位对应一块
 
-  uint8_t pad[460];
+  uint8_t pad[452];
 } __attribute__((packed));
  
 #endif
\ No newline at end of file
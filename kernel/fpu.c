@@ -0,0 +1,165 @@
+#include "fpu.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "print.h"
+#include "string.h"
+
+// 惰性切换FPU/SSE上下文：切换任务时只置CR0.TS，任务第一次执行浮点或SSE
+// 指令时触发#NM，再把上一个使用者的寄存器存回它的保存区并恢复当前任务的。
+// 保存区在任务第一次用FPU时才分配，不用浮点的任务不占这部分内存
+
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR0_TS (1 << 3)
+#define CR0_NE (1 << 5)
+#define CR4_OSFXSR (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+#define CPUID_FXSR (1 << 24)
+#define CPUID_SSE (1 << 25)
+#define MXCSR_DEFAULT 0x1f80
+// fxsave写512字节且要求16字节对齐，整页分配自然满足；fnsave只用前108字节
+#define FPU_AREA_SIZE 512
+
+static struct task_struct* fpu_owner;  // FPU寄存器中当前是谁的状态
+static bool has_fxsr;
+static bool has_sse;
+
+static inline uint32_t read_cr0(void) {
+  uint32_t cr0;
+  asm volatile("movl %%cr0, %0" : "=r"(cr0));
+  return cr0;
+}
+
+static inline void write_cr0(uint32_t cr0) {
+  asm volatile("movl %0, %%cr0" : : "r"(cr0) : "memory");
+}
+
+static inline void clts(void) {
+  asm volatile("clts" ::: "memory");
+}
+
+static inline void stts(void) {
+  write_cr0(read_cr0() | CR0_TS);
+}
+
+static void fpu_save(struct task_struct* pthread) {
+  if (has_fxsr) {
+    asm volatile("fxsave (%0)" : : "r"(pthread->fpu_area) : "memory");
+  } else {
+    asm volatile("fnsave (%0); fwait" : : "r"(pthread->fpu_area) : "memory");
+  }
+}
+
+static void fpu_restore(struct task_struct* pthread) {
+  if (has_fxsr) {
+    asm volatile("fxrstor (%0)" : : "r"(pthread->fpu_area) : "memory");
+  } else {
+    asm volatile("frstor (%0)" : : "r"(pthread->fpu_area) : "memory");
+  }
+}
+
+// #NM：当前任务在TS置位时用到了FPU
+static void fpu_nm_handler(uint8_t vec_nr UNUSED) {
+  struct task_struct* cur = running_thread();
+  bool fresh = false;
+  if (cur->fpu_area == NULL) {
+    // 分配时可能睡眠，此时还没碰FPU寄存器，回来后按当前状态继续即可
+    cur->fpu_area = get_kernel_pages(1);
+    if (cur->fpu_area == NULL) {
+      PANIC("fpu_nm_handler: no memory for fpu state");
+    }
+    fresh = true;
+  }
+  clts();
+  if (fpu_owner == cur) {
+    return;
+  }
+  if (fpu_owner != NULL) {
+    fpu_save(fpu_owner);
+  }
+  if (!fresh) {
+    fpu_restore(cur);
+  } else {
+    asm volatile("fninit");
+    if (has_sse) {
+      uint32_t mxcsr = MXCSR_DEFAULT;
+      asm volatile("ldmxcsr %0" : : "m"(mxcsr));
+    }
+  }
+  fpu_owner = cur;
+}
+
+// 由schedule在切换前调用，只有FPU中正是next的状态时才允许直接使用
+void fpu_switch_prepare(struct task_struct* next) {
+  if (next == fpu_owner) {
+    clts();
+  } else {
+    stts();
+  }
+}
+
+// 把pthread还留在寄存器中的状态写回保存区
+static void fpu_flush(struct task_struct* pthread) {
+  enum intr_status old_status = intr_disable();
+  if (fpu_owner == pthread) {
+    clts();
+    fpu_save(pthread);
+    if (pthread != running_thread()) {
+      stts();
+    }
+  }
+  intr_set_status(old_status);
+}
+
+// fork/clone在复制PCB之后调用，子任务得到父任务FPU状态的副本，内存不足返回-1
+int32_t fpu_copy(struct task_struct* child, struct task_struct* parent) {
+  child->fpu_area = NULL;
+  if (parent->fpu_area == NULL) {
+    return 0;
+  }
+  child->fpu_area = get_kernel_pages(1);
+  if (child->fpu_area == NULL) {
+    return -1;
+  }
+  fpu_flush(parent);
+  memcpy(child->fpu_area, parent->fpu_area, FPU_AREA_SIZE);
+  return 0;
+}
+
+// 任务退出或换掉映像后，寄存器中的状态不再有主人，保存区也一并释放
+void fpu_release(struct task_struct* pthread) {
+  enum intr_status old_status = intr_disable();
+  if (fpu_owner == pthread) {
+    fpu_owner = NULL;
+    stts();
+  }
+  if (pthread->fpu_area != NULL) {
+    mfree_page(PF_KERNEL, pthread->fpu_area, 1);
+    pthread->fpu_area = NULL;
+  }
+  intr_set_status(old_status);
+}
+
+void fpu_init(void) {
+  put_str("  fpu_init start\n");
+  uint32_t eax = 1, ebx, ecx, edx;
+  asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+  has_fxsr = (edx & CPUID_FXSR) != 0;
+  has_sse = has_fxsr && (edx & CPUID_SSE) != 0;
+  if (has_fxsr) {
+    uint32_t cr4;
+    asm volatile("movl %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR;
+    if (has_sse) {
+      cr4 |= CR4_OSXMMEXCPT;
+    }
+    asm volatile("movl %0, %%cr4" : : "r"(cr4));
+  }
+  write_cr0((read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE);
+  asm volatile("fninit");
+  fpu_owner = NULL;
+  stts();
+  register_handler(7, fpu_nm_handler);
+  put_str("  fpu_init done\n");
+}
@@ -0,0 +1,10 @@
+#ifndef __KERNEL_FPU_H
+#define __KERNEL_FPU_H
+#include "stdint.h"
+#include "thread.h"
+
+void fpu_init(void);
+void fpu_switch_prepare(struct task_struct* next);
+int32_t fpu_copy(struct task_struct* child, struct task_struct* parent);
+void fpu_release(struct task_struct* pthread);
+#endif
@@ -8,22 +8,42 @@
 #include "keyboard.h"
 #include "tss.h"
 #include "syscall-init.h"
+#include "blk.h"
+#include "genhd.h"
 #include "ide.h"
+#include "ahci.h"
+#include "virtio_blk.h"
+#include "ramdisk.h"
+#include "pci.h"
 #include "fs.h"
+#include "softirq.h"
+#include "workqueue.h"
+#include "futex.h"
+#include "fpu.h"
 
 //进行必要的初始化
 void init_all() {
   put_str("init all\n");
   idt_init();  // 有关中断额的初始化
+  fpu_init();
   mem_init();//初始化内存池
   thread_init();
+  softirq_init();  // 启动ksoftirqd，之后才能触发软中断
   timer_init();  // 初始化时钟中断的频率
+  workqueue_init();
   console_init();
   keyboard_init();
   tss_init();
   syscall_init();
+  futex_init();
   intr_enable();
+  pci_init();
+  blk_init();
+  genhd_init();
   ide_init();
+  ahci_init();
+  virtio_blk_init();
+  ramdisk_init();
   filesys_init();
   put_str("init all done\n");
 }
\ No newline at end of file
@@ -12,6 +12,8 @@
 #define PIC_S_DATA 0xa1
 
 #define IDT_DESC_CNT 0x81
+#define NR_IRQ_LINES 16    // 8259A主从片的中断线数
+#define NR_IRQ_ACTIONS 16  // 所有中断线上可挂的处理程序总数
 
 extern uint32_t syscall_handler();
 
@@ -46,6 +48,17 @@ intr_handler idt_table[IDT_DESC_CNT];
 // 中断处理历程，在kernel.s定义
 extern intr_handler intr_entry_table[IDT_DESC_CNT];
 
+// 挂在某根中断线上的一个处理程序，PCI设备的INTx可能多个设备共用一根线
+struct irq_action {
+  irq_handler_t* handler;
+  void* dev_id;
+  struct irq_action* next;
+};
+
+static struct irq_action irq_actions[NR_IRQ_ACTIONS];
+static uint32_t nr_irq_actions;
+static struct irq_action* irq_chain[NR_IRQ_LINES];  // 按注册顺序链接
+
 // 初始化可编程中断控制器
 static void pic_init() {
   // 初始化主片
@@ -193,4 +206,54 @@ enum intr_status intr_set_status(enum intr_status status) {
 
 void register_handler(uint8_t vector_no, intr_handler function) {
   idt_table[vector_no] = function;
-}
\ No newline at end of file
+}
+
+// 共享中断线的入口，依次调用线上的所有处理程序
+static void shared_irq_handler(uint8_t vec_nr) {
+  struct irq_action* action = irq_chain[vec_nr - 0x20];
+  while (action != NULL) {
+    action->handler(action->dev_id);
+    action = action->next;
+  }
+}
+
+// 把handler挂到irq号中断线上并打开该中断，dev_id原样传给handler。
+// 中断线已被register_handler独占或处理程序用完时返回-1
+int32_t request_irq(uint8_t irq, irq_handler_t* handler, void* dev_id) {
+  if (irq >= NR_IRQ_LINES) {
+    return -1;
+  }
+  uint8_t vec_nr = 0x20 + irq;
+  enum intr_status old_status = intr_disable();
+  if ((idt_table[vec_nr] != general_intr_handler &&
+       idt_table[vec_nr] != shared_irq_handler) ||
+      nr_irq_actions == NR_IRQ_ACTIONS) {
+    intr_set_status(old_status);
+    return -1;
+  }
+  struct irq_action* action = &irq_actions[nr_irq_actions++];
+  action->handler = handler;
+  action->dev_id = dev_id;
+  action->next = NULL;
+  struct irq_action** pos = &irq_chain[irq];
+  while (*pos != NULL) {
+    pos = &(*pos)->next;
+  }
+  *pos = action;
+  idt_table[vec_nr] = shared_irq_handler;
+  intr_set_status(old_status);
+  pic_unmask_irq(irq);
+  return 0;
+}
+
+// 在8259A上打开irq号中断，从片上的中断还需打开主片的级联线IRQ2
+void pic_unmask_irq(uint8_t irq) {
+  enum intr_status old_status = intr_disable();
+  if (irq < 8) {
+    outb(PIC_M_DATA, inb(PIC_M_DATA) & ~(1 << irq));
+  } else {
+    outb(PIC_S_DATA, inb(PIC_S_DATA) & ~(1 << (irq - 8)));
+    outb(PIC_M_DATA, inb(PIC_M_DATA) & ~(1 << 2));
+  }
+  intr_set_status(old_status);
+}
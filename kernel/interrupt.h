@@ -1,6 +1,8 @@
 #ifndef __KERNEL_INTERRUPT_H
 #define __KERNEL_INTERRUPT_H
 #include "stdint.h"
+// 处理程序形如void handler(uint8_t vec_nr, struct intr_stack* frame)，
+// frame指向被打断的现场，用不到时可只声明vec_nr
 typedef void* intr_handler;
 void idt_init(void);
 
@@ -11,4 +13,9 @@ enum intr_status intr_enable();
 enum intr_status intr_disable();
 enum intr_status intr_set_status(enum intr_status);
 void register_handler(uint8_t vector_no, intr_handler function);
+void pic_unmask_irq(uint8_t irq);
+
+// 共享中断线上的处理程序，须先检查自己设备的中断状态，不是自己的就直接返回
+typedef void irq_handler_t(void* dev_id);
+int32_t request_irq(uint8_t irq, irq_handler_t* handler, void* dev_id);
 #endif
\ No newline at end of file
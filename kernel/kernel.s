@@ -23,8 +23,12 @@ intr%1entry:
   out 0xa0, al
   out 0x20, al
   push %1
+  ;处理程序的参数为(中断号, 本次中断的intr_stack)，push esp压入的是执行前的esp
+  push esp
+  push %1
   ;调用idt_table中对应的中断处理方法
   call [idt_table + %1 * 4]
+  add esp, 8
   ;中断处理结束
   jmp intr_exit
 ;由于都是.data，这些section在编译时会被合并到一起，从而形成intr_entry_table,存放着各个中断处理历程的地址
@@ -15,12 +15,16 @@ struct pool {
   struct bitmap pool_bitmap;  // 池
   uint32_t phy_addr_start;    // 物理内存起始地址
   uint32_t phy_size;          // 物理内存大小(字节为单位)
-  struct lock lock;
+  struct mutex lock;
 };
 
 struct pool kernel_pool, user_pool;
 struct virtual_addr kernel_vaddr;
 
+#define CPUID_PGE (1 << 13)
+#define CR4_PGE (1 << 7)
+static bool pge_enabled = false;  // 是否已打开CR4.PGE，之后新建的内核页表项带G位
+
 #define PDE_INDEX(addr) ((addr & 0xffc00000) >> 22)
 #define PTE_INDEX(addr) ((addr & 0x003ff000) >> 12)
 
@@ -91,7 +95,7 @@ static void* vaddr_get(enum pool_flags pf, uint32_t pg_cnt) {
     }
     vaddr_start = kernel_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
   } else {
-    struct task_struct* cur = running_thread();
+    struct task_struct* cur = proc_of(running_thread());
     bit_idx_start = bitmap_scan(&cur->userprog_vaddr.vaddr_bitmap, pg_cnt);
     if (bit_idx_start == -1) {
       return NULL;
@@ -134,20 +138,25 @@ static void page_table_add(void* _vaddr, void* _page_phyaddr) {
   uint32_t vaddr = (uint32_t)_vaddr, page_phyaddr = (uint32_t)_page_phyaddr;
   uint32_t* pte = pte_ptr(vaddr);
   uint32_t* pde = pde_ptr(vaddr);
+  // 内核空间在所有页目录中相同，映射设为全局页；页目录项不能带G位
+  uint32_t pte_flags = PG_US_U | PG_RW_W | PG_P_1;
+  if (pge_enabled && vaddr >= 0xc0000000) {
+    pte_flags |= PG_G;
+  }
   if (*pde & 0x00000001) {
     ASSERT(!(*pte & 0x00000001))
     if (!(*pte & 0x00000001)) {
-      *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
+      *pte = (page_phyaddr | pte_flags);
     } else {
       PANIC("pte repeat");
-      *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
+      *pte = (page_phyaddr | pte_flags);
     }
   } else {
     uint32_t pde_phyaddr = (uint32_t)palloc(&kernel_pool);
     *pde = (pde_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
     memset((void*)((int)pte & 0xfffff000), 0, PG_SIZE);
     ASSERT(!(*pte & 0x00000001))
-    *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
+    *pte = (page_phyaddr | pte_flags);
   }
 }
 
@@ -172,31 +181,73 @@ void* malloc_page(enum pool_flags pf, uint32_t pg_cnt) {
   return vaddr_start;
 }
 
+// 申请物理上连续的cnt页内核内存，供要求整块连续的DMA结构使用
+void* get_kernel_pages_contig(uint32_t pg_cnt) {
+  mutex_lock(&kernel_pool.lock);
+  void* vaddr_start = NULL;
+  int bit_idx = bitmap_scan(&kernel_pool.pool_bitmap, pg_cnt);
+  if (bit_idx != -1) {
+    vaddr_start = vaddr_get(PF_KERNEL, pg_cnt);
+  }
+  if (vaddr_start != NULL) {
+    uint32_t vaddr = (uint32_t)vaddr_start, cnt = 0;
+    uint32_t page = kernel_pool.phy_addr_start + bit_idx * PG_SIZE;
+    while (cnt < pg_cnt) {
+      bitmap_set(&kernel_pool.pool_bitmap, bit_idx + cnt++, 1);
+      page_table_add((void*)vaddr, (void*)page);
+      vaddr += PG_SIZE;
+      page += PG_SIZE;
+    }
+    memset(vaddr_start, 0, pg_cnt * PG_SIZE);
+  }
+  mutex_unlock(&kernel_pool.lock);
+  return vaddr_start;
+}
+
+// 把物理地址phy_addr起size字节的设备内存映射到内核空间，映射不经缓存
+void* ioremap(uint32_t phy_addr, uint32_t size) {
+  uint32_t offset = phy_addr & (PG_SIZE - 1);
+  uint32_t pg_cnt = DIV_ROUND_UP(offset + size, PG_SIZE);
+  mutex_lock(&kernel_pool.lock);
+  void* vaddr_start = vaddr_get(PF_KERNEL, pg_cnt);
+  if (vaddr_start != NULL) {
+    uint32_t vaddr = (uint32_t)vaddr_start, page = phy_addr - offset;
+    while (pg_cnt-- > 0) {
+      page_table_add((void*)vaddr, (void*)page);
+      *pte_ptr(vaddr) |= PG_PCD | PG_PWT;
+      vaddr += PG_SIZE;
+      page += PG_SIZE;
+    }
+  }
+  mutex_unlock(&kernel_pool.lock);
+  return vaddr_start == NULL ? NULL : (void*)((uint32_t)vaddr_start + offset);
+}
+
 // 获取cnt页的内核内存空间
 void* get_kernel_pages(uint32_t pg_cnt) {
-  lock_acquire(&kernel_pool.lock);
+  mutex_lock(&kernel_pool.lock);
   void* vaddr = malloc_page(PF_KERNEL, pg_cnt);
   if (vaddr != NULL) {
     memset(vaddr, 0, pg_cnt * PG_SIZE);
   }
-  lock_release(&kernel_pool.lock);
+  mutex_unlock(&kernel_pool.lock);
   return vaddr;
 }
 
 void* get_user_page(uint32_t pg_cnt) {
-  lock_acquire(&user_pool.lock);
+  mutex_lock(&user_pool.lock);
   void* vaddr = malloc_page(PF_USER, pg_cnt);
   if (vaddr != NULL) {
     memset(vaddr, 0, pg_cnt * PG_SIZE);
   }
-  lock_release(&user_pool.lock);
+  mutex_unlock(&user_pool.lock);
   return vaddr;
 }
 
 void* get_a_page(enum pool_flags pf, uint32_t vaddr) {
   struct pool* mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
-  lock_acquire(&mem_pool->lock);
-  struct task_struct* cur = running_thread();
+  mutex_lock(&mem_pool->lock);
+  struct task_struct* cur = proc_of(running_thread());
   int32_t bit_idx = -1;
   if (cur->pgdir != NULL && pf == PF_USER) {
     bit_idx = (vaddr - cur->userprog_vaddr.vaddr_start) / PG_SIZE;
@@ -216,7 +267,7 @@ void* get_a_page(enum pool_flags pf, uint32_t vaddr) {
   //   return NULL;
   // }
   page_table_add((void*)vaddr, page_phyaddr);
-  lock_release(&mem_pool->lock);
+  mutex_unlock(&mem_pool->lock);
   return (void*)vaddr;
 }
 
@@ -225,14 +276,42 @@ uint32_t addr_v2p(uint32_t vaddr) {
   return ((*pte & 0xfffff000) + (vaddr & 0x00000fff));
 }
 
+// 把内核页表项设为全局页并打开CR4.PGE，内核的TLB项在切换地址空间时得以保留。
+// loader建立的0xc0000000处的页表与虚拟地址0处的恒等映射共用，而低端地址
+// 属于用户空间，不能置G位，所以先给高端映射复制一份独立的页表。
+// 0xc0400000以上的内核页表此时还是空的，之后由page_table_add加上G位。
+// 需在创建任何进程页目录之前调用，新页目录会复制到新的页目录项
+static void global_pages_init(void) {
+  uint32_t eax = 1, ebx, ecx, edx;
+  asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+  if (!(edx & CPUID_PGE)) {
+    put_str("  global pages not supported\n");
+    return;
+  }
+  uint32_t* new_pt = malloc_page(PF_KERNEL, 1);
+  ASSERT(new_pt != NULL);
+  uint32_t* old_pt = pte_ptr(0xc0000000);
+  for (uint32_t i = 0; i < 1024; i++) {
+    new_pt[i] = (old_pt[i] & PG_P_1) ? (old_pt[i] | PG_G) : 0;
+  }
+  *pde_ptr(0xc0000000) =
+      addr_v2p((uint32_t)new_pt) | PG_US_U | PG_RW_W | PG_P_1;
+  uint32_t cr3, cr4;
+  asm volatile("movl %%cr3, %0; movl %0, %%cr3" : "=r"(cr3) : : "memory");
+  asm volatile("movl %%cr4, %0" : "=r"(cr4));
+  asm volatile("movl %0, %%cr4" : : "r"(cr4 | CR4_PGE) : "memory");
+  pge_enabled = true;
+}
+
 // 初始化内存
 void mem_init() {
   put_str("  mem_init start\n");
   uint32_t mem_bytes_total = (*(uint32_t*)(0xb00));
   mem_pool_init(mem_bytes_total);
-  lock_init(&user_pool.lock);
-  lock_init(&kernel_pool.lock);
+  mutex_init(&user_pool.lock);
+  mutex_init(&kernel_pool.lock);
   block_desc_init(k_block_descs);
+  global_pages_init();
   put_str("  mem_init done\n");
 }
 
@@ -266,7 +345,7 @@ void* sys_malloc(uint32_t size) {
     PF = PF_USER;
     pool_size = user_pool.phy_size;
     mem_pool = &user_pool;
-    desc = cur->u_block_desc;
+    desc = proc_of(cur)->u_block_desc;
   } else {
     PF = PF_KERNEL;
     pool_size = kernel_pool.phy_size;
@@ -278,7 +357,7 @@ void* sys_malloc(uint32_t size) {
   }
   struct arena* a;
   struct mem_block* b;
-  lock_acquire(&mem_pool->lock);
+  mutex_lock(&mem_pool->lock);
   if (size > 1024) {
     uint32_t pg_cnt = DIV_ROUND_UP(size + sizeof(struct arena), PG_SIZE);
     a = malloc_page(PF, pg_cnt);
@@ -287,10 +366,10 @@ void* sys_malloc(uint32_t size) {
       a->desc = NULL;
       a->cnt = pg_cnt;
       a->large = true;
-      lock_release(&mem_pool->lock);
+      mutex_unlock(&mem_pool->lock);
       return (void*)(a + 1);
     } else {
-      lock_release(&mem_pool->lock);
+      mutex_unlock(&mem_pool->lock);
       return NULL;
     }
   } else {
@@ -303,7 +382,7 @@ void* sys_malloc(uint32_t size) {
     if (list_empty(&desc[desc_index].free_list)) {
       a = malloc_page(PF, 1);
       if (a == NULL) {
-        lock_release(&mem_pool->lock);
+        mutex_unlock(&mem_pool->lock);
         return NULL;
       }
       memset(a, 0, PG_SIZE);
@@ -325,7 +404,7 @@ void* sys_malloc(uint32_t size) {
     memset(b, 0, desc[desc_index].block_size);
     a = block2arena(b);
     a->cnt--;
-    lock_release(&mem_pool->lock);
+    mutex_unlock(&mem_pool->lock);
     return (void*)b;
   }
 }
@@ -357,7 +436,7 @@ static void vaddr_remove(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
       bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 0);
     }
   } else {
-    struct task_struct* cur_thread = running_thread();
+    struct task_struct* cur_thread = proc_of(running_thread());
     bit_idx_start = (vaddr - cur_thread->userprog_vaddr.vaddr_start) / PG_SIZE;
     while (cnt < pg_cnt) {
       bitmap_set(&cur_thread->userprog_vaddr.vaddr_bitmap,
@@ -411,7 +490,7 @@ void sys_free(void* ptr) {
       mem_pool = &user_pool;
       pf = PF_USER;
     }
-    lock_acquire(&mem_pool->lock);
+    mutex_lock(&mem_pool->lock);
     struct mem_block* b = ptr;
     struct arena* a = block2arena(b);
     ASSERT(a->large == 0 || a->large == 1);
@@ -423,26 +502,26 @@ void sys_free(void* ptr) {
         for (int block_cnt = 0; block_cnt < a->desc->blocks_per_arena;
              ++block_cnt) {
           b = arena2block(a, block_cnt);
-          ASSERT(elem_find(&a->desc->free_list, &b->free_elem));
+          ASSERT(elem_linked(&b->free_elem));
           list_remove(&b->free_elem);
         }
         mfree_page(pf, a, 1);
       }
     }
-    lock_release(&mem_pool->lock);
+    mutex_unlock(&mem_pool->lock);
   }
 }
 
 void* get_a_page_without_opvaddrbitmap(enum pool_flags pf, uint32_t vaddr) {
   struct pool* mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
-  lock_acquire(&mem_pool->lock);
+  mutex_lock(&mem_pool->lock);
   void* page_phyaddr = palloc(mem_pool);
   if (page_phyaddr == NULL) {
-    lock_release(&mem_pool->lock);
+    mutex_unlock(&mem_pool->lock);
     return NULL;
   }
   page_table_add((void*)vaddr, page_phyaddr);
-  lock_release(&mem_pool->lock);
+  mutex_unlock(&mem_pool->lock);
   return (void*)vaddr;
 }
 
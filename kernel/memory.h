@@ -12,6 +12,9 @@ enum pool_flags { PF_KERNEL = 1, PF_USER = 2 };
 #define PG_RW_W 2
 #define PG_US_S 0
 #define PG_US_U 4
+#define PG_PWT 0x8   // 写直达
+#define PG_PCD 0x10  // 禁止缓存，用于设备寄存器
+#define PG_G 0x100  // 全局页，切换CR3时TLB项不被刷掉
 
 struct virtual_addr {
   struct bitmap vaddr_bitmap;
@@ -41,6 +44,8 @@ void sys_free(void* ptr);
 void mfree_page(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt);
 void* get_a_page_without_opvaddrbitmap(enum pool_flags pf, uint32_t vaddr);
 void free_a_phy_page(uint32_t pg_phy_addr);
+void* ioremap(uint32_t phy_addr, uint32_t size);
+void* get_kernel_pages_contig(uint32_t pg_cnt);
 struct mem_block {
   struct list_elem free_elem;
 };
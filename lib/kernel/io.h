@@ -13,6 +13,27 @@ static inline void outsw(uint16_t port, const void* addr, uint32_t word_cnt) {
 static inline uint8_t inb(uint16_t port) {
   uint8_t data;
   asm volatile("inb %w1,%b0" : "=a"(data) : "Nd"(port));
+  return data;
+}
+//向对应端口写入一个字
+static inline void outw(uint16_t port, uint16_t data) {
+  asm volatile("outw %w0, %w1" ::"a"(data), "Nd"(port));
+}
+//从对应端口读一个字
+static inline uint16_t inw(uint16_t port) {
+  uint16_t data;
+  asm volatile("inw %w1,%w0" : "=a"(data) : "Nd"(port));
+  return data;
+}
+//向对应端口写入一个双字
+static inline void outl(uint16_t port, uint32_t data) {
+  asm volatile("outl %0, %w1" ::"a"(data), "Nd"(port));
+}
+//从对应端口读一个双字
+static inline uint32_t inl(uint16_t port) {
+  uint32_t data;
+  asm volatile("inl %w1,%0" : "=a"(data) : "Nd"(port));
+  return data;
 }
 //从对应端口读多个字节
 static inline void insw(uint16_t port, void* addr, uint32_t word_cnt) {
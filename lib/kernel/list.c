@@ -31,6 +31,7 @@ void list_remove(struct list_elem* pelem) {
   enum intr_status old_status = intr_disable();
   pelem->prev->next = pelem->next;
   pelem->next->prev = pelem->prev;
+  pelem->prev = pelem->next = NULL;
   intr_set_status(old_status);
 }
 
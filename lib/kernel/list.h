@@ -30,4 +30,9 @@ uint32_t list_len(struct list* plist);
 struct list_elem* list_traversal(struct list* plist, function func, int arg);
 bool elem_find(struct list* plist, struct list_elem* obj_elem);
 
+// 元素被移出链表后prev/next置空，可O(1)判断是否在某个链表中
+static inline bool elem_linked(struct list_elem* elem) {
+  return elem->next != NULL;
+}
+
 #endif 
\ No newline at end of file
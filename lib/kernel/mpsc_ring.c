@@ -0,0 +1,114 @@
+#include "mpsc_ring.h"
+#include "debug.h"
+
+// 原子比较交换，*addr等于old时写入new，返回*addr原来的值
+static inline uint32_t atomic_cmpxchg(volatile uint32_t* addr,
+                                      uint32_t old,
+                                      uint32_t new) {
+  asm volatile("lock cmpxchgl %2, %1"
+               : "+a"(old), "+m"(*addr)
+               : "r"(new)
+               : "memory");
+  return old;
+}
+
+// 生产者会同时修改位图中同一双字的其他位，置位和清位都须加lock
+static inline void committed_set(struct mpsc_ring* ring, uint32_t idx) {
+  asm volatile("lock btsl %1, %0"
+               : "+m"(ring->committed[idx / 32])
+               : "r"(idx % 32)
+               : "memory");
+}
+
+static inline void committed_clear(struct mpsc_ring* ring, uint32_t idx) {
+  asm volatile("lock btrl %1, %0"
+               : "+m"(ring->committed[idx / 32])
+               : "r"(idx % 32)
+               : "memory");
+}
+
+static inline bool committed_test(struct mpsc_ring* ring, uint32_t idx) {
+  return ring->committed[idx / 32] & (1u << (idx % 32));
+}
+
+#define barrier() asm volatile("" ::: "memory")
+
+void mpsc_ring_init(struct mpsc_ring* ring,
+                    void* data,
+                    uint32_t elem_size,
+                    uint32_t* committed,
+                    uint32_t size) {
+  ASSERT(size != 0 && (size & (size - 1)) == 0);
+  ASSERT(elem_size == 1 || elem_size == 4);
+  ring->head = ring->tail = 0;
+  ring->mask = size - 1;
+  ring->elem_size = elem_size;
+  ring->data = data;
+  ring->committed = committed;
+  for (uint32_t i = 0; i < MPSC_RING_MAP_WORDS(size); i++) {
+    committed[i] = 0;
+  }
+}
+
+static inline void slot_write(struct mpsc_ring* ring, uint32_t idx,
+                              uint32_t val) {
+  if (ring->elem_size == 1) {
+    ((uint8_t*)ring->data)[idx] = val;
+  } else {
+    ((uint32_t*)ring->data)[idx] = val;
+  }
+}
+
+static inline uint32_t slot_read(struct mpsc_ring* ring, uint32_t idx) {
+  if (ring->elem_size == 1) {
+    return ((uint8_t*)ring->data)[idx];
+  }
+  return ((uint32_t*)ring->data)[idx];
+}
+
+// 放入一个元素，队列满时返回false。可在任意上下文中调用
+bool mpsc_ring_push(struct mpsc_ring* ring, uint32_t val) {
+  uint32_t head;
+  do {
+    head = ring->head;
+    if (head - ring->tail > ring->mask) {
+      return false;
+    }
+  } while (atomic_cmpxchg(&ring->head, head, head + 1) != head);
+  uint32_t idx = head & ring->mask;
+  slot_write(ring, idx, val);
+  barrier();  // x86不会重排两次写，只需防止编译器重排
+  committed_set(ring, idx);
+  return true;
+}
+
+// 取出队首元素，队首尚未发布时返回false
+bool mpsc_ring_pop(struct mpsc_ring* ring, uint32_t* val) {
+  uint32_t idx = ring->tail & ring->mask;
+  if (!committed_test(ring, idx)) {
+    return false;
+  }
+  barrier();
+  *val = slot_read(ring, idx);
+  committed_clear(ring, idx);  // 先清标志再让出槽位，生产者看到新tail时槽位已空
+  ring->tail++;
+  return true;
+}
+
+// 批量取出最多max个连续已发布的元素，tail只更新一次，返回取出的个数
+uint32_t mpsc_ring_drain(struct mpsc_ring* ring, uint32_t* out, uint32_t max) {
+  uint32_t tail = ring->tail, n = 0;
+  while (n < max) {
+    uint32_t idx = tail & ring->mask;
+    if (!committed_test(ring, idx)) {
+      break;
+    }
+    barrier();
+    out[n++] = slot_read(ring, idx);
+    committed_clear(ring, idx);
+    tail++;
+  }
+  barrier();
+  ring->tail = tail;
+  return n;
+}
@@ -0,0 +1,50 @@
+#ifndef __LIB_KERNEL_MPSC_RING_H
+#define __LIB_KERNEL_MPSC_RING_H
+#include "global.h"
+#include "stdint.h"
+
+// 无锁的多生产者单消费者环形队列，元素为1字节(字符)或4字节(状态码等)。
+// 生产者用cmpxchg抢占head处的槽位，写入数据后再置committed位发布，
+// 全程不关中断，可在中断处理程序中使用；消费者按顺序读取已发布的槽位，
+// 多个消费者之间须自行互斥(关中断或加锁)。下标自由增长，容量须为2的幂。
+// committed是每槽位一位的位图，字符队列的额外开销只有1/8
+struct mpsc_ring {
+  volatile uint32_t head;  // 下一个待申请的槽位，生产者推进
+  volatile uint32_t tail;  // 下一个待读取的槽位，只由消费者推进
+  uint32_t mask;           // 容量-1
+  uint32_t elem_size;      // 1或4
+  void* data;
+  volatile uint32_t* committed;  // 置位表示对应槽位的数据已写好
+};
+
+// size个槽位的committed位图所需的双字数
+#define MPSC_RING_MAP_WORDS(size) (((size) + 31) / 32)
+
+void mpsc_ring_init(struct mpsc_ring* ring,
+                    void* data,
+                    uint32_t elem_size,
+                    uint32_t* committed,
+                    uint32_t size);
+bool mpsc_ring_push(struct mpsc_ring* ring, uint32_t val);
+bool mpsc_ring_pop(struct mpsc_ring* ring, uint32_t* val);
+uint32_t mpsc_ring_drain(struct mpsc_ring* ring, uint32_t* out, uint32_t max);
+
+static inline uint32_t mpsc_ring_capacity(struct mpsc_ring* ring) {
+  return ring->mask + 1;
+}
+
+// 已申请的槽位数，包括尚未发布的
+static inline uint32_t mpsc_ring_count(struct mpsc_ring* ring) {
+  return ring->head - ring->tail;
+}
+
+static inline bool mpsc_ring_full(struct mpsc_ring* ring) {
+  return mpsc_ring_count(ring) > ring->mask;
+}
+
+// 队首槽位是否已发布，消费者调用
+static inline bool mpsc_ring_empty(struct mpsc_ring* ring) {
+  uint32_t idx = ring->tail & ring->mask;
+  return !(ring->committed[idx / 32] & (1u << (idx % 32)));
+}
+#endif
@@ -0,0 +1,116 @@
+#include "pthread.h"
+#include "futex.h"
+#include "syscall.h"
+
+static inline uint32_t atomic_xchg(volatile uint32_t* addr, uint32_t val) {
+  asm volatile("xchgl %0, %1" : "+r"(val), "+m"(*addr) : : "memory");
+  return val;
+}
+
+// 若*addr等于old则改为new，返回*addr原来的值
+static inline uint32_t atomic_cmpxchg(volatile uint32_t* addr,
+                                      uint32_t old,
+                                      uint32_t new) {
+  asm volatile("lock cmpxchgl %2, %1"
+               : "+a"(old), "+m"(*addr)
+               : "r"(new)
+               : "memory");
+  return old;
+}
+
+// 新线程的入口，栈上依次为返回地址(不使用)、start_routine和arg
+static void pthread_start(void* (*start_routine)(void*), void* arg) {
+  pthread_exit(start_routine(arg));
+}
+
+int32_t pthread_create(pthread_t* thread,
+                       void* (*start_routine)(void*),
+                       void* arg) {
+  struct pthread* pt = malloc(sizeof(struct pthread));
+  if (pt == NULL) {
+    return -1;
+  }
+  pt->stack = malloc(PTHREAD_STACK_SIZE);
+  if (pt->stack == NULL) {
+    free(pt);
+    return -1;
+  }
+  uint32_t* sp = (uint32_t*)((uint32_t)pt->stack + PTHREAD_STACK_SIZE);
+  *--sp = (uint32_t)arg;
+  *--sp = (uint32_t)start_routine;
+  *--sp = 0;
+  pt->tid = clone(pthread_start, sp);
+  if (pt->tid == -1) {
+    free(pt->stack);
+    free(pt);
+    return -1;
+  }
+  *thread = pt;
+  return 0;
+}
+
+int32_t pthread_join(pthread_t thread, void** retval) {
+  if (join_thread(thread->tid, retval) == -1) {
+    return -1;
+  }
+  free(thread->stack);
+  free(thread);
+  return 0;
+}
+
+void pthread_exit(void* retval) {
+  exit_thread(retval);
+}
+
+void pthread_mutex_init(pthread_mutex_t* mutex) {
+  mutex->state = 0;
+}
+
+// 无竞争时一次cmpxchg即可拿到锁，不进入内核
+void pthread_mutex_lock(pthread_mutex_t* mutex) {
+  uint32_t c = atomic_cmpxchg(&mutex->state, 0, 1);
+  if (c == 0) {
+    return;
+  }
+  // 有竞争：把状态标成2再睡眠，释放者看到2才会去唤醒
+  if (c != 2) {
+    c = atomic_xchg(&mutex->state, 2);
+  }
+  while (c != 0) {
+    futex((uint32_t*)&mutex->state, FUTEX_WAIT, 2);
+    c = atomic_xchg(&mutex->state, 2);
+  }
+}
+
+int32_t pthread_mutex_trylock(pthread_mutex_t* mutex) {
+  return atomic_cmpxchg(&mutex->state, 0, 1) == 0 ? 0 : -1;
+}
+
+// 只有状态为2(可能有等待者)时才需要系统调用
+void pthread_mutex_unlock(pthread_mutex_t* mutex) {
+  if (atomic_xchg(&mutex->state, 0) == 2) {
+    futex((uint32_t*)&mutex->state, FUTEX_WAKE, 1);
+  }
+}
+
+void pthread_cond_init(pthread_cond_t* cond) {
+  cond->seq = 0;
+}
+
+// 先记下seq再解锁，若期间有signal则seq已变，futex不会睡眠
+void pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex) {
+  uint32_t seq = cond->seq;
+  pthread_mutex_unlock(mutex);
+  futex((uint32_t*)&cond->seq, FUTEX_WAIT, seq);
+  pthread_mutex_lock(mutex);
+}
+
+void pthread_cond_signal(pthread_cond_t* cond) {
+  __sync_fetch_and_add(&cond->seq, 1);
+  futex((uint32_t*)&cond->seq, FUTEX_WAKE, 1);
+}
+
+void pthread_cond_broadcast(pthread_cond_t* cond) {
+  __sync_fetch_and_add(&cond->seq, 1);
+  futex((uint32_t*)&cond->seq, FUTEX_WAKE, 0xffffffff);
+}
@@ -0,0 +1,37 @@
+#ifndef __LIB_USER_PTHREAD_H
+#define __LIB_USER_PTHREAD_H
+#include "stdint.h"
+
+#define PTHREAD_STACK_SIZE 8192
+
+struct pthread {
+  int32_t tid;
+  void* stack;  // malloc出的用户栈，join后释放
+};
+typedef struct pthread* pthread_t;
+
+// 0:未加锁 1:已加锁且无等待者 2:已加锁且可能有等待者
+typedef struct {
+  volatile uint32_t state;
+} pthread_mutex_t;
+
+typedef struct {
+  volatile uint32_t seq;  // 每次signal/broadcast加一，等待者据此判断是否被唤醒过
+} pthread_cond_t;
+
+int32_t pthread_create(pthread_t* thread,
+                       void* (*start_routine)(void*),
+                       void* arg);
+int32_t pthread_join(pthread_t thread, void** retval);
+void pthread_exit(void* retval);
+
+void pthread_mutex_init(pthread_mutex_t* mutex);
+void pthread_mutex_lock(pthread_mutex_t* mutex);
+int32_t pthread_mutex_trylock(pthread_mutex_t* mutex);
+void pthread_mutex_unlock(pthread_mutex_t* mutex);
+
+void pthread_cond_init(pthread_cond_t* cond);
+void pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex);
+void pthread_cond_signal(pthread_cond_t* cond);
+void pthread_cond_broadcast(pthread_cond_t* cond);
+#endif
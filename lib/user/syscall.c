@@ -175,3 +175,83 @@ void help(void)
 {
     _syscall0(SYS_HELP);
 }
+
+/* 创建与当前进程共享地址空间的线程,从entry开始以stack为栈运行 */
+pid_t clone(void* entry, void* stack) {
+  return _syscall2(SYS_CLONE, entry, stack);
+}
+
+/* 结束当前线程,retval留给join_thread */
+void exit_thread(void* retval) {
+  _syscall1(SYS_THREAD_EXIT, retval);
+}
+
+/* 等待线程tid结束并取得其返回值 */
+int32_t join_thread(pid_t tid, void** retval) {
+  return _syscall2(SYS_THREAD_JOIN, tid, retval);
+}
+
+/* 在用户地址uaddr上睡眠或唤醒,见futex.h */
+int32_t futex(uint32_t* uaddr, uint32_t op, uint32_t val) {
+  return _syscall3(SYS_FUTEX, uaddr, op, val);
+}
+
+/* 读取pid对应任务的CPU时间、等待时间和切换次数 */
+int32_t taskstat(pid_t pid, struct task_stat* st) {
+  return _syscall2(SYS_TASKSTAT, pid, st);
+}
+
+/* 读取全局的调度次数和就绪队列等待时间直方图 */
+int32_t schedstat(struct sched_stat* st) {
+  return _syscall1(SYS_SCHEDSTAT, st);
+}
+
+/* 创建调度组或修改已有组的权重,返回组号 */
+int32_t sched_group_create(const char* name, uint32_t weight) {
+  return _syscall2(SYS_SCHED_GROUP_CREATE, name, weight);
+}
+
+/* 把任务pid移入调度组gid */
+int32_t sched_setgroup(pid_t pid, int32_t gid) {
+  return _syscall2(SYS_SCHED_SETGROUP, pid, gid);
+}
+
+/* 设置任务pid允许运行的CPU掩码 */
+int32_t sched_setaffinity(pid_t pid, uint32_t mask) {
+  return _syscall2(SYS_SCHED_SETAFFINITY, pid, mask);
+}
+
+/* 读取任务pid允许运行的CPU掩码 */
+int32_t sched_getaffinity(pid_t pid) {
+  return _syscall1(SYS_SCHED_GETAFFINITY, pid);
+}
+
+/* 读取最多cnt个调度组的信息,返回实际个数 */
+int32_t sched_groups(struct sched_group_info* info, uint32_t cnt) {
+  return _syscall2(SYS_SCHED_GROUPS, info, cnt);
+}
+
+/* 设置任务pid的调度策略及实时优先级或deadline参数 */
+int32_t sched_setattr(pid_t pid, struct sched_attr* attr) {
+  return _syscall2(SYS_SCHED_SETATTR, pid, attr);
+}
+
+/* 读取任务pid的调度策略和参数 */
+int32_t sched_getattr(pid_t pid, struct sched_attr* attr) {
+  return _syscall2(SYS_SCHED_GETATTR, pid, attr);
+}
+
+/* 把缓存中的全部脏块写回磁盘 */
+int32_t sync(void) {
+  return _syscall0(SYS_SYNC);
+}
+
+/* 把文件fd的数据和inode写回磁盘 */
+int32_t fsync(int32_t fd) {
+  return _syscall1(SYS_FSYNC, fd);
+}
+
+/* 格式化未挂载的分区part_name */
+int32_t mkfs(const char* part_name) {
+  return _syscall1(SYS_MKFS, part_name);
+}
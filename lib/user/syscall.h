@@ -3,6 +3,8 @@
 #include "fs.h"
 #include "stdint.h"
 #include "thread.h"
+#include "acct.h"
+#include "sched.h"
 
 enum SYSCALL_NR {
   SYS_GETPID,
@@ -32,7 +34,23 @@ enum SYSCALL_NR {
   SYS_EXIT,
   SYS_PIPE,
   SYS_FD_REDIRECT,
-  SYS_HELP
+  SYS_HELP,
+  SYS_CLONE,
+  SYS_THREAD_EXIT,
+  SYS_THREAD_JOIN,
+  SYS_FUTEX,
+  SYS_TASKSTAT,
+  SYS_SCHEDSTAT,
+  SYS_SCHED_GROUP_CREATE,
+  SYS_SCHED_SETGROUP,
+  SYS_SCHED_SETAFFINITY,
+  SYS_SCHED_GETAFFINITY,
+  SYS_SCHED_GROUPS,
+  SYS_SCHED_SETATTR,
+  SYS_SCHED_GETATTR,
+  SYS_SYNC,
+  SYS_FSYNC,
+  SYS_MKFS
 };
 
 uint32_t getpid(void);
@@ -63,4 +81,20 @@ pid_t wait(int32_t* status);
 int32_t pipe(int32_t pipefd[2]);
 void fd_redirect(uint32_t old_local_fd, uint32_t new_local_fd);
 void help(void);
+pid_t clone(void* entry, void* stack);
+void exit_thread(void* retval);
+int32_t join_thread(pid_t tid, void** retval);
+int32_t futex(uint32_t* uaddr, uint32_t op, uint32_t val);
+int32_t taskstat(pid_t pid, struct task_stat* st);
+int32_t schedstat(struct sched_stat* st);
+int32_t sched_group_create(const char* name, uint32_t weight);
+int32_t sched_setgroup(pid_t pid, int32_t gid);
+int32_t sched_setaffinity(pid_t pid, uint32_t mask);
+int32_t sched_getaffinity(pid_t pid);
+int32_t sched_groups(struct sched_group_info* info, uint32_t cnt);
+int32_t sched_setattr(pid_t pid, struct sched_attr* attr);
+int32_t sched_getattr(pid_t pid, struct sched_attr* attr);
+int32_t sync(void);
+int32_t fsync(int32_t fd);
+int32_t mkfs(const char* part_name);
 #endif
\ No newline at end of file
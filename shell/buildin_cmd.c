@@ -181,12 +181,163 @@ void buildin_ls(uint32_t argc, char** argv) {
   }
 }
 
-void buildin_ps(uint32_t argc, char** argv UNUSED) {
-  if (argc != 1) {
-    printf("ps: no argument support!\n");
+/* ps -l 额外打印就绪队列等待时间直方图 */
+void buildin_ps(uint32_t argc, char** argv) {
+  if (argc > 2 || (argc == 2 && strcmp(argv[1], "-l"))) {
+    printf("ps: only support -l option!\n");
     return;
   }
   ps();
+  if (argc == 2) {
+    struct sched_stat st;
+    schedstat(&st);
+    printf("switches: %d  max latency: %d Kcycles\n", st.nr_switches,
+           (uint32_t)(st.max_latency >> LATENCY_SHIFT));
+    printf("cr3 loads: %d  switch cost: %d cycles\n", st.nr_cr3_loads,
+           st.switch_cycles);
+    uint32_t i = 0;
+    while (i < LATENCY_BUCKETS) {
+      if (st.latency_hist[i] != 0) {
+        printf("  >= %d Kcycles: %d\n", i == 0 ? 0 : 1 << i,
+               st.latency_hist[i]);
+      }
+      i++;
+    }
+  }
+}
+
+/* 把十进制或0x开头的十六进制字符串转成整数,格式不对返回-1 */
+static int32_t str2num(const char* str) {
+  uint32_t base = 10;
+  int32_t num = 0;
+  if (str[0] == '0' && str[1] == 'x') {
+    base = 16;
+    str += 2;
+  }
+  if (*str == 0) {
+    return -1;
+  }
+  while (*str) {
+    int32_t digit;
+    if (*str >= '0' && *str <= '9') {
+      digit = *str - '0';
+    } else if (base == 16 && *str >= 'a' && *str <= 'f') {
+      digit = *str - 'a' + 10;
+    } else {
+      return -1;
+    }
+    num = num * base + digit;
+    str++;
+  }
+  return num;
+}
+
+static void print_sched_attr(int32_t pid) {
+  static char* policy_names[] = {"normal", "fifo", "rr", "deadline"};
+  struct sched_attr attr;
+  if (sched_getattr(pid, &attr) == -1) {
+    printf("sched: no such task %d\n", pid);
+    return;
+  }
+  printf("pid %d policy: %s", pid, policy_names[attr.policy]);
+  if (attr.policy == SCHED_FIFO || attr.policy == SCHED_RR) {
+    printf(" priority %d", attr.rt_priority);
+  } else if (attr.policy == SCHED_DEADLINE) {
+    printf(" runtime %dms deadline %dms period %dms", attr.runtime,
+           attr.deadline, attr.period);
+  }
+  printf("\n");
+}
+
+/* sched命令内建函数:
+ *   sched                        列出所有调度组
+ *   sched group <name> <weight>  创建调度组或修改其权重
+ *   sched attach <pid> <gid>     把任务移入调度组
+ *   sched affinity <pid> [mask]  查看或设置任务的CPU亲和性掩码
+ *   sched policy <pid> [normal | fifo <prio> | rr <prio>]  查看或设置调度策略
+ *   sched deadline <pid> <runtime> <deadline> <period>      设为deadline任务,单位毫秒 */
+void buildin_sched(uint32_t argc, char** argv) {
+  if (argc == 1) {
+    struct sched_group_info info[MAX_SCHED_GROUPS];
+    int32_t cnt = sched_groups(info, MAX_SCHED_GROUPS);
+    printf("GID  WEIGHT  TASKS  VRUNTIME  NAME\n");
+    int32_t i = 0;
+    while (i < cnt) {
+      printf("%d    %d    %d    %x  %s\n", info[i].id, info[i].weight,
+             info[i].nr_tasks, info[i].vruntime, info[i].name);
+      i++;
+    }
+    return;
+  }
+  if (argc == 4 && !strcmp(argv[1], "group")) {
+    int32_t weight = str2num(argv[3]);
+    int32_t gid = weight < 0 ? -1 : sched_group_create(argv[2], weight);
+    if (gid == -1) {
+      printf("sched: create group %s failed\n", argv[2]);
+    } else {
+      printf("group %s: gid %d, weight %d\n", argv[2], gid, weight);
+    }
+  } else if (argc == 4 && !strcmp(argv[1], "attach")) {
+    int32_t pid = str2num(argv[2]);
+    int32_t gid = str2num(argv[3]);
+    if (pid < 0 || gid < 0 || sched_setgroup(pid, gid) == -1) {
+      printf("sched: attach %s to group %s failed\n", argv[2], argv[3]);
+    }
+  } else if ((argc == 3 || argc == 4) && !strcmp(argv[1], "affinity")) {
+    int32_t pid = str2num(argv[2]);
+    if (argc == 4) {
+      int32_t mask = str2num(argv[3]);
+      if (pid < 0 || mask < 0 || sched_setaffinity(pid, mask) == -1) {
+        printf("sched: set affinity of %s failed\n", argv[2]);
+        return;
+      }
+    }
+    int32_t mask = pid < 0 ? -1 : sched_getaffinity(pid);
+    if (mask == -1) {
+      printf("sched: no such task %s\n", argv[2]);
+    } else {
+      printf("pid %d affinity mask: %x\n", pid, mask);
+    }
+  } else if (argc >= 3 && argc <= 5 && !strcmp(argv[1], "policy")) {
+    int32_t pid = str2num(argv[2]);
+    if (argc > 3) {
+      struct sched_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      if (!strcmp(argv[3], "fifo")) {
+        attr.policy = SCHED_FIFO;
+      } else if (!strcmp(argv[3], "rr")) {
+        attr.policy = SCHED_RR;
+      } else if (strcmp(argv[3], "normal")) {
+        printf("sched: unknown policy %s\n", argv[3]);
+        return;
+      }
+      if (attr.policy != SCHED_NORMAL) {
+        attr.rt_priority = argc == 5 ? str2num(argv[4]) : 0;
+      }
+      if (pid < 0 || sched_setattr(pid, &attr) == -1) {
+        printf("sched: set policy of %s failed\n", argv[2]);
+        return;
+      }
+    }
+    print_sched_attr(pid);
+  } else if (argc == 6 && !strcmp(argv[1], "deadline")) {
+    int32_t pid = str2num(argv[2]);
+    struct sched_attr attr;
+    attr.policy = SCHED_DEADLINE;
+    attr.rt_priority = 0;
+    attr.runtime = str2num(argv[3]);
+    attr.deadline = str2num(argv[4]);
+    attr.period = str2num(argv[5]);
+    if (pid < 0 || sched_setattr(pid, &attr) == -1) {
+      printf("sched: invalid parameters or not enough bandwidth\n");
+      return;
+    }
+    print_sched_attr(pid);
+  } else {
+    printf("usage: sched [group <name> <weight> | attach <pid> <gid> | "
+           "affinity <pid> [mask] | policy <pid> [normal|fifo|rr <prio>] | "
+           "deadline <pid> <runtime> <deadline> <period>]\n");
+  }
 }
 
 /* clear命令内建函数 */
@@ -255,6 +406,19 @@ int32_t buildin_rm(uint32_t argc, char** argv) {
   return ret;
 }
 
+/* mkfs命令的内建函数，格式化一个未挂载的分区 */
+int32_t buildin_mkfs(uint32_t argc, char** argv) {
+  int32_t ret = -1;
+  if (argc != 2) {
+    printf("mkfs: only support 1 argument!\n");
+  } else if (mkfs(argv[1]) == 0) {
+    ret = 0;
+  } else {
+    printf("mkfs: format %s failed.\n", argv[1]);
+  }
+  return ret;
+}
+
 /* 显示内建命令列表 */
 void buildin_help(uint32_t argc UNUSED, char **argv UNUSED)
 {
@@ -26,20 +26,10 @@ int32_t sys_pipe(int32_t pipefd[2]){
 }
 
 uint32_t pipe_read(int32_t fd,void* buf,uint32_t count){
-  char* buffer = buf;
-  uint32_t bytes_read = 0;
   uint32_t global_fd = fd_local2global(fd);
-
   struct ioqueue* ioq = (struct ioqueue*)file_table[global_fd].fd_inode;
-
-  uint32_t ioq_len = ioq_length(ioq);
-  uint32_t size = ioq_len > count ? count : ioq_len;
-  while(bytes_read < size){
-    *buffer = ioq_getchar(ioq);
-    buffer++;
-    bytes_read++;
-  }
-  return bytes_read;
+  // 一次批量取走管道中已有的数据
+  return ioq_read(ioq, buf, count);
 }
 
 uint32_t pipe_write(int32_t fd,const void* buf,uint32_t count){
@@ -58,7 +48,7 @@ uint32_t pipe_write(int32_t fd,const void* buf,uint32_t count){
 }
 
 void sys_fd_redirect(uint32_t old_local_fd,uint32_t new_local_fd){
-  struct task_struct* cur = running_thread();
+  struct task_struct* cur = proc_of(running_thread());
   if(new_local_fd < 3){
     cur->fd_table[old_local_fd] = new_local_fd;
   } else {
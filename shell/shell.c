@@ -102,6 +102,8 @@ static void cmd_execute(uint32_t argc, char** argv) {
     buildin_pwd(argc, argv);
   } else if (!strcmp("ps", argv[0])) {
     buildin_ps(argc, argv);
+  } else if (!strcmp("sched", argv[0])) {
+    buildin_sched(argc, argv);
   } else if (!strcmp("clear", argv[0])) {
     buildin_clear(argc, argv);
   } else if (!strcmp("mkdir", argv[0])) {
@@ -110,6 +112,8 @@ static void cmd_execute(uint32_t argc, char** argv) {
     buildin_rmdir(argc, argv);
   } else if (!strcmp("rm", argv[0])) {
     buildin_rm(argc, argv);
+  } else if (!strcmp("mkfs", argv[0])) {
+    buildin_mkfs(argc, argv);
   } else if (!strcmp("help", argv[0])) {
     buildin_help(argc, argv);
   } else {  // 如果是外部命令,需要从磁盘上加载
@@ -0,0 +1,113 @@
+#include "acct.h"
+#include "interrupt.h"
+#include "string.h"
+
+// 每个时钟中断和每次切换时，把上次记账以来的TSC增量计给当前任务：
+// 时钟中断打断的是用户态就记入utime，否则记入stime
+
+static uint64_t acct_stamp;  // 上次记账的TSC
+static struct sched_stat sched_stat;
+static uint64_t switch_stamp;  // 切换开始时的TSC，为0表示没有进行中的切换
+
+static void acct_charge(struct task_struct* cur, bool user_mode) {
+  uint64_t now = rdtsc();
+  uint64_t delta = now - acct_stamp;
+  acct_stamp = now;
+  if (user_mode) {
+    cur->acct.utime += delta;
+  } else {
+    cur->acct.stime += delta;
+  }
+}
+
+// 时钟中断中调用，user_mode表示被打断的是特权级3的代码
+void acct_tick(struct task_struct* cur, bool user_mode) {
+  acct_charge(cur, user_mode);
+}
+
+// 任务进入就绪队列时记下时间，被调度时算出等待了多久
+void acct_enqueue(struct task_struct* pthread) {
+  pthread->acct.ready_stamp = rdtsc();
+}
+
+static uint32_t latency_bucket(uint64_t cycles) {
+  uint32_t bucket = 0;
+  cycles >>= LATENCY_SHIFT;
+  while (cycles > 1 && bucket < LATENCY_BUCKETS - 1) {
+    cycles >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+// schedule在选出next后调用，需关中断
+void acct_switch(struct task_struct* cur, struct task_struct* next) {
+  acct_charge(cur, false);
+  if (cur->status == TASK_READY && cur->acct.involuntary) {
+    cur->acct.nivcsw++;
+  } else if (cur != next) {
+    cur->acct.nvcsw++;
+  }
+  cur->acct.involuntary = false;
+  switch_stamp = 0;
+  if (next != cur) {
+    switch_stamp = acct_stamp;
+    uint64_t wait = acct_stamp - next->acct.ready_stamp;
+    next->acct.wait_time += wait;
+    sched_stat.nr_switches++;
+    sched_stat.latency_hist[latency_bucket(wait)]++;
+    if (wait > sched_stat.max_latency) {
+      sched_stat.max_latency = wait;
+    }
+  }
+}
+
+// 被换下的任务从switch_to返回时调用，统计切换地址空间、FPU和寄存器的开销。
+// 新任务不经过这里，它们的那次切换不计入
+void acct_switch_done(void) {
+  if (switch_stamp == 0) {
+    return;
+  }
+  uint32_t cycles = (uint32_t)(rdtsc() - switch_stamp);
+  switch_stamp = 0;
+  if (sched_stat.switch_cycles == 0) {
+    sched_stat.switch_cycles = cycles;
+  } else {
+    sched_stat.switch_cycles =
+        sched_stat.switch_cycles - (sched_stat.switch_cycles >> 4) +
+        (cycles >> 4);
+  }
+}
+
+void acct_cr3_load(void) {
+  sched_stat.nr_cr3_loads++;
+}
+
+// 读取pid对应任务的统计，任务不存在返回-1
+int32_t sys_taskstat(pid_t pid, struct task_stat* st) {
+  enum intr_status old_status = intr_disable();
+  struct task_struct* pthread = pid2thread(pid);
+  if (pthread == NULL) {
+    intr_set_status(old_status);
+    return -1;
+  }
+  st->pid = pthread->pid;
+  st->ppid = pthread->parent_pid;
+  st->status = pthread->status;
+  memcpy(st->name, pthread->name, TASK_NAME_LEN);
+  st->elapsed_ticks = pthread->elapsed_ticks;
+  st->utime = pthread->acct.utime;
+  st->stime = pthread->acct.stime;
+  st->wait_time = pthread->acct.wait_time;
+  st->nvcsw = pthread->acct.nvcsw;
+  st->nivcsw = pthread->acct.nivcsw;
+  intr_set_status(old_status);
+  return 0;
+}
+
+int32_t sys_schedstat(struct sched_stat* st) {
+  enum intr_status old_status = intr_disable();
+  memcpy(st, &sched_stat, sizeof(struct sched_stat));
+  intr_set_status(old_status);
+  return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef __THREAD_ACCT_H
+#define __THREAD_ACCT_H
+#include "stdint.h"
+#include "thread.h"
+
+// 就绪队列等待时间直方图：第i个桶统计等待了[2^i, 2^(i+1)) K个TSC周期的次数，
+// 第0个桶统计不足2K周期的，最后一个桶包含所有更长的
+#define LATENCY_BUCKETS 16
+#define LATENCY_SHIFT 10
+
+// 通过sys_taskstat导出给用户的任务统计，时间单位均为TSC周期
+struct task_stat {
+  pid_t pid;
+  pid_t ppid;
+  enum task_status status;
+  char name[TASK_NAME_LEN];
+  uint32_t elapsed_ticks;
+  uint64_t utime;
+  uint64_t stime;
+  uint64_t wait_time;
+  uint32_t nvcsw;
+  uint32_t nivcsw;
+};
+
+struct sched_stat {
+  uint32_t nr_switches;
+  uint32_t nr_cr3_loads;   // 实际重载CR3的次数
+  uint32_t switch_cycles;  // 一次任务切换耗费的TSC周期，取指数滑动平均
+  uint64_t max_latency;
+  uint32_t latency_hist[LATENCY_BUCKETS];
+};
+
+static inline uint64_t rdtsc(void) {
+  uint64_t tsc;
+  asm volatile("rdtsc" : "=A"(tsc));
+  return tsc;
+}
+
+void acct_tick(struct task_struct* cur, bool user_mode);
+void acct_enqueue(struct task_struct* pthread);
+void acct_switch(struct task_struct* cur, struct task_struct* next);
+void acct_switch_done(void);
+void acct_cr3_load(void);
+int32_t sys_taskstat(pid_t pid, struct task_stat* st);
+int32_t sys_schedstat(struct sched_stat* st);
+#endif
@@ -0,0 +1,98 @@
+#include "futex.h"
+#include "debug.h"
+#include "global.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "thread.h"
+
+// futex等待者按uaddr所在的物理地址散列到桶中，同一物理字上的等待者
+// 无论来自哪个地址空间都能互相唤醒
+#define FUTEX_HASH_SIZE 32
+
+// 在某个物理字上睡眠的线程，节点位于等待者的内核栈上
+struct futex_q {
+  struct list_elem q_tag;
+  uint32_t key;  // uaddr的物理地址
+  struct task_struct* task;
+};
+
+struct futex_bucket {
+  struct list waiters;
+};
+
+static struct futex_bucket futex_hash[FUTEX_HASH_SIZE];
+
+void futex_init(void) {
+  for (uint32_t i = 0; i < FUTEX_HASH_SIZE; i++) {
+    list_init(&futex_hash[i].waiters);
+  }
+}
+
+static struct futex_bucket* hash_futex(uint32_t key) {
+  return &futex_hash[(key >> 2) % FUTEX_HASH_SIZE];
+}
+
+// 把用户地址转换成物理地址作为键，页不存在时返回0
+static uint32_t futex_key(uint32_t* uaddr) {
+  uint32_t vaddr = (uint32_t)uaddr;
+  if (vaddr >= 0xc0000000 || !(*pde_ptr(vaddr) & PG_P_1) ||
+      !(*pte_ptr(vaddr) & PG_P_1)) {
+    return 0;
+  }
+  return addr_v2p(vaddr);
+}
+
+static int32_t futex_wait(uint32_t* uaddr, uint32_t val) {
+  enum intr_status old_status = intr_disable();
+  uint32_t key = futex_key(uaddr);
+  // 检查与入队之间不会被调度，唤醒者改完值后一定能看到我们
+  if (key == 0 || *uaddr != val) {
+    intr_set_status(old_status);
+    return -1;
+  }
+  struct futex_q q;
+  q.key = key;
+  q.task = running_thread();
+  list_append(&hash_futex(key)->waiters, &q.q_tag);
+  thread_block_killable(&q.q_tag);
+  intr_set_status(old_status);
+  return 0;
+}
+
+static int32_t futex_wake(uint32_t* uaddr, uint32_t nr_wake) {
+  enum intr_status old_status = intr_disable();
+  uint32_t key = futex_key(uaddr);
+  if (key == 0) {
+    intr_set_status(old_status);
+    return -1;
+  }
+  struct list* waiters = &hash_futex(key)->waiters;
+  int32_t woken = 0;
+  struct list_elem* elem = waiters->head.next;
+  while (elem != &waiters->tail && (uint32_t)woken < nr_wake) {
+    struct list_elem* next = elem->next;
+    struct futex_q* q = elem2entry(struct futex_q, q_tag, elem);
+    if (q->key == key) {
+      list_remove(&q->q_tag);
+      thread_unblock(q->task);
+      woken++;
+    }
+    elem = next;
+  }
+  intr_set_status(old_status);
+  return woken;
+}
+
+int32_t sys_futex(uint32_t* uaddr, uint32_t op, uint32_t val) {
+  if (uaddr == NULL || ((uint32_t)uaddr & 3) != 0) {
+    return -1;
+  }
+  switch (op) {
+    case FUTEX_WAIT:
+      return futex_wait(uaddr, val);
+    case FUTEX_WAKE:
+      return futex_wake(uaddr, val);
+    default:
+      return -1;
+  }
+}
@@ -0,0 +1,10 @@
+#ifndef __THREAD_FUTEX_H
+#define __THREAD_FUTEX_H
+#include "stdint.h"
+
+#define FUTEX_WAIT 0  // *uaddr仍等于val时睡眠
+#define FUTEX_WAKE 1  // 唤醒最多val个在uaddr上睡眠的线程
+
+void futex_init(void);
+int32_t sys_futex(uint32_t* uaddr, uint32_t op, uint32_t val);
+#endif
@@ -0,0 +1,630 @@
+#include "sched.h"
+#include "acct.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "string.h"
+#include "timer.h"
+
+// 虚拟时间以1K个TSC周期为单位，32位回绕，比较时取差值的符号
+#define VRUNTIME_SHIFT 10
+// 单次记账的上限，防止乘以权重时溢出
+#define VRUNTIME_DELTA_MAX (1u << 20)
+// 睡眠后醒来的任务/组最多比当前下限少这么多，既照顾交互任务又不让它长期独占CPU
+#define SCHED_WAKEUP_CREDIT 8192
+#define vruntime_before(a, b) ((int32_t)((a) - (b)) < 0)
+
+#define deadline_before(a, b) ((int32_t)((a) - (b)) < 0)
+
+static struct sched_group sched_groups[MAX_SCHED_GROUPS];
+static uint32_t group_min_vruntime;  // 各组vruntime的下限
+static struct list dl_ready;  // 未被限流的deadline任务，按绝对截止时间升序
+static struct list rt_ready[MAX_RT_PRIO];  // 各实时优先级的就绪队列
+static uint32_t dl_total_bw;  // 已接纳的deadline任务的带宽总和
+static bool need_resched;     // 有更该运行的任务，在下一个时钟中断时调度
+
+// 任务权重由优先级折算，默认优先级31约等于SCHED_WEIGHT_DEFAULT
+#define task_weight(pthread) ((uint32_t)(pthread)->priority * 32 + 1)
+
+void sched_init(void) {
+  memset(sched_groups, 0, sizeof(sched_groups));
+  for (int32_t i = 0; i < MAX_SCHED_GROUPS; i++) {
+    sched_groups[i].id = i;
+    list_init(&sched_groups[i].ready);
+  }
+  strcpy(sched_groups[0].name, "root");
+  sched_groups[0].weight = SCHED_WEIGHT_DEFAULT;
+  group_min_vruntime = 0;
+  list_init(&dl_ready);
+  for (int32_t i = 0; i < MAX_RT_PRIO; i++) {
+    list_init(&rt_ready[i]);
+  }
+  dl_total_bw = 0;
+  need_resched = false;
+}
+
+static uint32_t max_vruntime(uint32_t a, uint32_t b) {
+  return vruntime_before(a, b) ? b : a;
+}
+
+// 开始新的周期：补满预算，截止时间从start起算，需关中断
+static void dl_replenish(struct task_struct* pthread, uint32_t start) {
+  pthread->se.dl_period_start = start;
+  pthread->se.dl_abs_deadline = start + pthread->se.dl_deadline;
+  pthread->se.dl_budget = pthread->se.dl_runtime;
+  pthread->se.dl_throttled = false;
+}
+
+// 限流的任务到了下个周期起点，补充预算后重新入队
+static void dl_replenish_timer(struct timer_list* timer) {
+  struct task_struct* pthread = timer->data;
+  enum intr_status old_status = intr_disable();
+  if (pthread->se.policy == SCHED_DEADLINE && pthread->se.dl_throttled) {
+    dl_replenish(pthread, timer->expires);
+    if (pthread->status == TASK_READY &&
+        !elem_linked(&pthread->general_tag)) {
+      sched_enqueue(pthread, 0);
+    }
+  }
+  intr_set_status(old_status);
+}
+
+// 预算用完：本周期剩余时间内不再运行，到下个周期起点再补充
+static void dl_throttle(struct task_struct* pthread) {
+  uint32_t next_period = pthread->se.dl_period_start + pthread->se.dl_period;
+  if (!deadline_before(ticks, next_period)) {
+    dl_replenish(pthread, ticks);
+    return;
+  }
+  pthread->se.dl_throttled = true;
+  add_timer(&pthread->se.dl_timer, next_period);
+}
+
+// 新任务放到所在组当前的下限处，由init_thread调用
+void sched_task_init(struct task_struct* pthread) {
+  pthread->se.group = &sched_groups[0];
+  pthread->se.vruntime = sched_groups[0].min_vruntime;
+  pthread->se.cpus_allowed = CPU_MASK_ALL;
+  pthread->se.exec_start = 0;
+  timer_setup(&pthread->se.dl_timer, dl_replenish_timer, pthread);
+  sched_groups[0].nr_tasks++;
+}
+
+// fork/clone出的任务继承父任务的组、亲和性和实时策略，从组的下限开始，
+// 不继承父任务的欠账；deadline带宽不能复制，子任务回到SCHED_NORMAL
+void sched_fork(struct task_struct* child) {
+  struct sched_group* group = child->se.group;
+  group->nr_tasks++;
+  child->se.vruntime = max_vruntime(child->se.vruntime, group->min_vruntime);
+  child->se.exec_start = 0;
+  timer_setup(&child->se.dl_timer, dl_replenish_timer, child);
+  // 继承来的优先级属于父任务持有的锁，子任务不带走
+  child->se.policy = child->se.base_policy;
+  child->se.rt_priority = child->se.base_rt_priority;
+  child->se.pi_policy = SCHED_NORMAL;
+  child->se.dl_boosted = false;
+  if (child->se.policy == SCHED_DEADLINE) {
+    child->se.policy = child->se.base_policy = SCHED_NORMAL;
+    child->se.dl_bw = 0;
+    child->se.dl_throttled = false;
+  }
+}
+
+// 需关中断
+void sched_exit(struct task_struct* pthread) {
+  ASSERT(pthread->se.group->nr_tasks > 0);
+  pthread->se.group->nr_tasks--;
+  if (pthread->se.base_policy == SCHED_DEADLINE) {
+    del_timer(&pthread->se.dl_timer);
+    dl_total_bw -= pthread->se.dl_bw;
+  }
+}
+
+static uint32_t policy_rank(uint8_t policy) {
+  switch (policy) {
+    case SCHED_DEADLINE:
+      return 3;
+    case SCHED_FIFO:
+    case SCHED_RR:
+      return 2;
+    default:
+      return 1;
+  }
+}
+
+#define class_rank(pthread) policy_rank((pthread)->se.policy)
+
+// deadline队列的排序键，继承来的截止时间优先
+#define dl_key(pthread)                                  \
+  ((pthread)->se.dl_boosted ? (pthread)->se.pi_deadline \
+                            : (pthread)->se.dl_abs_deadline)
+
+// 按调度类、实时优先级、截止时间比较两组调度参数，前者更优先时返回true；
+// 普通任务之间不分先后
+static bool prio_higher(uint8_t policy, uint8_t rt_prio, uint32_t deadline,
+                        uint8_t other_policy, uint8_t other_rt_prio,
+                        uint32_t other_deadline) {
+  uint32_t rank = policy_rank(policy), other_rank = policy_rank(other_policy);
+  if (rank != other_rank) {
+    return rank > other_rank;
+  }
+  if (policy == SCHED_DEADLINE) {
+    return deadline_before(deadline, other_deadline);
+  }
+  if (rank == 2) {
+    return rt_prio > other_rt_prio;
+  }
+  return false;
+}
+
+// a当前的调度参数是否比b更优先
+bool sched_prio_higher(struct task_struct* a, struct task_struct* b) {
+  return prio_higher(a->se.policy, a->se.rt_priority, dl_key(a), b->se.policy,
+                     b->se.rt_priority, dl_key(b));
+}
+
+// 刚就绪的pthread是否应抢占正在运行的cur；普通任务之间不抢占，等时间片用完
+static bool should_preempt(struct task_struct* pthread,
+                           struct task_struct* cur) {
+  if (cur == idle_thread) {
+    return true;
+  }
+  return sched_prio_higher(pthread, cur);
+}
+
+static void dl_insert(struct task_struct* pthread) {
+  struct list_elem* pos = dl_ready.head.next;
+  while (pos != &dl_ready.tail) {
+    struct task_struct* t = elem2entry(struct task_struct, general_tag, pos);
+    if (deadline_before(dl_key(pthread), dl_key(t))) {
+      break;
+    }
+    pos = pos->next;
+  }
+  list_insert_before(pos, &pthread->general_tag);
+}
+
+// 按vruntime升序插入，相等时排在后面，需关中断
+static void group_insert(struct sched_group* group,
+                         struct task_struct* pthread) {
+  struct list_elem* pos = group->ready.head.next;
+  while (pos != &group->ready.tail) {
+    struct task_struct* t = elem2entry(struct task_struct, general_tag, pos);
+    if (vruntime_before(pthread->se.vruntime, t->se.vruntime)) {
+      break;
+    }
+    pos = pos->next;
+  }
+  list_insert_before(pos, &pthread->general_tag);
+}
+
+static void fair_enqueue(struct task_struct* pthread, uint32_t flags) {
+  struct sched_group* group = pthread->se.group;
+  if (flags & ENQUEUE_WAKEUP) {
+    pthread->se.vruntime =
+        max_vruntime(pthread->se.vruntime,
+                     group->min_vruntime - SCHED_WAKEUP_CREDIT);
+  }
+  // 组从空闲变为活跃时同样不能带着太多积蓄回来
+  if (list_empty(&group->ready)) {
+    group->vruntime = max_vruntime(group->vruntime,
+                                   group_min_vruntime - SCHED_WAKEUP_CREDIT);
+  }
+  group_insert(group, pthread);
+}
+
+// 按调度类放入相应的就绪队列，flags见ENQUEUE_*，需关中断
+void sched_enqueue(struct task_struct* pthread, uint32_t flags) {
+  ASSERT(intr_get_status() == INTR_OFF);
+  ASSERT(!elem_linked(&pthread->general_tag));
+  struct list* rt_list = &rt_ready[pthread->se.rt_priority];
+  switch (pthread->se.policy) {
+    case SCHED_DEADLINE:
+      // 睡过了截止时间的任务开始新的周期
+      if ((flags & ENQUEUE_WAKEUP) &&
+          !deadline_before(ticks, pthread->se.dl_abs_deadline)) {
+        dl_replenish(pthread, ticks);
+      }
+      // 限流中的任务由dl_replenish_timer入队
+      if (pthread->se.dl_throttled) {
+        return;
+      }
+      dl_insert(pthread);
+      break;
+    case SCHED_FIFO:
+    case SCHED_RR:
+      // 被抢占的任务回到队首，RR用完时间片的除外
+      if ((flags & ENQUEUE_PREEMPTED) &&
+          !(pthread->se.policy == SCHED_RR && pthread->ticks == 0)) {
+        list_push(rt_list, &pthread->general_tag);
+      } else {
+        list_append(rt_list, &pthread->general_tag);
+      }
+      break;
+    default:
+      fair_enqueue(pthread, flags);
+  }
+  if (!(flags & ENQUEUE_PREEMPTED) &&
+      should_preempt(pthread, running_thread())) {
+    need_resched = true;
+  }
+}
+
+static struct task_struct* fair_pick_next(void) {
+  struct sched_group* best = NULL;
+  for (int32_t i = 0; i < MAX_SCHED_GROUPS; i++) {
+    struct sched_group* group = &sched_groups[i];
+    if (group->weight == 0 || list_empty(&group->ready)) {
+      continue;
+    }
+    if (best == NULL || vruntime_before(group->vruntime, best->vruntime)) {
+      best = group;
+    }
+  }
+  if (best == NULL) {
+    return NULL;
+  }
+  struct list_elem* elem = list_pop(&best->ready);
+  struct task_struct* next = elem2entry(struct task_struct, general_tag, elem);
+  // 只有一个CPU，设置亲和性时已保证掩码包含它
+  ASSERT(next->se.cpus_allowed & 1);
+  best->min_vruntime = max_vruntime(best->min_vruntime, next->se.vruntime);
+  group_min_vruntime = max_vruntime(group_min_vruntime, best->vruntime);
+  return next;
+}
+
+// 依次从deadline、实时、普通调度类中选出下一个任务并出队，没有就绪任务时返回NULL
+struct task_struct* sched_pick_next(void) {
+  ASSERT(intr_get_status() == INTR_OFF);
+  need_resched = false;
+  struct task_struct* next = NULL;
+  if (!list_empty(&dl_ready)) {
+    next = elem2entry(struct task_struct, general_tag, list_pop(&dl_ready));
+  }
+  for (int32_t prio = MAX_RT_PRIO - 1; next == NULL && prio > 0; prio--) {
+    if (!list_empty(&rt_ready[prio])) {
+      next = elem2entry(struct task_struct, general_tag,
+                        list_pop(&rt_ready[prio]));
+    }
+  }
+  if (next == NULL) {
+    next = fair_pick_next();
+  }
+  if (next != NULL) {
+    next->se.exec_start = rdtsc();
+  }
+  return next;
+}
+
+// 时钟中断中调用，返回是否需要重新调度：FIFO不受时间片限制，
+// deadline任务每tick消耗预算，其他任务按ticks轮转
+bool sched_tick(struct task_struct* cur) {
+  switch (cur->se.policy) {
+    case SCHED_FIFO:
+      break;
+    case SCHED_DEADLINE:
+      if (cur->se.dl_boosted) {
+        break;
+      }
+      if (cur->se.dl_budget > 0) {
+        cur->se.dl_budget--;
+      }
+      if (cur->se.dl_budget == 0) {
+        dl_throttle(cur);
+        need_resched = true;
+      }
+      break;
+    default:
+      if (cur->ticks == 0) {
+        need_resched = true;
+      } else {
+        cur->ticks--;
+      }
+  }
+  return need_resched;
+}
+
+// 把当前任务自上次被选中以来的运行时间按权重计入任务和组的vruntime
+void sched_charge(struct task_struct* cur) {
+  if (cur->se.exec_start == 0) {
+    return;
+  }
+  uint32_t delta = (uint32_t)((rdtsc() - cur->se.exec_start) >> VRUNTIME_SHIFT);
+  if (delta > VRUNTIME_DELTA_MAX) {
+    delta = VRUNTIME_DELTA_MAX;
+  }
+  cur->se.exec_start = 0;
+  // 实时和deadline任务不参与组间的公平分配
+  if (cur->se.policy != SCHED_NORMAL) {
+    return;
+  }
+  struct sched_group* group = cur->se.group;
+  cur->se.vruntime += delta * SCHED_WEIGHT_DEFAULT / task_weight(cur);
+  group->vruntime += delta * SCHED_WEIGHT_DEFAULT / group->weight;
+}
+
+// 调度类取自己设置的与继承来的两者中更高的，就绪的任务按新的类重新入队。
+// 从实时或deadline回到普通类时不带回在高类中没有累计的虚拟时间，需关中断
+static void sched_update_prio(struct task_struct* pthread) {
+  struct sched_entity* se = &pthread->se;
+  if (pthread->status == TASK_READY && elem_linked(&pthread->general_tag)) {
+    list_remove(&pthread->general_tag);
+  }
+  uint32_t old_rank = class_rank(pthread);
+  se->policy = se->base_policy;
+  se->rt_priority = se->base_rt_priority;
+  se->dl_boosted = false;
+  if (prio_higher(se->pi_policy, se->pi_rt_priority, se->pi_deadline,
+                  se->base_policy, se->base_rt_priority,
+                  se->dl_abs_deadline)) {
+    se->policy = se->pi_policy;
+    se->rt_priority = se->pi_rt_priority;
+    if (se->policy == SCHED_DEADLINE) {
+      // 持锁期间不因预算耗尽而停下，否则等待者会一起被拖过截止时间
+      se->dl_boosted = true;
+      if (se->dl_throttled) {
+        del_timer(&se->dl_timer);
+        se->dl_throttled = false;
+      }
+    }
+  }
+  if (old_rank != 1 && class_rank(pthread) == 1) {
+    se->vruntime = max_vruntime(se->vruntime, se->group->min_vruntime);
+  }
+  // 原先限流而不在队列中的deadline任务，换类或不再限流后也要入队
+  if (pthread->status == TASK_READY && !elem_linked(&pthread->general_tag)) {
+    sched_enqueue(pthread, 0);
+  } else if (pthread->status == TASK_RUNNING &&
+             class_rank(pthread) < old_rank) {
+    need_resched = true;  // 降级了，让调度器重新选择
+  }
+}
+
+// 优先级继承：pthread持有的锁上最优先的等待者是donor，pthread以两者中
+// 更高的调度类、实时优先级和截止时间运行；donor为NULL时恢复自己的设置。需关中断
+void sched_pi_inherit(struct task_struct* pthread, struct task_struct* donor) {
+  ASSERT(intr_get_status() == INTR_OFF);
+  struct sched_entity* se = &pthread->se;
+  se->pi_policy = SCHED_NORMAL;
+  if (donor != NULL) {
+    se->pi_policy = donor->se.policy;
+    se->pi_rt_priority = donor->se.rt_priority;
+    se->pi_deadline = dl_key(donor);
+  }
+  sched_update_prio(pthread);
+}
+
+// 优先级继承时把就绪的持有者提到所在队列最前面，deadline队列按截止时间重排，需关中断
+void sched_boost(struct task_struct* pthread) {
+  ASSERT(intr_get_status() == INTR_OFF);
+  if (pthread->status != TASK_READY || !elem_linked(&pthread->general_tag)) {
+    return;
+  }
+  list_remove(&pthread->general_tag);
+  if (pthread->se.policy == SCHED_DEADLINE) {
+    dl_insert(pthread);
+    return;
+  }
+  if (pthread->se.policy != SCHED_NORMAL) {
+    list_push(&rt_ready[pthread->se.rt_priority], &pthread->general_tag);
+    return;
+  }
+  struct sched_group* group = pthread->se.group;
+  if (!list_empty(&group->ready)) {
+    struct task_struct* first = elem2entry(struct task_struct, general_tag,
+                                           group->ready.head.next);
+    if (vruntime_before(first->se.vruntime, pthread->se.vruntime)) {
+      pthread->se.vruntime = first->se.vruntime;
+    }
+  }
+  list_push(&group->ready, &pthread->general_tag);
+}
+
+static struct sched_group* name2group(const char* name) {
+  for (int32_t i = 0; i < MAX_SCHED_GROUPS; i++) {
+    if (sched_groups[i].weight != 0 && !strcmp(sched_groups[i].name, name)) {
+      return &sched_groups[i];
+    }
+  }
+  return NULL;
+}
+
+// 创建名为name的调度组，已存在时只修改其权重，返回组号，失败返回-1
+int32_t sys_sched_group_create(const char* name, uint32_t weight) {
+  if (name == NULL || strlen(name) == 0 ||
+      strlen(name) >= SCHED_GROUP_NAME_LEN || weight < SCHED_WEIGHT_MIN ||
+      weight > SCHED_WEIGHT_MAX) {
+    return -1;
+  }
+  enum intr_status old_status = intr_disable();
+  struct sched_group* group = name2group(name);
+  if (group == NULL) {
+    for (int32_t i = 1; i < MAX_SCHED_GROUPS; i++) {
+      if (sched_groups[i].weight == 0) {
+        group = &sched_groups[i];
+        strcpy(group->name, name);
+        group->vruntime = group_min_vruntime;
+        group->min_vruntime = 0;
+        group->nr_tasks = 0;
+        break;
+      }
+    }
+  }
+  if (group == NULL) {
+    intr_set_status(old_status);
+    return -1;
+  }
+  group->weight = weight;
+  intr_set_status(old_status);
+  return group->id;
+}
+
+// 把pid对应的任务移到组gid，就绪的任务会从新组的下限处重新排队
+int32_t sys_sched_setgroup(pid_t pid, int32_t gid) {
+  if (gid < 0 || gid >= MAX_SCHED_GROUPS) {
+    return -1;
+  }
+  enum intr_status old_status = intr_disable();
+  struct task_struct* pthread = pid2thread(pid);
+  struct sched_group* group = &sched_groups[gid];
+  if (pthread == NULL || group->weight == 0) {
+    intr_set_status(old_status);
+    return -1;
+  }
+  struct sched_group* old = pthread->se.group;
+  if (old != group) {
+    bool queued = pthread->status == TASK_READY &&
+                  elem_linked(&pthread->general_tag);
+    if (queued) {
+      list_remove(&pthread->general_tag);
+    }
+    old->nr_tasks--;
+    group->nr_tasks++;
+    pthread->se.group = group;
+    pthread->se.vruntime = group->min_vruntime;
+    if (queued) {
+      sched_enqueue(pthread, 0);
+    }
+  }
+  intr_set_status(old_status);
+  return 0;
+}
+
+// 向上取整，不先加除数以免ms接近上限时溢出
+#define ms2ticks(ms) \
+  ((ms) / mil_seconds_per_intr + ((ms) % mil_seconds_per_intr != 0))
+
+// 检查参数并做deadline准入控制，成功后把pthread切换到新的调度策略
+int32_t sched_setattr_task(struct task_struct* pthread,
+                           struct sched_attr* attr) {
+  uint32_t runtime = 0, deadline = 0, period = 0, bw = 0;
+  switch (attr->policy) {
+    case SCHED_NORMAL:
+      break;
+    case SCHED_FIFO:
+    case SCHED_RR:
+      if (attr->rt_priority == 0 || attr->rt_priority >= MAX_RT_PRIO) {
+        return -1;
+      }
+      break;
+    case SCHED_DEADLINE:
+      // 换算成ticks后再检查，上限和带宽计算都以ticks为单位
+      runtime = ms2ticks(attr->runtime);
+      deadline = ms2ticks(attr->deadline);
+      period = ms2ticks(attr->period);
+      if (runtime == 0 || runtime > deadline || deadline > period ||
+          period > DL_PARAM_MAX) {
+        return -1;
+      }
+      bw = (runtime << DL_BW_SHIFT) / period;
+      break;
+    default:
+      return -1;
+  }
+  if (pthread == idle_thread) {
+    return -1;
+  }
+  enum intr_status old_status = intr_disable();
+  uint32_t old_bw =
+      pthread->se.base_policy == SCHED_DEADLINE ? pthread->se.dl_bw : 0;
+  if (dl_total_bw - old_bw + bw > DL_BW_LIMIT) {
+    intr_set_status(old_status);
+    return -1;
+  }
+  if (pthread->se.base_policy == SCHED_DEADLINE) {
+    del_timer(&pthread->se.dl_timer);
+    pthread->se.dl_throttled = false;
+    pthread->se.dl_bw = 0;
+  }
+  dl_total_bw = dl_total_bw - old_bw + bw;
+  pthread->se.base_policy = attr->policy;
+  pthread->se.base_rt_priority =
+      attr->policy == SCHED_FIFO || attr->policy == SCHED_RR
+          ? attr->rt_priority
+          : 0;
+  if (attr->policy == SCHED_DEADLINE) {
+    pthread->se.dl_runtime = runtime;
+    pthread->se.dl_deadline = deadline;
+    pthread->se.dl_period = period;
+    pthread->se.dl_bw = bw;
+    dl_replenish(pthread, ticks);
+  }
+  // 正在继承优先级时仍取两者中更高的
+  sched_update_prio(pthread);
+  if (pthread->status == TASK_RUNNING) {
+    need_resched = true;  // 可能降级了，让调度器重新选择
+  }
+  intr_set_status(old_status);
+  return 0;
+}
+
+// 查找和修改都在关中断下进行，期间目标线程不会退出
+int32_t sys_sched_setattr(pid_t pid, struct sched_attr* attr) {
+  enum intr_status old_status = intr_disable();
+  struct task_struct* pthread = pid2thread(pid);
+  int32_t ret = -1;
+  if (pthread != NULL && attr != NULL) {
+    ret = sched_setattr_task(pthread, attr);
+  }
+  intr_set_status(old_status);
+  return ret;
+}
+
+int32_t sys_sched_getattr(pid_t pid, struct sched_attr* attr) {
+  enum intr_status old_status = intr_disable();
+  struct task_struct* pthread = pid2thread(pid);
+  if (pthread == NULL || attr == NULL) {
+    intr_set_status(old_status);
+    return -1;
+  }
+  attr->policy = pthread->se.base_policy;
+  attr->rt_priority = pthread->se.base_rt_priority;
+  attr->runtime = pthread->se.dl_runtime * mil_seconds_per_intr;
+  attr->deadline = pthread->se.dl_deadline * mil_seconds_per_intr;
+  attr->period = pthread->se.dl_period * mil_seconds_per_intr;
+  intr_set_status(old_status);
+  return 0;
+}
+
+// 设置允许运行的CPU掩码，掩码中没有在线的CPU时返回-1
+int32_t sys_sched_setaffinity(pid_t pid, uint32_t mask) {
+  if ((mask & CPU_MASK_ALL) == 0) {
+    return -1;
+  }
+  enum intr_status old_status = intr_disable();
+  struct task_struct* pthread = pid2thread(pid);
+  if (pthread == NULL) {
+    intr_set_status(old_status);
+    return -1;
+  }
+  pthread->se.cpus_allowed = mask & CPU_MASK_ALL;
+  intr_set_status(old_status);
+  return 0;
+}
+
+int32_t sys_sched_getaffinity(pid_t pid) {
+  enum intr_status old_status = intr_disable();
+  struct task_struct* pthread = pid2thread(pid);
+  int32_t mask = pthread == NULL ? -1 : (int32_t)pthread->se.cpus_allowed;
+  intr_set_status(old_status);
+  return mask;
+}
+
+// 把最多cnt个调度组的信息复制到info，返回复制的个数
+int32_t sys_sched_groups(struct sched_group_info* info, uint32_t cnt) {
+  uint32_t n = 0;
+  enum intr_status old_status = intr_disable();
+  for (int32_t i = 0; i < MAX_SCHED_GROUPS && n < cnt; i++) {
+    struct sched_group* group = &sched_groups[i];
+    if (group->weight == 0) {
+      continue;
+    }
+    info[n].id = group->id;
+    memcpy(info[n].name, group->name, SCHED_GROUP_NAME_LEN);
+    info[n].weight = group->weight;
+    info[n].vruntime = group->vruntime;
+    info[n].nr_tasks = group->nr_tasks;
+    n++;
+  }
+  intr_set_status(old_status);
+  return n;
+}
@@ -0,0 +1,82 @@
+#ifndef __THREAD_SCHED_H
+#define __THREAD_SCHED_H
+#include "stdint.h"
+#include "list.h"
+#include "thread.h"
+
+// 调度类按优先级从高到低依次为：
+//   SCHED_DEADLINE  按绝对截止时间最早优先(EDF)，每周期有运行预算，准入时检查总带宽
+//   SCHED_FIFO/RR   固定实时优先级，FIFO一直运行到阻塞或让出，RR用完时间片后排到队尾
+//   SCHED_NORMAL    两级公平调度：先在有就绪任务的调度组中选虚拟运行时间最小的组，
+//                   再在组内选虚拟运行时间最小的任务。实际运行时间按权重折算成虚拟
+//                   时间，权重越大虚拟时间走得越慢，得到的CPU份额越多
+
+enum sched_policy { SCHED_NORMAL, SCHED_FIFO, SCHED_RR, SCHED_DEADLINE };
+
+#define MAX_RT_PRIO 32  // 实时优先级范围为1~MAX_RT_PRIO-1
+// deadline任务的带宽用DL_BW_SHIFT位小数的定点数表示，总和不超过95%
+#define DL_BW_SHIFT 16
+#define DL_BW_LIMIT ((95 << DL_BW_SHIFT) / 100)
+#define DL_PARAM_MAX 65535  // 参数换算成ticks后的上限，保证带宽计算不溢出
+
+// sched_enqueue的flags
+#define ENQUEUE_WAKEUP 1     // 刚从睡眠中醒来
+#define ENQUEUE_PREEMPTED 2  // 被抢占的运行中任务，FIFO/RR排回队首
+
+#define MAX_SCHED_GROUPS 8
+#define SCHED_GROUP_NAME_LEN 16
+#define SCHED_WEIGHT_DEFAULT 1024
+#define SCHED_WEIGHT_MIN 1
+#define SCHED_WEIGHT_MAX 65536
+#define NR_CPUS 1
+#define CPU_MASK_ALL ((1u << NR_CPUS) - 1)
+
+struct sched_group {
+  int32_t id;
+  char name[SCHED_GROUP_NAME_LEN];
+  uint32_t weight;
+  uint32_t vruntime;      // 组内所有任务运行时间按组权重折算后的累计
+  uint32_t min_vruntime;  // 组内任务虚拟时间的下限，唤醒的任务不低于它
+  uint32_t nr_tasks;      // 属于本组的任务数(含未就绪的)
+  struct list ready;      // 本组的就绪任务，按vruntime升序，经general_tag链接
+};
+
+// sys_sched_setattr/getattr的参数，时间单位为毫秒
+struct sched_attr {
+  uint32_t policy;
+  uint32_t rt_priority;  // SCHED_FIFO/SCHED_RR
+  uint32_t runtime;      // 以下三项用于SCHED_DEADLINE，须runtime<=deadline<=period
+  uint32_t deadline;
+  uint32_t period;
+};
+
+// 通过sys_sched_groups导出给用户的组信息
+struct sched_group_info {
+  int32_t id;
+  char name[SCHED_GROUP_NAME_LEN];
+  uint32_t weight;
+  uint32_t vruntime;
+  uint32_t nr_tasks;
+};
+
+void sched_init(void);
+void sched_task_init(struct task_struct* pthread);
+void sched_fork(struct task_struct* child);
+void sched_exit(struct task_struct* pthread);
+void sched_enqueue(struct task_struct* pthread, uint32_t flags);
+struct task_struct* sched_pick_next(void);
+void sched_charge(struct task_struct* cur);
+void sched_boost(struct task_struct* pthread);
+bool sched_prio_higher(struct task_struct* a, struct task_struct* b);
+void sched_pi_inherit(struct task_struct* pthread, struct task_struct* donor);
+bool sched_tick(struct task_struct* cur);
+int32_t sched_setattr_task(struct task_struct* pthread,
+                           struct sched_attr* attr);
+int32_t sys_sched_setattr(pid_t pid, struct sched_attr* attr);
+int32_t sys_sched_getattr(pid_t pid, struct sched_attr* attr);
+int32_t sys_sched_group_create(const char* name, uint32_t weight);
+int32_t sys_sched_setgroup(pid_t pid, int32_t gid);
+int32_t sys_sched_setaffinity(pid_t pid, uint32_t mask);
+int32_t sys_sched_getaffinity(pid_t pid);
+int32_t sys_sched_groups(struct sched_group_info* info, uint32_t cnt);
+#endif
@@ -0,0 +1,57 @@
+#include "softirq.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "sched.h"
+#include "thread.h"
+#include "wait_queue.h"
+
+// 中断处理程序只标记pending，耗时的工作交给ksoftirqd线程在开中断下完成
+
+static softirq_action* softirq_vec[NR_SOFTIRQS];
+static volatile uint32_t softirq_pending;
+static struct wait_queue ksoftirqd_wq;
+struct softirq_stat softirq_stat;
+
+void open_softirq(enum softirq_nr nr, softirq_action* action) {
+  ASSERT(nr < NR_SOFTIRQS);
+  softirq_vec[nr] = action;
+}
+
+// 可在中断处理程序中调用
+void raise_softirq(enum softirq_nr nr) {
+  enum intr_status old_status = intr_disable();
+  softirq_pending |= 1 << nr;
+  softirq_stat.raised[nr]++;
+  wake_up_one(&ksoftirqd_wq);
+  intr_set_status(old_status);
+}
+
+static void ksoftirqd(void* arg UNUSED) {
+  while (1) {
+    intr_disable();
+    while (softirq_pending == 0) {
+      wait_queue_sleep(&ksoftirqd_wq);
+    }
+    uint32_t pending = softirq_pending;
+    softirq_pending = 0;
+    intr_enable();
+
+    uint32_t nr = 0;
+    while (nr < NR_SOFTIRQS) {
+      if ((pending & (1 << nr)) && softirq_vec[nr] != NULL) {
+        softirq_stat.handled[nr]++;
+        softirq_vec[nr]();
+      }
+      nr++;
+    }
+  }
+}
+
+void softirq_init(void) {
+  wait_queue_init(&ksoftirqd_wq);
+  struct task_struct* thread = thread_start("ksoftirqd", 31, ksoftirqd, NULL);
+  // 定时器(包括deadline任务的预算补充)在这里执行，不能被实时任务饿死
+  struct sched_attr attr = {.policy = SCHED_FIFO,
+                            .rt_priority = MAX_RT_PRIO - 1};
+  sched_setattr_task(thread, &attr);
+}
@@ -0,0 +1,24 @@
+#ifndef __THREAD_SOFTIRQ_H
+#define __THREAD_SOFTIRQ_H
+#include "stdint.h"
+
+// 软中断号，数值越小越先处理
+enum softirq_nr {
+  TIMER_SOFTIRQ,
+  BLOCK_SOFTIRQ,
+  NR_SOFTIRQS
+};
+
+typedef void softirq_action(void);
+
+struct softirq_stat {
+  uint32_t raised[NR_SOFTIRQS];  // 被触发的次数
+  uint32_t handled[NR_SOFTIRQS]; // 实际处理的次数，多次触发可能合并为一次
+};
+
+extern struct softirq_stat softirq_stat;
+
+void softirq_init(void);
+void open_softirq(enum softirq_nr nr, softirq_action* action);
+void raise_softirq(enum softirq_nr nr);
+#endif
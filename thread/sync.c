@@ -1,54 +1,83 @@
 #include "sync.h"
 #include "debug.h"
 #include "interrupt.h"
+#include "sched.h"
 #include "stdio-kernel.h"
+#include "string.h"
 
-void sema_init(struct semaphore* psema, uint8_t value) {
+#ifdef LOCK_STAT
+#define lock_stat_inc(stat, field) ((stat)->field++)
+#else
+#define lock_stat_inc(stat, field) ((void)0)
+#endif
+
+// 原子交换，返回旧值
+static inline uint32_t atomic_xchg(volatile uint32_t* addr, uint32_t val) {
+  asm volatile("xchgl %0, %1" : "+r"(val), "+m"(*addr) : : "memory");
+  return val;
+}
+
+// 原子加，返回旧值
+static inline uint16_t atomic_xadd16(volatile uint16_t* addr, uint16_t val) {
+  asm volatile("lock xaddw %0, %1" : "+r"(val), "+m"(*addr) : : "memory");
+  return val;
+}
+
+static inline void cpu_relax(void) {
+  asm volatile("pause" ::: "memory");
+}
+
+void sema_init(struct semaphore* psema, uint32_t value) {
   psema->value = value;
-  list_init(&psema->waiters);
+  wait_queue_init(&psema->waiters);
 }
 
 void lock_init(struct lock* plock) {
   plock->holder = NULL;
   plock->holder_repeat_nr = 0;
   sema_init(&plock->semaphore, 1);
+  memset(&plock->stat, 0, sizeof(struct lock_stat));
 }
 
 void sema_down(struct semaphore* psema) {
   enum intr_status old_status = intr_disable();
-  
+
   while (psema->value == 0) {
-    ASSERT(!elem_find(&psema->waiters, &running_thread()->general_tag));
-    if (elem_find(&psema->waiters, &running_thread()->general_tag)) {
-      PANIC("sema_down: thread blocked has been in waiters_list\n");
-    }
-    list_append(&psema->waiters, &running_thread()->general_tag);
-    thread_block(TASK_BLOCKED);
+    wait_queue_sleep(&psema->waiters);
   }
   psema->value--;
-  ASSERT(psema->value == 0);
   intr_set_status(old_status);
 }
 
-void sema_up(struct semaphore* psema) {
+// 不阻塞地尝试获取信号量，成功返回true
+bool sema_try_down(struct semaphore* psema) {
   enum intr_status old_status = intr_disable();
-  ASSERT(psema->value == 0);
-  if (!list_empty(&psema->waiters)) {
-    struct task_struct* thread_blocked =
-        elem2entry(struct task_struct, general_tag, list_pop(&psema->waiters));
-    thread_unblock(thread_blocked);
+  bool ret = false;
+  if (psema->value > 0) {
+    psema->value--;
+    ret = true;
   }
+  intr_set_status(old_status);
+  return ret;
+}
+
+void sema_up(struct semaphore* psema) {
+  enum intr_status old_status = intr_disable();
+  wake_up_one(&psema->waiters);
   psema->value++;
-  ASSERT(psema->value == 1);
   intr_set_status(old_status);
 }
 
 void lock_acquire(struct lock* plock) {
   if (plock->holder != running_thread()) {
+    if (plock->holder != NULL) {
+      lock_stat_inc(&plock->stat, contended);
+    }
     sema_down(&plock->semaphore);
     plock->holder = running_thread();
     ASSERT(plock->holder_repeat_nr == 0);
     plock->holder_repeat_nr = 1;
+    lock_stat_inc(&plock->stat, acquired);
   } else {
     plock->holder_repeat_nr++;
   }
@@ -66,4 +95,266 @@ void lock_release(struct lock* plock) {
   sema_up(&plock->semaphore);
 }
 
+void spin_lock_init(struct spinlock* slock) {
+  slock->locked = 0;
+  slock->holder = NULL;
+  memset(&slock->stat, 0, sizeof(struct lock_stat));
+}
+
+// 关中断后自旋获取锁，返回进入前的中断状态
+enum intr_status spin_lock_irqsave(struct spinlock* slock) {
+  enum intr_status old_status = intr_disable();
+  // 单核下持锁者不会被抢占，若持锁者就是自己说明递归获取，会死锁
+  ASSERT(slock->holder != running_thread());
+  if (atomic_xchg(&slock->locked, 1) != 0) {
+    lock_stat_inc(&slock->stat, contended);
+    do {
+      lock_stat_inc(&slock->stat, spins);
+      cpu_relax();
+    } while (slock->locked != 0 || atomic_xchg(&slock->locked, 1) != 0);
+  }
+  slock->holder = running_thread();
+  lock_stat_inc(&slock->stat, acquired);
+  return old_status;
+}
+
+void spin_unlock_irqrestore(struct spinlock* slock, enum intr_status status) {
+  ASSERT(slock->holder == running_thread());
+  slock->holder = NULL;
+  atomic_xchg(&slock->locked, 0);
+  intr_set_status(status);
+}
+
+void ticket_lock_init(struct ticket_lock* tlock) {
+  tlock->next = 0;
+  tlock->owner = 0;
+  memset(&tlock->stat, 0, sizeof(struct lock_stat));
+}
+
+// 领取一个号并等待叫号，保证先到先得
+enum intr_status ticket_lock_irqsave(struct ticket_lock* tlock) {
+  enum intr_status old_status = intr_disable();
+  uint16_t my_ticket = atomic_xadd16(&tlock->next, 1);
+  if (tlock->owner != my_ticket) {
+    lock_stat_inc(&tlock->stat, contended);
+    while (tlock->owner != my_ticket) {
+      lock_stat_inc(&tlock->stat, spins);
+      cpu_relax();
+    }
+  }
+  lock_stat_inc(&tlock->stat, acquired);
+  return old_status;
+}
+
+void ticket_unlock_irqrestore(struct ticket_lock* tlock,
+                              enum intr_status status) {
+  ASSERT(tlock->owner != tlock->next);
+  atomic_xadd16(&tlock->owner, 1);
+  intr_set_status(status);
+}
+
+// 自旋等待持有者释放的最大次数，超过后转入睡眠
+#define MUTEX_SPIN_MAX 100
+// 优先级继承沿等待链传递的最大深度
+#define MUTEX_PI_DEPTH 8
+
+void mutex_init(struct mutex* mutex) {
+  mutex->owner = NULL;
+  wait_queue_init(&mutex->waiters);
+  memset(&mutex->stat, 0, sizeof(struct lock_stat));
+}
+
+// 将owner及其所等待的锁的持有者的优先级提升到至少与waiter相同，
+// 包括调度类和实时优先级，需关中断调用
+static void mutex_boost(struct task_struct* owner, struct task_struct* waiter) {
+  uint8_t prio = waiter->priority;
+  uint32_t depth = 0;
+  while (owner != NULL && depth++ < MUTEX_PI_DEPTH) {
+    bool boosted = false;
+    if (owner->priority < prio) {
+      owner->priority = prio;
+      if (owner->ticks < prio) {
+        owner->ticks = prio;
+      }
+      boosted = true;
+    }
+    if (sched_prio_higher(waiter, owner)) {
+      sched_pi_inherit(owner, waiter);
+      boosted = true;
+    }
+    if (!boosted) {
+      break;
+    }
+    // 已就绪的持有者移到所在就绪队列的队首，尽快运行完临界区
+    sched_boost(owner);
+    owner = owner->blocked_on != NULL ? owner->blocked_on->owner : NULL;
+  }
+}
+
+// 重新计算pthread的优先级：基础优先级与其持有的锁上所有等待者优先级的最大值，
+// 调度类取自己设置的与最优先的等待者两者中更高的
+static void mutex_restore_priority(struct task_struct* pthread) {
+  uint8_t prio = pthread->base_priority;
+  struct task_struct* donor = NULL;
+  struct list_elem* m_elem = pthread->pi_mutexes.head.next;
+  while (m_elem != &pthread->pi_mutexes.tail) {
+    struct mutex* m = elem2entry(struct mutex, pi_tag, m_elem);
+    struct list_elem* w_elem = m->waiters.waiters.head.next;
+    while (w_elem != &m->waiters.waiters.tail) {
+      struct task_struct* waiter =
+          elem2entry(struct task_struct, general_tag, w_elem);
+      if (waiter->priority > prio) {
+        prio = waiter->priority;
+      }
+      if (donor == NULL || sched_prio_higher(waiter, donor)) {
+        donor = waiter;
+      }
+      w_elem = w_elem->next;
+    }
+    m_elem = m_elem->next;
+  }
+  pthread->priority = prio;
+  sched_pi_inherit(pthread, donor);
+}
 
+void mutex_lock(struct mutex* mutex) {
+  struct task_struct* cur = running_thread();
+  enum intr_status old_status = intr_disable();
+  ASSERT(mutex->owner != cur);
+  if (mutex->owner != NULL) {
+    lock_stat_inc(&mutex->stat, contended);
+    // 持有者正在运行(只可能在另一个CPU上)时开中断自旋一会儿
+    uint32_t spins = 0;
+    while (mutex->owner != NULL && mutex->owner->status == TASK_RUNNING &&
+           spins++ < MUTEX_SPIN_MAX) {
+      lock_stat_inc(&mutex->stat, spins);
+      intr_set_status(old_status);
+      cpu_relax();
+      intr_disable();
+    }
+  }
+  if (mutex->owner == NULL) {
+    mutex->owner = cur;
+  } else {
+    if (wait_queue_empty(&mutex->waiters)) {
+      list_append(&mutex->owner->pi_mutexes, &mutex->pi_tag);
+    }
+    cur->blocked_on = mutex;
+    mutex_boost(mutex->owner, cur);
+    // 释放者会直接把锁交给队首，因此醒来时锁已属于自己
+    while (mutex->owner != cur) {
+      wait_queue_sleep(&mutex->waiters);
+    }
+    cur->blocked_on = NULL;
+  }
+  lock_stat_inc(&mutex->stat, acquired);
+  intr_set_status(old_status);
+}
+
+void mutex_unlock(struct mutex* mutex) {
+  struct task_struct* cur = running_thread();
+  enum intr_status old_status = intr_disable();
+  ASSERT(mutex->owner == cur);
+  if (wait_queue_empty(&mutex->waiters)) {
+    mutex->owner = NULL;
+  } else {
+    list_remove(&mutex->pi_tag);
+    struct task_struct* next = elem2entry(struct task_struct, general_tag,
+                                          list_pop(&mutex->waiters.waiters));
+    mutex->owner = next;
+    if (!wait_queue_empty(&mutex->waiters)) {
+      list_append(&next->pi_mutexes, &mutex->pi_tag);
+      mutex_restore_priority(next);
+    }
+    thread_unblock(next);
+    mutex_restore_priority(cur);
+  }
+  intr_set_status(old_status);
+}
+
+void rwlock_init(struct rwlock* rwlock) {
+  rwlock->readers = 0;
+  rwlock->waiting_writers = 0;
+  rwlock->writer = NULL;
+  wait_queue_init(&rwlock->read_waiters);
+  wait_queue_init(&rwlock->write_waiters);
+  memset(&rwlock->stat, 0, sizeof(struct lock_stat));
+}
+
+// 获取读锁，有写者持有或等待时阻塞，避免写者饥饿
+void read_lock(struct rwlock* rwlock) {
+  enum intr_status old_status = intr_disable();
+  struct task_struct* cur = running_thread();
+  ASSERT(rwlock->writer != cur);
+  if (rwlock->writer != NULL || rwlock->waiting_writers != 0) {
+    lock_stat_inc(&rwlock->stat, contended);
+  }
+  while (rwlock->writer != NULL || rwlock->waiting_writers != 0) {
+    wait_queue_sleep(&rwlock->read_waiters);
+  }
+  rwlock->readers++;
+  lock_stat_inc(&rwlock->stat, acquired);
+  intr_set_status(old_status);
+}
+
+void read_unlock(struct rwlock* rwlock) {
+  enum intr_status old_status = intr_disable();
+  ASSERT(rwlock->readers > 0);
+  if (--rwlock->readers == 0) {
+    wake_up_one(&rwlock->write_waiters);
+  }
+  intr_set_status(old_status);
+}
+
+void write_lock(struct rwlock* rwlock) {
+  enum intr_status old_status = intr_disable();
+  struct task_struct* cur = running_thread();
+  ASSERT(rwlock->writer != cur);
+  if (rwlock->writer != NULL || rwlock->readers != 0) {
+    lock_stat_inc(&rwlock->stat, contended);
+  }
+  rwlock->waiting_writers++;
+  while (rwlock->writer != NULL || rwlock->readers != 0) {
+    wait_queue_sleep(&rwlock->write_waiters);
+  }
+  rwlock->waiting_writers--;
+  rwlock->writer = cur;
+  lock_stat_inc(&rwlock->stat, acquired);
+  intr_set_status(old_status);
+}
+
+// 释放写锁，优先唤醒下一个写者，没有写者时唤醒全部读者
+void write_unlock(struct rwlock* rwlock) {
+  enum intr_status old_status = intr_disable();
+  ASSERT(rwlock->writer == running_thread());
+  rwlock->writer = NULL;
+  if (!wake_up_one(&rwlock->write_waiters)) {
+    wake_up_all(&rwlock->read_waiters);
+  }
+  intr_set_status(old_status);
+}
+
+void cond_init(struct condition* cond) {
+  wait_queue_init(&cond->waiters);
+}
+
+// 释放plock并睡眠，被唤醒后重新获取plock，调用者需在循环中重新检查条件
+void cond_wait(struct condition* cond, struct lock* plock) {
+  ASSERT(plock->holder == running_thread() && plock->holder_repeat_nr == 1);
+  enum intr_status old_status = intr_disable();
+  // 先入队再释放锁，避免错过释放锁与睡眠之间的唤醒
+  ASSERT(!elem_linked(&running_thread()->general_tag));
+  list_append(&cond->waiters.waiters, &running_thread()->general_tag);
+  lock_release(plock);
+  thread_block(TASK_BLOCKED);
+  intr_set_status(old_status);
+  lock_acquire(plock);
+}
+
+void cond_signal(struct condition* cond) {
+  wake_up_one(&cond->waiters);
+}
+
+void cond_broadcast(struct condition* cond) {
+  wake_up_all(&cond->waiters);
+}
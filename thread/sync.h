@@ -3,22 +3,97 @@
 #include "stdint.h"
 #include "list.h"
 #include "thread.h"
+#include "interrupt.h"
+#include "wait_queue.h"
 
+// 锁竞争统计，编译时定义LOCK_STAT后才会累加
+struct lock_stat {
+  uint32_t acquired;   // 成功获取的次数
+  uint32_t contended;  // 获取时锁已被占用的次数
+  uint32_t spins;      // 自旋等待的循环次数
+};
+
+// 计数信号量
 struct semaphore{
-  uint8_t value;
-  struct list waiters;
+  uint32_t value;
+  struct wait_queue waiters;
 };
 
+// 可重入的睡眠锁
 struct lock{
   struct task_struct* holder;
   struct semaphore semaphore;
   uint32_t holder_repeat_nr;
+  struct lock_stat stat;
+};
+
+// 关中断的自旋锁，用于极短的临界区，持有期间不可睡眠
+struct spinlock {
+  volatile uint32_t locked;
+  struct task_struct* holder;
+  struct lock_stat stat;
+};
+
+// 排号自旋锁，按申请顺序获得锁，同样会关中断
+struct ticket_lock {
+  volatile uint16_t next;   // 下一个发放的号
+  volatile uint16_t owner;  // 当前可以进入的号
+  struct lock_stat stat;
+};
+
+// 读写锁，写者优先，适用于读多写少的数据
+struct rwlock {
+  uint32_t readers;          // 当前持有读锁的线程数
+  uint32_t waiting_writers;  // 正在等待的写者数
+  struct task_struct* writer;
+  struct wait_queue read_waiters;
+  struct wait_queue write_waiters;
+  struct lock_stat stat;
 };
 
-void sema_init(struct semaphore* psema, uint8_t value);
+// 自适应互斥锁：持有者在其他CPU上运行时短暂自旋，否则在FIFO队列上睡眠，
+// 等待者会把自己的优先级借给持有者(优先级继承)，不可重入
+struct mutex {
+  struct task_struct* owner;
+  struct wait_queue waiters;   // 按到达顺序排队，释放时直接交给队首
+  struct list_elem pi_tag;     // 有等待者时挂在owner->pi_mutexes上
+  struct lock_stat stat;
+};
+
+// 条件变量，需配合lock使用
+struct condition {
+  struct wait_queue waiters;
+};
+
+void sema_init(struct semaphore* psema, uint32_t value);
 void lock_init(struct lock* plock);
 void sema_down(struct semaphore* psema);
+bool sema_try_down(struct semaphore* psema);
 void sema_up(struct semaphore* psema);
 void lock_acquire(struct lock* plock);
 void lock_release(struct lock* plock);
+
+void spin_lock_init(struct spinlock* slock);
+enum intr_status spin_lock_irqsave(struct spinlock* slock);
+void spin_unlock_irqrestore(struct spinlock* slock, enum intr_status status);
+
+void ticket_lock_init(struct ticket_lock* tlock);
+enum intr_status ticket_lock_irqsave(struct ticket_lock* tlock);
+void ticket_unlock_irqrestore(struct ticket_lock* tlock,
+                              enum intr_status status);
+
+void mutex_init(struct mutex* mutex);
+void mutex_lock(struct mutex* mutex);
+void mutex_unlock(struct mutex* mutex);
+
+void rwlock_init(struct rwlock* rwlock);
+void read_lock(struct rwlock* rwlock);
+void read_unlock(struct rwlock* rwlock);
+void write_lock(struct rwlock* rwlock);
+void write_unlock(struct rwlock* rwlock);
+
+void cond_init(struct condition* cond);
+void cond_wait(struct condition* cond, struct lock* plock);
+void cond_signal(struct condition* cond);
+void cond_broadcast(struct condition* cond);
 #endif
@@ -1,23 +1,24 @@
 #include "thread.h"
 #include "debug.h"
+#include "acct.h"
 #include "file.h"
+#include "fpu.h"
 #include "fs.h"
 #include "global.h"
 #include "interrupt.h"
 #include "print.h"
 #include "process.h"
+#include "sched.h"
 #include "stdint.h"
 #include "stdio.h"
 #include "string.h"
 #include "sync.h"
+#include "wait_exit.h"
 
 #define PG_SIZE 4096
 
 struct task_struct* main_thread;
-struct list thread_ready_list;
 struct list thread_all_list;
-static struct list_elem* thread_tag;
-struct lock pid_lock;
 struct task_struct* idle_thread;
 
 extern void switch_to(struct task_struct* cur, struct task_struct* next);
@@ -28,22 +29,38 @@ uint8_t pid_bitmap_bits[128] = {0};
 struct pid_pool {
   struct bitmap pid_bitmap;
   uint32_t pid_start;
-  struct lock pid_lock;
+  uint32_t next_idx;  // 下次从这里开始找空闲pid，避免刚释放的pid被立即复用
+  struct spinlock pid_lock;
 } pid_pool;
 
+// pid -> task_struct的哈希表，桶内经pid_tag链接
+#define PID_HASH_SIZE 64
+#define pid_hashfn(pid) ((uint32_t)(pid) % PID_HASH_SIZE)
+static struct list pid_hash[PID_HASH_SIZE];
+
+// 从上次分配的位置往后循环查找空闲pid
 static pid_t allocate_pid() {
-  lock_acquire(&pid_pool.pid_lock);
-  int32_t bit_idx = bitmap_scan(&pid_pool.pid_bitmap, 1);
+  enum intr_status old_status = spin_lock_irqsave(&pid_pool.pid_lock);
+  uint32_t bit_cnt = pid_pool.pid_bitmap.btmp_bytes_len * 8;
+  uint32_t bit_idx = pid_pool.next_idx;
+  uint32_t tried = 0;
+  while (bitmap_scan_test(&pid_pool.pid_bitmap, bit_idx)) {
+    if (++tried == bit_cnt) {
+      PANIC("allocate_pid: no free pid\n");
+    }
+    bit_idx = (bit_idx + 1) % bit_cnt;
+  }
   bitmap_set(&pid_pool.pid_bitmap, bit_idx, 1);
-  lock_release(&pid_pool.pid_lock);
+  pid_pool.next_idx = (bit_idx + 1) % bit_cnt;
+  spin_unlock_irqrestore(&pid_pool.pid_lock, old_status);
   return (bit_idx + pid_pool.pid_start);
 }
 
 void release_pid(pid_t pid) {
-  lock_acquire(&pid_pool.pid_lock);
+  enum intr_status old_status = spin_lock_irqsave(&pid_pool.pid_lock);
   int32_t bit_idx = pid - pid_pool.pid_start;
   bitmap_set(&pid_pool.pid_bitmap, bit_idx, 0);
-  lock_release(&pid_pool.pid_lock);
+  spin_unlock_irqrestore(&pid_pool.pid_lock, old_status);
 }
 
 pid_t fork_pid(void) {
@@ -87,9 +104,12 @@ void init_thread(struct task_struct* pthread, char* name, int prio) {
     pthread->status = TASK_READY;
   }
   pthread->priority = prio;
+  pthread->base_priority = prio;
   pthread->ticks = prio;
   pthread->elapsed_ticks = 0;
   pthread->pgdir = NULL;
+  pthread->group_leader = pthread;
+  list_init(&pthread->threads);
   pthread->self_kstack = (uint32_t*)((uint32_t)pthread + PG_SIZE);
   pthread->fd_table[0] = 0;
   pthread->fd_table[1] = 1;
@@ -101,6 +121,14 @@ void init_thread(struct task_struct* pthread, char* name, int prio) {
   }
   pthread->cwd_inode_nr = 0;
   pthread->parent_pid = -1;
+  wait_queue_init(&pthread->child_exit_wq);
+  list_init(&pthread->children);
+  list_init(&pthread->zombies);
+  pthread->blocked_on = NULL;
+  pthread->killed = false;
+  pthread->wait_elem = NULL;
+  list_init(&pthread->pi_mutexes);
+  sched_task_init(pthread);
   pthread->stack_magic = 0x13421342;
 }
 
@@ -111,26 +139,24 @@ struct task_struct* thread_start(char* name,
   struct task_struct* thread = get_kernel_pages(1);
   init_thread(thread, name, prio);
   thread_create(thread, function, func_arg);
-  ASSERT(!(elem_find(&thread_ready_list, &thread->general_tag)));
-  list_append(&thread_ready_list, &thread->general_tag);
-  ASSERT(!(elem_find(&thread_all_list, &thread->all_list_tag)));
-  list_append(&thread_all_list, &thread->all_list_tag);
+  enum intr_status old_status = intr_disable();
+  thread_ready_enqueue(thread);
+  thread_register(thread);
+  intr_set_status(old_status);
   return thread;
 }
 
 static void make_main_thread() {
   main_thread = running_thread();
   init_thread(main_thread, "main", 31);
-  ASSERT(!(elem_find(&thread_all_list, &main_thread->all_list_tag)));
-  list_append(&thread_all_list, &main_thread->all_list_tag);
+  thread_register(main_thread);
 }
 
 void thread_yield() {
   struct task_struct* cur = running_thread();
   enum intr_status old_status = intr_disable();
-  ASSERT(!(elem_find(&thread_ready_list, &cur->general_tag)));
   cur->status = TASK_READY;
-  list_append(&thread_ready_list, &cur->general_tag);
+  thread_ready_enqueue(cur);
   schedule();
   intr_set_status(old_status);
 }
@@ -144,42 +170,54 @@ static void idle(void* arg UNUSED) {
 
 static void pid_pool_init() {
   pid_pool.pid_start = 1;
+  pid_pool.next_idx = 0;
   pid_pool.pid_bitmap.bits = pid_bitmap_bits;
   pid_pool.pid_bitmap.btmp_bytes_len = 128;
   bitmap_init(&pid_pool.pid_bitmap);
-  lock_init(&pid_pool.pid_lock);
+  spin_lock_init(&pid_pool.pid_lock);
+  for (uint32_t i = 0; i < PID_HASH_SIZE; i++) {
+    list_init(&pid_hash[i]);
+  }
 }
 
 void schedule() {
   ASSERT(intr_get_status() == INTR_OFF)
   struct task_struct* cur = running_thread();
+  sched_charge(cur);
   if (cur->status == TASK_RUNNING) {
-    ASSERT(!elem_find(&thread_ready_list, &cur->general_tag));
-    list_append(&thread_ready_list, &cur->general_tag);
-    cur->ticks = cur->priority;
     cur->status = TASK_READY;
-  } else {
+    if (cur != idle_thread) {
+      sched_enqueue(cur, ENQUEUE_PREEMPTED);
+      acct_enqueue(cur);
+    }
+    cur->ticks = cur->priority;
   }
-  if (list_empty(&thread_ready_list)) {
-    thread_unblock(idle_thread);
+  // 没有就绪任务时运行idle，idle从不进入就绪队列
+  struct task_struct* next = sched_pick_next();
+  if (next == NULL) {
+    next = idle_thread;
+    acct_enqueue(next);
   }
-  thread_tag = NULL;
-  thread_tag = list_pop(&thread_ready_list);
-  struct task_struct* next =
-      elem2entry(struct task_struct, general_tag, thread_tag);
   next->status = TASK_RUNNING;
+  acct_switch(cur, next);
   process_activate(next);
+  fpu_switch_prepare(next);
   switch_to(cur, next);
+  acct_switch_done();
 }
 
 void thread_init() {
   put_str("  thread_init start\n");
   list_init(&thread_all_list);
-  list_init(&thread_ready_list);
+  sched_init();
   pid_pool_init();
   process_execute(init, "init");
   make_main_thread();
-  idle_thread = thread_start("idle", 10, idle, NULL);
+  idle_thread = get_kernel_pages(1);
+  init_thread(idle_thread, "idle", 10);
+  thread_create(idle_thread, idle, NULL);
+  idle_thread->status = TASK_BLOCKED;
+  thread_register(idle_thread);
   put_str("  thread_init_done\n");
 }
 
@@ -192,17 +230,42 @@ void thread_block(enum task_status stat) {
   intr_set_status(old_status);
 }
 
+// wait_elem已挂到等待链表后阻塞，线程组退出时reap_group_threads可把它摘下唤醒，
+// 醒来发现被杀死就直接退出。只用于不持有锁的睡眠，需关中断调用
+void thread_block_killable(struct list_elem* wait_elem) {
+  ASSERT(intr_get_status() == INTR_OFF);
+  struct task_struct* cur = running_thread();
+  if (!cur->killed) {
+    cur->wait_elem = wait_elem;
+    thread_block(TASK_BLOCKED);
+    cur->wait_elem = NULL;
+  }
+  if (cur->killed) {
+    if (elem_linked(wait_elem)) {
+      list_remove(wait_elem);
+    }
+    sys_thread_exit(NULL);
+  }
+}
+
+// 把线程放入所在调度组的就绪队列，O(1)检查它不在任何队列上
+void thread_ready_enqueue(struct task_struct* pthread) {
+  ASSERT(!elem_linked(&pthread->general_tag));
+  sched_enqueue(pthread, 0);
+  acct_enqueue(pthread);
+}
+
 void thread_unblock(struct task_struct* pthread) {
   enum intr_status old_status = intr_disable();
   ASSERT((pthread->status == TASK_BLOCKED) ||
          (pthread->status == TASK_HANGING) ||
          (pthread->status == TASK_WAITING));
   if (pthread->status != TASK_READY) {
-    ASSERT(!(elem_find(&thread_ready_list, &pthread->general_tag)));
-    if (elem_find(&thread_ready_list, &pthread->general_tag)) {
+    if (elem_linked(&pthread->general_tag)) {
       PANIC("thread_unblock:block thread in ready_list\n");
     }
-    list_push(&thread_ready_list, &pthread->general_tag);
+    sched_enqueue(pthread, ENQUEUE_WAKEUP);
+    acct_enqueue(pthread);
     pthread->status = TASK_READY;
   }
   intr_set_status(old_status);
@@ -221,6 +284,9 @@ static void pad_print(char* buf, int32_t buf_len, void* ptr, char format) {
     case 'x':
       out_pad_0idx = sprintf(buf, "%x", *((uint32_t*)ptr));
       break;
+    case 'u':
+      out_pad_0idx = sprintf(buf, "%d", *((uint32_t*)ptr));
+      break;
   }
   while (out_pad_0idx < buf_len) {
     buf[out_pad_0idx] = ' ';
@@ -234,34 +300,44 @@ static bool elem2thread_info(struct list_elem* pelem, int arg UNUSED) {
       elem2entry(struct task_struct, all_list_tag, pelem);
   char out_pad[16] = {0};
 
-  pad_print(out_pad, 16, &pthread->pid, 'd');
+  pad_print(out_pad, 7, &pthread->pid, 'd');
 
   if (pthread->parent_pid == -1) {
-    pad_print(out_pad, 16, "NULL", 's');
+    pad_print(out_pad, 7, "NULL", 's');
   } else {
-    pad_print(out_pad, 16, &pthread->parent_pid, 'd');
+    pad_print(out_pad, 7, &pthread->parent_pid, 'd');
   }
 
   switch (pthread->status) {
     case 0:
-      pad_print(out_pad, 16, "RUNNING", 's');
+      pad_print(out_pad, 9, "RUNNING", 's');
       break;
     case 1:
-      pad_print(out_pad, 16, "READY", 's');
+      pad_print(out_pad, 9, "READY", 's');
       break;
     case 2:
-      pad_print(out_pad, 16, "BLOCKED", 's');
+      pad_print(out_pad, 9, "BLOCKED", 's');
       break;
     case 3:
-      pad_print(out_pad, 16, "WAITING", 's');
+      pad_print(out_pad, 9, "WAITING", 's');
       break;
     case 4:
-      pad_print(out_pad, 16, "HANGING", 's');
+      pad_print(out_pad, 9, "HANGING", 's');
       break;
     case 5:
-      pad_print(out_pad, 16, "DIED", 's');
+      pad_print(out_pad, 9, "DIED", 's');
   }
-  pad_print(out_pad, 16, &pthread->elapsed_ticks, 'x');
+  pad_print(out_pad, 8, &pthread->elapsed_ticks, 'u');
+
+  // 时间以2^20个TSC周期为单位显示
+  uint32_t mcycles = (uint32_t)(pthread->acct.utime >> 20);
+  pad_print(out_pad, 8, &mcycles, 'u');
+  mcycles = (uint32_t)(pthread->acct.stime >> 20);
+  pad_print(out_pad, 8, &mcycles, 'u');
+  mcycles = (uint32_t)(pthread->acct.wait_time >> 20);
+  pad_print(out_pad, 8, &mcycles, 'u');
+  pad_print(out_pad, 7, &pthread->acct.nvcsw, 'u');
+  pad_print(out_pad, 7, &pthread->acct.nivcsw, 'u');
 
   memset(out_pad, 0, 16);
   ASSERT(strlen(pthread->name) < 17);
@@ -273,7 +349,7 @@ static bool elem2thread_info(struct list_elem* pelem, int arg UNUSED) {
 
 void sys_ps() {
   char* ps_title =
-      "PID            PPID           STAT           TICKS          COMMAND\n";
+      "PID   PPID  STAT    TICKS  UTIME  STIME  WAIT   VCSW  IVCSW COMMAND\n";
   sys_write(stdout_no, ps_title, strlen(ps_title));
   list_traversal(&thread_all_list, elem2thread_info, 0);
 }
@@ -281,15 +357,30 @@ void sys_ps() {
 void thread_exit(struct task_struct* thread_over, bool need_schedule) {
   intr_disable();
   thread_over->status = TASK_DIED;
+  fpu_release(thread_over);
 
-  if (elem_find(&thread_ready_list, &thread_over->general_tag)) {
+  // 可能还挂在就绪队列或某个等待队列上
+  if (elem_linked(&thread_over->general_tag)) {
     list_remove(&thread_over->general_tag);
   }
-  if (thread_over->pgdir) {
+  sched_exit(thread_over);
+  // 页目录归整个线程组所有，只由主线程释放
+  if (thread_over->pgdir && proc_of(thread_over) == thread_over) {
+    page_dir_release(thread_over->pgdir);
     mfree_page(PF_KERNEL, thread_over->pgdir, 1);
   }
 
   list_remove(&thread_over->all_list_tag);
+  list_remove(&thread_over->pid_tag);
+  if (elem_linked(&thread_over->sibling_tag)) {
+    list_remove(&thread_over->sibling_tag);
+  }
+  if (elem_linked(&thread_over->zombie_tag)) {
+    list_remove(&thread_over->zombie_tag);
+  }
+  if (elem_linked(&thread_over->group_tag)) {
+    list_remove(&thread_over->group_tag);
+  }
   if (thread_over != main_thread) {
     mfree_page(PF_KERNEL, thread_over, 1);
   }
@@ -300,23 +391,31 @@ void thread_exit(struct task_struct* thread_over, bool need_schedule) {
   }
 }
 
-static bool pid_check(struct list_elem* pelem,int32_t pid){
-  struct task_struct* pthread =
-      elem2entry(struct task_struct, all_list_tag, pelem);
-  if(pthread->pid == pid){
-    return true;
+// 把新任务加入thread_all_list和pid哈希表，有父进程时挂到父进程的children上
+void thread_register(struct task_struct* pthread) {
+  enum intr_status old_status = intr_disable();
+  ASSERT(!elem_linked(&pthread->all_list_tag));
+  list_append(&thread_all_list, &pthread->all_list_tag);
+  list_append(&pid_hash[pid_hashfn(pthread->pid)], &pthread->pid_tag);
+  if (pthread->parent_pid != -1 && proc_of(pthread) == pthread) {
+    struct task_struct* parent = pid2thread(pthread->parent_pid);
+    ASSERT(parent != NULL);
+    list_append(&parent->children, &pthread->sibling_tag);
   }
-  return false;
+  intr_set_status(old_status);
 }
 
 struct task_struct* pid2thread(int32_t pid){
-  struct list_elem* pelem = list_traversal(&thread_all_list, pid_check, pid);
-  if(pelem == NULL){
-    return NULL;
+  struct list* bucket = &pid_hash[pid_hashfn(pid)];
+  struct list_elem* pelem = bucket->head.next;
+  while (pelem != &bucket->tail) {
+    struct task_struct* thread = elem2entry(struct task_struct, pid_tag, pelem);
+    if (thread->pid == pid) {
+      return thread;
+    }
+    pelem = pelem->next;
   }
-  struct task_struct* thread =
-      elem2entry(struct task_struct, all_list_tag, pelem);
-  return thread;
+  return NULL;
 }
 
 
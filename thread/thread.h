@@ -3,11 +3,15 @@
 #include "list.h"
 #include "stdint.h"
 #include "bitmap.h"
+#include "wait_queue.h"
+#include "timer.h"
 #include "../kernel/memory.h"
 
 #define MAX_FILES_OPEN_PER_PROC 8
 #define TASK_NAME_LEN 16
 
+struct mutex;
+struct sched_group;
 typedef void thread_func(void*);
 typedef int16_t pid_t;
 
@@ -58,26 +62,86 @@ struct thread_stack {
 };
 
 
+// 记账信息，时间单位为TSC周期
+struct task_acct {
+  uint64_t utime;
+  uint64_t stime;
+  uint64_t wait_time;    // 在就绪队列中等待的总时间
+  uint64_t ready_stamp;  // 最近一次进入就绪队列的时间
+  uint32_t nvcsw;        // 主动让出CPU的次数
+  uint32_t nivcsw;       // 时间片用完被抢占的次数
+  bool involuntary;      // 本次调度是否由时间片耗尽引起
+};
+
+// 调度用的信息，见sched.h
+struct sched_entity {
+  uint8_t policy;              // enum sched_policy，可能经优先级继承提升
+  uint8_t rt_priority;         // 实时优先级，越大越优先
+  uint8_t base_policy;         // 自己设置的策略和实时优先级
+  uint8_t base_rt_priority;
+  uint8_t pi_policy;           // 从等待者继承的策略，SCHED_NORMAL表示没有继承
+  uint8_t pi_rt_priority;
+  uint32_t pi_deadline;        // 继承deadline类时沿用等待者的绝对截止时间
+  bool dl_boosted;             // 正以继承来的deadline参数运行，不消耗预算
+  uint32_t vruntime;           // 按权重折算后的虚拟运行时间
+  uint64_t exec_start;         // 本次被选中运行时的TSC，未在运行时为0
+  struct sched_group* group;   // 所属调度组
+  uint32_t cpus_allowed;       // 允许运行的CPU掩码
+  // SCHED_DEADLINE参数，单位为ticks
+  uint32_t dl_runtime;         // 每个周期的运行预算
+  uint32_t dl_deadline;        // 相对周期起点的截止时间
+  uint32_t dl_period;
+  uint32_t dl_bw;              // 占用的带宽runtime/period，定点数
+  uint32_t dl_budget;          // 本周期剩余预算
+  uint32_t dl_abs_deadline;    // 本周期的绝对截止时间
+  uint32_t dl_period_start;
+  bool dl_throttled;           // 预算耗尽，等待下个周期补充
+  struct timer_list dl_timer;  // 补充预算的定时器
+};
+
 struct task_struct {
   uint32_t* self_kstack;
   pid_t pid;
   enum task_status status;
   uint8_t priority;
+  uint8_t base_priority;  // 未经优先级继承提升的优先级
   char name[16];
   uint8_t ticks;
-  uint8_t elapsed_ticks;
+  uint32_t elapsed_ticks;
+  struct task_acct acct;
+  struct sched_entity se;
   uint32_t fd_table[MAX_FILES_OPEN_PER_PROC];
   struct list_elem general_tag;
   struct list_elem all_list_tag;
+  struct list_elem pid_tag;  // pid哈希桶中的节点
   uint32_t* pgdir;
+  // 线程组的主线程，fd_table、u_block_desc、userprog_vaddr以它的为准
+  struct task_struct* group_leader;
+  struct list threads;         // 主线程上：clone出的其他线程，经group_tag链接
+  struct list_elem group_tag;
+  void* thread_retval;         // sys_thread_exit的返回值，供join取走
   struct virtual_addr userprog_vaddr;
   struct mem_block_desc u_block_desc[DESC_CNT];
   uint32_t cwd_inode_nr;
   pid_t parent_pid;
   int8_t exit_status;
+  struct wait_queue child_exit_wq;  // sys_wait在此等待子进程退出
+  struct list children;             // 所有子进程，经sibling_tag链接
+  struct list_elem sibling_tag;
+  struct list zombies;              // 已退出待回收的子进程，经zombie_tag链接
+  struct list_elem zombie_tag;
+  struct mutex* blocked_on;  // 正在等待的互斥锁
+  struct list pi_mutexes;    // 持有且有等待者的互斥锁，用于计算继承的优先级
+  bool killed;               // 所在线程组正在退出，须尽快自行退出
+  struct list_elem* wait_elem;  // 可中断睡眠时挂在等待链表上的节点
+  // FPU/SSE状态保存区，第一次用FPU时分配一页，NULL表示还没用过
+  void* fpu_area;
   uint32_t stack_magic;
 };
-extern struct list thread_ready_list;
+// 取线程所属进程(线程组主线程)，进程级资源都通过它访问
+#define proc_of(pthread) ((pthread)->group_leader)
+
+extern struct task_struct* idle_thread;
 extern struct list thread_all_list;
 void thread_create(struct task_struct* pthread,
                    thread_func function,
@@ -92,10 +156,13 @@ void schedule(void);
 void thread_init(void);
 void thread_block(enum task_status stat);
 void thread_unblock(struct task_struct* pthread);
+void thread_block_killable(struct list_elem* wait_elem);
+void thread_ready_enqueue(struct task_struct* pthread);
 void thread_yield(void);
 pid_t fork_pid(void);
 void sys_ps(void);
 void thread_exit(struct task_struct* thread_over, bool need_schedule);
 struct task_struct* pid2thread(int32_t pid);
 void release_pid(pid_t pid);
+void thread_register(struct task_struct* pthread);
 #endif
\ No newline at end of file
@@ -0,0 +1,55 @@
+#include "wait_queue.h"
+#include "debug.h"
+#include "thread.h"
+
+void wait_queue_init(struct wait_queue* wq) {
+  list_init(&wq->waiters);
+}
+
+bool wait_queue_empty(struct wait_queue* wq) {
+  return list_empty(&wq->waiters);
+}
+
+// 把当前线程挂到wq上并阻塞，需关中断调用，醒来后由调用者重新检查条件
+void wait_queue_sleep(struct wait_queue* wq) {
+  ASSERT(intr_get_status() == INTR_OFF);
+  struct task_struct* cur = running_thread();
+  ASSERT(!elem_linked(&cur->general_tag));
+  list_append(&wq->waiters, &cur->general_tag);
+  thread_block(TASK_BLOCKED);
+}
+
+// 同wait_queue_sleep，但线程组退出时会被唤醒并直接退出，只用于不持有锁的等待
+void wait_queue_sleep_killable(struct wait_queue* wq) {
+  ASSERT(intr_get_status() == INTR_OFF);
+  struct task_struct* cur = running_thread();
+  ASSERT(!elem_linked(&cur->general_tag));
+  list_append(&wq->waiters, &cur->general_tag);
+  thread_block_killable(&cur->general_tag);
+}
+
+// 唤醒队首的线程，队列为空时返回false
+bool wake_up_one(struct wait_queue* wq) {
+  enum intr_status old_status = intr_disable();
+  bool woken = false;
+  if (!list_empty(&wq->waiters)) {
+    thread_unblock(
+        elem2entry(struct task_struct, general_tag, list_pop(&wq->waiters)));
+    woken = true;
+  }
+  intr_set_status(old_status);
+  return woken;
+}
+
+// 唤醒全部等待者，返回唤醒的个数
+uint32_t wake_up_all(struct wait_queue* wq) {
+  enum intr_status old_status = intr_disable();
+  uint32_t cnt = 0;
+  while (!list_empty(&wq->waiters)) {
+    thread_unblock(
+        elem2entry(struct task_struct, general_tag, list_pop(&wq->waiters)));
+    cnt++;
+  }
+  intr_set_status(old_status);
+  return cnt;
+}
@@ -0,0 +1,29 @@
+#ifndef __THREAD_WAIT_QUEUE_H
+#define __THREAD_WAIT_QUEUE_H
+#include "stdint.h"
+#include "list.h"
+#include "interrupt.h"
+
+// 等待队列，线程通过general_tag挂在waiters上，按到达顺序唤醒
+struct wait_queue {
+  struct list waiters;
+};
+
+void wait_queue_init(struct wait_queue* wq);
+bool wait_queue_empty(struct wait_queue* wq);
+void wait_queue_sleep(struct wait_queue* wq);
+void wait_queue_sleep_killable(struct wait_queue* wq);
+bool wake_up_one(struct wait_queue* wq);
+uint32_t wake_up_all(struct wait_queue* wq);
+
+// 在wq上睡眠直到condition成立，condition在关中断下求值
+#define wait_event(wq, condition)                     \
+  do {                                                \
+    enum intr_status __old_status = intr_disable();   \
+    while (!(condition)) {                            \
+      wait_queue_sleep(wq);                           \
+    }                                                 \
+    intr_set_status(__old_status);                    \
+  } while (0)
+
+#endif
@@ -0,0 +1,135 @@
+#include "workqueue.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "print.h"
+#include "stdio-kernel.h"
+#include "string.h"
+#include "thread.h"
+
+struct workqueue* system_wq;
+static struct list workqueue_list;  // 所有工作队列，用于打印统计
+
+static void worker_thread(void* arg) {
+  struct workqueue* wq = arg;
+  while (1) {
+    intr_disable();
+    while (list_empty(&wq->works)) {
+      wait_queue_sleep(&wq->idle_workers);
+    }
+    struct work_struct* work =
+        elem2entry(struct work_struct, work_tag, list_pop(&wq->works));
+    work->pending = false;
+    wq->nr_pending--;
+    wq->nr_active++;
+    intr_enable();
+
+    work->func(work);
+
+    intr_disable();
+    wq->nr_active--;
+    wq->stat.executed++;
+    intr_enable();
+  }
+}
+
+// 创建工作队列并启动max_workers个工作线程
+struct workqueue* create_workqueue(const char* name, uint32_t max_workers) {
+  ASSERT(strlen(name) < WQ_NAME_LEN);
+  ASSERT(max_workers > 0 && max_workers <= WQ_MAX_WORKERS);
+  struct workqueue* wq = sys_malloc(sizeof(struct workqueue));
+  if (wq == NULL) {
+    return NULL;
+  }
+  memset(wq, 0, sizeof(struct workqueue));
+  strcpy(wq->name, name);
+  list_init(&wq->works);
+  wait_queue_init(&wq->idle_workers);
+  wq->nr_workers = max_workers;
+  uint32_t i = 0;
+  while (i < max_workers) {
+    thread_start(wq->name, 31, worker_thread, wq);
+    i++;
+  }
+  enum intr_status old_status = intr_disable();
+  list_append(&workqueue_list, &wq->wq_tag);
+  intr_set_status(old_status);
+  return wq;
+}
+
+void init_work(struct work_struct* work, work_func* func) {
+  work->work_tag.prev = work->work_tag.next = NULL;
+  work->func = func;
+  work->pending = false;
+}
+
+// 工作入队并唤醒一个空闲工作线程，已在队列中时返回false，可在中断中调用
+bool queue_work(struct workqueue* wq, struct work_struct* work) {
+  enum intr_status old_status = intr_disable();
+  if (work->pending) {
+    intr_set_status(old_status);
+    return false;
+  }
+  work->pending = true;
+  list_append(&wq->works, &work->work_tag);
+  wq->stat.queued++;
+  if (++wq->nr_pending > wq->stat.max_pending) {
+    wq->stat.max_pending = wq->nr_pending;
+  }
+  wake_up_one(&wq->idle_workers);
+  intr_set_status(old_status);
+  return true;
+}
+
+static void delayed_work_timer_fn(struct timer_list* timer) {
+  struct delayed_work* dwork = timer->data;
+  dwork->wq->stat.delayed++;
+  queue_work(dwork->wq, &dwork->work);
+}
+
+void init_delayed_work(struct delayed_work* dwork, work_func* func) {
+  init_work(&dwork->work, func);
+  timer_setup(&dwork->timer, delayed_work_timer_fn, dwork);
+  dwork->wq = NULL;
+}
+
+// delay_ticks个时钟周期后再入队，定时器已在等待或工作已入队时返回false
+bool queue_delayed_work(struct workqueue* wq,
+                        struct delayed_work* dwork,
+                        uint32_t delay_ticks) {
+  if (delay_ticks == 0) {
+    return queue_work(wq, &dwork->work);
+  }
+  enum intr_status old_status = intr_disable();
+  if (dwork->work.pending || timer_pending(&dwork->timer)) {
+    intr_set_status(old_status);
+    return false;
+  }
+  dwork->wq = wq;
+  add_timer(&dwork->timer, ticks + delay_ticks);
+  intr_set_status(old_status);
+  return true;
+}
+
+bool cancel_delayed_work(struct delayed_work* dwork) {
+  return del_timer(&dwork->timer);
+}
+
+void workqueue_print_stats(void) {
+  printk("NAME            WORKERS ACTIVE PENDING QUEUED EXECUTED DELAYED MAXPEND\n");
+  struct list_elem* elem = workqueue_list.head.next;
+  while (elem != &workqueue_list.tail) {
+    struct workqueue* wq = elem2entry(struct workqueue, wq_tag, elem);
+    printk("%s %d %d %d %d %d %d %d\n", wq->name, wq->nr_workers,
+           wq->nr_active, wq->nr_pending, wq->stat.queued, wq->stat.executed,
+           wq->stat.delayed, wq->stat.max_pending);
+    elem = elem->next;
+  }
+}
+
+void workqueue_init(void) {
+  put_str("  workqueue_init start\n");
+  list_init(&workqueue_list);
+  system_wq = create_workqueue("events", 2);
+  put_str("  workqueue_init done\n");
+}
@@ -0,0 +1,57 @@
+#ifndef __THREAD_WORKQUEUE_H
+#define __THREAD_WORKQUEUE_H
+#include "stdint.h"
+#include "list.h"
+#include "timer.h"
+#include "wait_queue.h"
+
+#define WQ_NAME_LEN 16
+#define WQ_MAX_WORKERS 4
+
+struct work_struct;
+typedef void work_func(struct work_struct* work);
+
+struct work_struct {
+  struct list_elem work_tag;
+  work_func* func;
+  bool pending;  // 已入队尚未开始执行
+};
+
+struct delayed_work {
+  struct work_struct work;
+  struct timer_list timer;
+  struct workqueue* wq;
+};
+
+struct wq_stat {
+  uint32_t queued;       // 入队次数
+  uint32_t executed;     // 执行完毕的次数
+  uint32_t delayed;      // 经定时器延迟入队的次数
+  uint32_t max_pending;  // 队列中积压的最大工作数
+};
+
+// 工作队列，由固定数量的常驻工作线程处理，并发数不超过工作线程数
+struct workqueue {
+  char name[WQ_NAME_LEN];
+  struct list works;
+  struct wait_queue idle_workers;
+  uint32_t nr_workers;
+  uint32_t nr_active;   // 正在执行工作的线程数
+  uint32_t nr_pending;  // 排队中的工作数
+  struct wq_stat stat;
+  struct list_elem wq_tag;
+};
+
+extern struct workqueue* system_wq;
+
+void workqueue_init(void);
+struct workqueue* create_workqueue(const char* name, uint32_t max_workers);
+void init_work(struct work_struct* work, work_func* func);
+void init_delayed_work(struct delayed_work* dwork, work_func* func);
+bool queue_work(struct workqueue* wq, struct work_struct* work);
+bool queue_delayed_work(struct workqueue* wq,
+                        struct delayed_work* dwork,
+                        uint32_t delay_ticks);
+bool cancel_delayed_work(struct delayed_work* dwork);
+void workqueue_print_stats(void);
+#endif
@@ -1,5 +1,6 @@
 #include "exec.h"
 #include "memory.h"
+#include "fpu.h"
 #include "fs.h"
 #include "global.h"
 #include "string.h"
@@ -131,6 +132,11 @@ done:
 }
 
 int32_t sys_execv(const char* path,const char* argv[]){
+  // 还有其他线程共享地址空间时不能替换映像
+  struct task_struct* caller = running_thread();
+  if (proc_of(caller) != caller || !list_empty(&caller->threads)) {
+    return -1;
+  }
   uint32_t argc = 0;
   while(argv[argc]){
     argc++;
@@ -140,6 +146,7 @@ int32_t sys_execv(const char* path,const char* argv[]){
     return -1;
   }
   struct task_struct* cur = running_thread();
+  fpu_release(cur);
   memcpy(cur->name, path,TASK_NAME_LEN);
   cur->name[TASK_NAME_LEN - 1] = 0;
   struct intr_stack* intr_0_stack =
@@ -1,23 +1,48 @@
 #include "fork.h"
 #include "file.h"
+#include "fpu.h"
 #include "interrupt.h"
 #include "pipe.h"
 #include "process.h"
+#include "sched.h"
 #include "string.h"
 #include "thread.h"
 
 extern void intr_exit();
 
-static int32_t copy_pcb_vaddrbitmap_stack0(struct task_struct* child_thread,
-                                           struct task_struct* parent_thread) {
+// 复制父线程的PCB和0级栈，并重置不能继承的字段
+static void copy_pcb_stack0(struct task_struct* child_thread,
+                            struct task_struct* parent_thread) {
   memcpy(child_thread, parent_thread, PG_SIZE);
   child_thread->pid = fork_pid();
   child_thread->elapsed_ticks = 0;
+  memset(&child_thread->acct, 0, sizeof(struct task_acct));
   child_thread->status = TASK_READY;
+  child_thread->priority = child_thread->base_priority;
   child_thread->ticks = child_thread->priority;
+  child_thread->blocked_on = NULL;
+  child_thread->killed = false;
+  child_thread->wait_elem = NULL;
+  list_init(&child_thread->pi_mutexes);
+  wait_queue_init(&child_thread->child_exit_wq);
+  list_init(&child_thread->children);
+  list_init(&child_thread->zombies);
   child_thread->parent_pid = parent_thread->pid;
   child_thread->general_tag.next = child_thread->general_tag.prev = NULL;
   child_thread->all_list_tag.next = child_thread->all_list_tag.prev = NULL;
+  child_thread->pid_tag.next = child_thread->pid_tag.prev = NULL;
+  child_thread->sibling_tag.next = child_thread->sibling_tag.prev = NULL;
+  child_thread->zombie_tag.next = child_thread->zombie_tag.prev = NULL;
+  child_thread->group_leader = child_thread;
+  list_init(&child_thread->threads);
+  child_thread->group_tag.next = child_thread->group_tag.prev = NULL;
+  child_thread->thread_retval = NULL;
+  sched_fork(child_thread);
+}
+
+static int32_t copy_pcb_vaddrbitmap_stack0(struct task_struct* child_thread,
+                                           struct task_struct* parent_thread) {
+  copy_pcb_stack0(child_thread, parent_thread);
   block_desc_init(child_thread->u_block_desc);
 
   uint32_t bitmap_pg_cnt =
@@ -113,6 +138,10 @@ static int32_t copy_process(struct task_struct* child_thread,
     return -1;
   }
 
+  if (fpu_copy(child_thread, parent_thread) == -1) {
+    return -1;
+  }
+
   child_thread->pgdir = create_page_dir();
   if (child_thread->pgdir == NULL) {
     return -1;
@@ -130,6 +159,10 @@ static int32_t copy_process(struct task_struct* child_thread,
 
 pid_t sys_fork() {
   struct task_struct* parent_thread = running_thread();
+  // 多线程进程只允许主线程fork，fd_table等进程资源都在主线程PCB中
+  if (proc_of(parent_thread) != parent_thread) {
+    return -1;
+  }
   struct task_struct* child_thread = get_kernel_pages(1);
 
   if (child_thread == NULL) {
@@ -139,9 +172,38 @@ pid_t sys_fork() {
   if (copy_process(child_thread, parent_thread) == -1) {
     return -1;
   }
-  ASSERT(!elem_find(&thread_ready_list, &child_thread->general_tag));
-  list_append(&thread_ready_list, &child_thread->general_tag);
-  ASSERT(!elem_find(&thread_all_list, &child_thread->all_list_tag));
-  list_append(&thread_all_list, &child_thread->all_list_tag);
+  thread_ready_enqueue(child_thread);
+  thread_register(child_thread);
+  return child_thread->pid;
+}
+// 创建与当前进程共享地址空间、文件和堆的线程，新线程以stack为用户栈从entry开始运行
+pid_t sys_clone(void* entry, void* stack) {
+  struct task_struct* parent_thread = running_thread();
+  struct task_struct* leader = proc_of(parent_thread);
+  if (parent_thread->pgdir == NULL || entry == NULL || stack == NULL) {
+    return -1;
+  }
+  struct task_struct* child_thread = get_kernel_pages(1);
+  if (child_thread == NULL) {
+    return -1;
+  }
+  ASSERT(INTR_OFF == intr_get_status());
+  copy_pcb_stack0(child_thread, parent_thread);
+  if (fpu_copy(child_thread, parent_thread) == -1) {
+    mfree_page(PF_KERNEL, child_thread, 1);
+    return -1;
+  }
+  child_thread->group_leader = leader;
+
+  struct intr_stack* intr_0_stack =
+      (struct intr_stack*)((uint32_t)child_thread + PG_SIZE -
+                           sizeof(struct intr_stack));
+  intr_0_stack->eip = entry;
+  intr_0_stack->esp = stack;
+  build_child_stack(child_thread);
+
+  list_append(&leader->threads, &child_thread->group_tag);
+  thread_ready_enqueue(child_thread);
+  thread_register(child_thread);
   return child_thread->pid;
-}
\ No newline at end of file
+}
@@ -4,5 +4,6 @@
 #include "thread.h"
 #include "stdint.h"
 pid_t sys_fork();
+pid_t sys_clone(void* entry, void* stack);
 
 #endif
\ No newline at end of file
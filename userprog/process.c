@@ -1,4 +1,5 @@
 #include "process.h"
+#include "acct.h"
 #include "console.h"
 #include "debug.h"
 #include "global.h"
@@ -29,12 +30,35 @@ void start_process(void* filename_) {
   asm volatile("movl %0,%%esp;jmp intr_exit" ::"g"(proc_stack) : "memory");
 }
 
+#define KERNEL_PGDIR_PHY 0x100000
+static uint32_t active_pgdir_phy = KERNEL_PGDIR_PHY;  // 当前CR3中的页目录
+
+// 关中断切换，保证CR3与active_pgdir_phy始终一致
+static void load_cr3(uint32_t pgdir_phy) {
+  enum intr_status old_status = intr_disable();
+  asm volatile("movl %0,%%cr3" ::"r"(pgdir_phy) : "memory");
+  active_pgdir_phy = pgdir_phy;
+  acct_cr3_load();
+  intr_set_status(old_status);
+}
+
+// 内核线程只访问内核空间，而内核空间在所有页目录中都相同，
+// 因此沿用上一个任务的页目录；同一线程组的线程共用页目录，同样不必重载CR3
 void page_dir_activate(struct task_struct* p_thread) {
-  uint32_t page_dir_phy_addr = 0x100000;
-  if (p_thread->pgdir != NULL) {
-    page_dir_phy_addr = addr_v2p((uint32_t)p_thread->pgdir);
+  if (p_thread->pgdir == NULL) {
+    return;
+  }
+  uint32_t page_dir_phy_addr = addr_v2p((uint32_t)p_thread->pgdir);
+  if (page_dir_phy_addr != active_pgdir_phy) {
+    load_cr3(page_dir_phy_addr);
+  }
+}
+
+// 释放页目录前调用：若它仍在CR3中(例如被内核线程沿用)，先换回内核页目录
+void page_dir_release(uint32_t* pgdir) {
+  if (addr_v2p((uint32_t)pgdir) == active_pgdir_phy) {
+    load_cr3(KERNEL_PGDIR_PHY);
   }
-  asm volatile("movl %0,%%cr3" ::"r"(page_dir_phy_addr) : "memory");
 }
 
 void process_activate(struct task_struct* p_thread) {
@@ -76,9 +100,7 @@ void process_execute(void* filename, char* name) {
   thread->pgdir = create_page_dir();
   block_desc_init(thread->u_block_desc);
   enum intr_status old_status = intr_disable();
-  ASSERT(!(elem_find(&thread_ready_list, &thread->general_tag)));
-  list_append(&thread_ready_list, &thread->general_tag);
-  ASSERT(!(elem_find(&thread_all_list, &thread->all_list_tag)));
-  list_append(&thread_all_list, &thread->all_list_tag);
+  thread_ready_enqueue(thread);
+  thread_register(thread);
   intr_set_status(old_status);
 }
\ No newline at end of file
@@ -10,6 +10,7 @@ uint32_t* create_page_dir(void);
 void start_process(void* filename_);
 void intr_init(void* func);
 void page_dir_activate(struct task_struct* p_thread);
+void page_dir_release(uint32_t* pgdir);
 void process_execute(void* filename, char* name);
 void process_activate(struct task_struct* p_thread);
 #endif
\ No newline at end of file
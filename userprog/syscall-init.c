@@ -1,16 +1,19 @@
 #include "syscall-init.h"
+#include "acct.h"
 #include "console.h"
 #include "exec.h"
 #include "file.h"
 #include "fork.h"
+#include "futex.h"
 #include "pipe.h"
 #include "print.h"
+#include "sched.h"
 #include "string.h"
 #include "syscall.h"
 #include "thread.h"
 #include "wait_exit.h"
 
-#define syscall_nr 32
+#define syscall_nr 64
 typedef void* syscall;
 syscall syscall_table[syscall_nr];
 
@@ -48,5 +51,21 @@ void syscall_init() {
   syscall_table[SYS_PIPE] = sys_pipe;
   syscall_table[SYS_FD_REDIRECT] = sys_fd_redirect;
   syscall_table[SYS_HELP] = sys_help;
+  syscall_table[SYS_CLONE] = sys_clone;
+  syscall_table[SYS_THREAD_EXIT] = sys_thread_exit;
+  syscall_table[SYS_THREAD_JOIN] = sys_thread_join;
+  syscall_table[SYS_FUTEX] = sys_futex;
+  syscall_table[SYS_TASKSTAT] = sys_taskstat;
+  syscall_table[SYS_SCHEDSTAT] = sys_schedstat;
+  syscall_table[SYS_SCHED_GROUP_CREATE] = sys_sched_group_create;
+  syscall_table[SYS_SCHED_SETGROUP] = sys_sched_setgroup;
+  syscall_table[SYS_SCHED_SETAFFINITY] = sys_sched_setaffinity;
+  syscall_table[SYS_SCHED_GETAFFINITY] = sys_sched_getaffinity;
+  syscall_table[SYS_SCHED_GROUPS] = sys_sched_groups;
+  syscall_table[SYS_SCHED_SETATTR] = sys_sched_setattr;
+  syscall_table[SYS_SCHED_GETATTR] = sys_sched_getattr;
+  syscall_table[SYS_SYNC] = sys_sync;
+  syscall_table[SYS_FSYNC] = sys_fsync;
+  syscall_table[SYS_MKFS] = sys_mkfs;
   put_str("  syscall_init done\n");
 }
@@ -62,68 +62,132 @@ static void release_prog_resource(struct task_struct* release_thread) {
   }
 }
 
-static bool find_child(struct list_elem* pelem, int32_t ppid) {
-  struct task_struct* pthread =
-      elem2entry(struct task_struct, all_list_tag, pelem);
-  if (pthread->parent_pid == ppid) {
-    return true;
+// 把退出进程的子进程(含僵尸)交给init(pid 1)收养，需关中断调用
+static void reparent_children(struct task_struct* pthread) {
+  struct task_struct* init_thread = pid2thread(1);
+  ASSERT(init_thread != NULL && init_thread != pthread);
+  while (!list_empty(&pthread->children)) {
+    struct task_struct* child =
+        elem2entry(struct task_struct, sibling_tag, list_pop(&pthread->children));
+    child->parent_pid = 1;
+    list_append(&init_thread->children, &child->sibling_tag);
   }
-  return false;
-}
-
-static bool find_hanging_child(struct list_elem* pelem, int32_t ppid) {
-  struct task_struct* pthread =
-      elem2entry(struct task_struct, all_list_tag, pelem);
-  if (pthread->parent_pid == ppid && pthread->status == TASK_HANGING) {
-    return true;
-  }
-  return false;
-}
-
-static bool init_adopt_a_child(struct list_elem* pelem, int32_t pid) {
-  struct task_struct* pthread =
-      elem2entry(struct task_struct, all_list_tag, pelem);
-  if (pthread->parent_pid == pid) {
-    pthread->parent_pid = 1;
+  if (!list_empty(&pthread->zombies)) {
+    while (!list_empty(&pthread->zombies)) {
+      list_append(&init_thread->zombies, list_pop(&pthread->zombies));
+    }
+    wake_up_all(&init_thread->child_exit_wq);
   }
-  return false;
 }
 
 pid_t sys_wait(int32_t* status) {
   struct task_struct* parent_thread = running_thread();
+  enum intr_status old_status = intr_disable();
   while (1) {
-    struct list_elem* child_elem = list_traversal(
-        &thread_all_list, find_hanging_child, parent_thread->pid);
-    if (child_elem != NULL) {
-      struct task_struct* child_thread =
-          elem2entry(struct task_struct, all_list_tag, child_elem);
+    if (!list_empty(&parent_thread->zombies)) {
+      struct task_struct* child_thread = elem2entry(
+          struct task_struct, zombie_tag, list_pop(&parent_thread->zombies));
       *status = child_thread->exit_status;
       uint16_t child_pid = child_thread->pid;
       thread_exit(child_thread, false);
+      intr_set_status(old_status);
       return child_pid;
     }
 
-    child_elem =
-        list_traversal(&thread_all_list, find_child, parent_thread->pid);
-    if (child_elem == NULL) {
+    if (list_empty(&parent_thread->children)) {
+      intr_set_status(old_status);
       return -1;
     } else {
-      thread_block(TASK_WAITING);
+      wait_queue_sleep_killable(&parent_thread->child_exit_wq);
+    }
+  }
+}
+
+// 主线程退出前让线程组中的其他线程退出并回收它们，之后才能释放共享的地址空间。
+// 可中断睡眠(futex、管道、join等)中的线程被摘下唤醒后自行退出，
+// 其余的在返回用户态后的下一个时钟中断里退出
+static void reap_group_threads(struct task_struct* leader) {
+  enum intr_status old_status = intr_disable();
+  struct list_elem* elem = leader->threads.head.next;
+  while (elem != &leader->threads.tail) {
+    struct task_struct* pthread =
+        elem2entry(struct task_struct, group_tag, elem);
+    pthread->killed = true;
+    if (pthread->status == TASK_BLOCKED && pthread->wait_elem != NULL &&
+        elem_linked(pthread->wait_elem)) {
+      list_remove(pthread->wait_elem);
+      thread_unblock(pthread);
+    }
+    elem = elem->next;
+  }
+  while (!list_empty(&leader->threads)) {
+    struct task_struct* pthread =
+        elem2entry(struct task_struct, group_tag, leader->threads.head.next);
+    if (pthread->status == TASK_HANGING) {
+      thread_exit(pthread, false);
+    } else {
+      wait_queue_sleep(&leader->child_exit_wq);
     }
   }
+  intr_set_status(old_status);
+}
+
+// 非主线程退出：只留下PCB和返回值等待join，进程资源仍归线程组
+void sys_thread_exit(void* retval) {
+  struct task_struct* cur = running_thread();
+  struct task_struct* leader = proc_of(cur);
+  if (leader == cur) {
+    sys_exit((int32_t)retval);
+  }
+  intr_disable();
+  cur->thread_retval = retval;
+  wake_up_all(&cur->child_exit_wq);
+  wake_up_all(&leader->child_exit_wq);
+  thread_block(TASK_HANGING);
+}
+
+// 等待同一线程组中的线程tid退出并回收它，成功返回0
+int32_t sys_thread_join(pid_t tid, void** retval) {
+  struct task_struct* cur = running_thread();
+  enum intr_status old_status = intr_disable();
+  struct task_struct* pthread = pid2thread(tid);
+  if (pthread == NULL || pthread == cur || proc_of(pthread) == pthread ||
+      proc_of(pthread) != proc_of(cur)) {
+    intr_set_status(old_status);
+    return -1;
+  }
+  while (pthread->status != TASK_HANGING) {
+    wait_queue_sleep_killable(&pthread->child_exit_wq);
+    // 可能已被另一个join者回收
+    if (pid2thread(tid) != pthread) {
+      intr_set_status(old_status);
+      return -1;
+    }
+  }
+  if (retval != NULL) {
+    *retval = pthread->thread_retval;
+  }
+  thread_exit(pthread, false);
+  intr_set_status(old_status);
+  return 0;
 }
 
 void sys_exit(int32_t status) {
   struct task_struct* child_thread = running_thread();
+  if (proc_of(child_thread) != child_thread) {
+    sys_thread_exit((void*)status);
+  }
   child_thread->exit_status = status;
   if (child_thread->parent_pid == -1) {
     PANIC("sys_exit: child_thread->parent_pid is -1\n");
   }
-  list_traversal(&thread_all_list, init_adopt_a_child, child_thread->pid);
+  reap_group_threads(child_thread);
   release_prog_resource(child_thread);
+  // 挂入父进程的僵尸队列到阻塞之间不能被调度，否则父进程可能提前回收本PCB
+  intr_disable();
+  reparent_children(child_thread);
   struct task_struct* parent_thread = pid2thread(child_thread->parent_pid);
-  if (parent_thread->status == TASK_WAITING) {
-    thread_unblock(parent_thread);
-  }
+  list_append(&parent_thread->zombies, &child_thread->zombie_tag);
+  wake_up_all(&parent_thread->child_exit_wq);
   thread_block(TASK_HANGING);
 }